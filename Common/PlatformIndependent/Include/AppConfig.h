@@ -108,27 +108,49 @@ static const float_t		CAMERA_START_HEADING_RADIANS = 0.0;
 ***************************************************************************************************/
 // Leaf level is determined by (single) floating point precision of the camera.
 // see http://de.wikipedia.org/wiki/IEEE_754
+// It defines the world size and is the deepest level an octree may use (see Octree::setLeafLevel).
 static const uint8_t		OCTREE_LEAF_LEVEL = 15;
 
 static const float_t		OCTREE_SCALE = 20.0f;
 
-// We assume in city models every node is cutted by a plane thus x^2 node cells are occupied
+// Points of a node are written to disk padded to a multiple of this block size
 static const uint16_t		OCTREE_POINTS_PER_POINT_DATA_BLOCK = 31;
 
+// Points of a node are stored in one contiguous array. Arrays are allocated in size classes of
+// 32, 64, 128, 256 and 512 points and relocated to the next size class if they are full.
+// We assume in city models every node is cutted by a plane thus x^2 node cells are occupied
+static const uint16_t		OCTREE_POINT_ARRAY_MIN_CAPACITY = 32;
+static const uint8_t		OCTREE_POINT_ARRAY_SIZE_CLASS_COUNT = 5;
+
 // Length of the ring buffer to restore nodes from backing store. The rendering thread pushes
 // nodes to be restored into the buffer and the backing store thread pulls them out.
 static const uint32_t		OCTREE_ASYNC_NODE_RESTORE_RING_BUFFER_LENGTH = 4096;
 
 
-// Both values should be factors ot 4096 for best memory alignment/least iOS padding
-// see http://developer.apple.com/mac/library/documentation/Performance/Conceptual/ManagingMemory/Articles/MemoryAlloc.html
+// Memory budget of the octree in MB. It is given at runtime (see Octree::Octree) and is divided
+// between the nodes and the point array size classes (32, 64, 128, 256 and 512 points) by the
+// weights below. Memory is committed in chunks as the octree grows and released if unused.
+// On desktops the budget is raised to a share of the physical memory (see AppCore).
+static const uint32_t		OCTREE_NODE_MEMORY_WEIGHT = 16;
+static const uint32_t		OCTREE_POINT_ARRAY_MEMORY_WEIGHT[OCTREE_POINT_ARRAY_SIZE_CLASS_COUNT] = {40, 16, 12, 8, 4};
+static const uint32_t		OCTREE_MEMORY_BUDGET_MB = 96;
+#if (TARGET_IPHONE_SIMULATOR || TARGET_OS_IPHONE)
+static const uint32_t		OCTREE_MEMORY_BUDGET_PHYSICAL_MEMORY_PERCENT = 0;
+#else
+static const uint32_t		OCTREE_MEMORY_BUDGET_PHYSICAL_MEMORY_PERCENT = 50;
+#endif
+
+// Nodes and point arrays are backed by huge pages on desktops (see MemoryPool::HugePageMode).
+// On multi-socket hosts the memory is bound to the NUMA node of the rendering thread.
 #if (TARGET_IPHONE_SIMULATOR || TARGET_OS_IPHONE)
-static const uint32_t		OCTREE_NODE_MEMORY_MB = 16;
-static const uint32_t		OCTREE_QUANT_POINT_BLOCK_MEMORY_MB = 80;
+static const uint8_t		OCTREE_HUGE_PAGE_MODE = 0;
 #else
-static const uint32_t		OCTREE_NODE_MEMORY_MB = 16;
-static const uint32_t		OCTREE_QUANT_POINT_BLOCK_MEMORY_MB = 80;
+static const uint8_t		OCTREE_HUGE_PAGE_MODE = 1;
 #endif
+static const bool			OCTREE_BIND_MEMORY_TO_RENDER_NUMA_NODE = true;
+
+// Number of nodes that are relocated into depth-first order per idle frame (see Octree::compactMemory)
+static const uint32_t		OCTREE_COMPACTION_NODES_PER_IDLE_FRAME = 4096;
 
 static const char* const	OCTREE_BACKING_STORE_FILENAME = "nodes.dat";
 
@@ -167,7 +189,10 @@ static const int			LOCK_COUNT = 4;
 /***************************************************************************************************
 	Architecture Config
 ***************************************************************************************************/
-//#define PORTABLE_64_BIT 1
+#if defined(__LP64__) || defined(_WIN64)
+#define PORTABLE_64_BIT 1
+#else
 #define PORTABLE_32_BIT 1
+#endif
 
 #endif
\ No newline at end of file
@@ -40,9 +40,21 @@ namespace WVSClientCommon
 
 class BackingStore
 {
+	static const uint32_t		INITIAL_FILE_POSITION_CAPACITY = 4096;
+	
+	// File positions of the swapped children of all nodes in memory. Siblings have consecutive
+	// handles. Free groups are kept in one list per group size. The first slot of a free group
+	// holds the next free handle instead of a position.
+	long*						_filePositions;
+	uint32_t					_filePositionCapacity;
+	uint32_t					_filePositionCount;
+	uint32_t					_firstFreeFilePositionHandle[8];
 
 protected:
 	FILE*						_file;
+	
+	// Stores the non-zero file positions as the swapped children of the node
+	void storeChildFilePositions(const long childrenFilePosition[8], Octree::Node* const outNode);
 
 public:
 	BackingStore();
@@ -50,19 +62,53 @@ public:
 	
 	bool init(const char* const filename);
 	bool close() const;
+	
+	// Nodes keep the file positions of their swapped children as 32 bit handle of the first child
+	// (see Octree::Node::children). The handle of a sibling is the handle of the first child
+	// plus its rank. Handles are never 0.
+	uint32_t storeFilePositions(const long* const positions, const uint8_t count);
+	inline long getFilePosition(const uint32_t handle) const;
+	void releaseFilePositions(const uint32_t handle, const uint8_t count);
 
-	virtual bool readNode(const long position, Octree::Node* const outNode) const;
-	bool readQuantPointBlock(	long position, 
-								const uint32_t numberOfBlocks,
-								Octree::QuantPointBlock* const outfirstQuantPointBlock) const;
+	// Stores the file positions of the children of the node (see storeFilePositions)
+	virtual bool readNode(const long position, Octree::Node* const outNode);
+	bool readQuantPoints(	long position, 
+							const uint16_t quantPointCount,
+							QuantPoint* const outQuantPoints) const;
 								
 	virtual bool writeNode(	const Octree::Node* const node, 
+							const QuantPoint* const quantPoints,
 							long* const outPosition) const;
 	
+	// Called if a node in memory is moved to another slot (see Octree::moveNodeToSlot)
+	virtual void moveNode(const Octree::Node* const node, const Octree::Node* const target);
+	
+	// Called if a node slot is freed without writing the node (see Octree::restoreChildNodesFromBackingStore)
+	virtual void releaseNode(const Octree::Node* const node);
+	
 	bool writeNodeToFile(	FILE* const file, 
 							const Octree::Node* const node,
+							const QuantPoint* const quantPoints,
 							long* const outPosition) const;
+	
+	// Appends the world transform and the leaf level to a point cloud file (behind the nodes)
+	static bool writeFooter(	FILE* const file,
+								const Octree::WorldTransform* const transform,
+								const uint8_t leafLevel);
+	
+	// Returns the end of the nodes. Files without footer yield the identity transform and
+	// OCTREE_LEAF_LEVEL.
+	static long readFooter(	FILE* const file,
+							Octree::WorldTransform* const outTransform,
+							uint8_t* const outLeafLevel);
 };
+
+
+inline long BackingStore::getFilePosition(const uint32_t handle) const
+{
+	assert((handle > 0) && (handle <= _filePositionCount));
+	return _filePositions[handle - 1];
+}
 	
 
 }
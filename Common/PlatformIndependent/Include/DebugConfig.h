@@ -59,9 +59,18 @@
 // Switch here between custom memory allocation and OS memory allocation
 #define USE_MEMORY_POOL 1
 
+// Allocate pool elements through per-thread caches that are refilled and flushed in batches
+#define USE_MEMORY_POOL_MAGAZINES 1
+
 // Enabled/Disable backing store
 #define USE_BACKING_STORE 1
 
+// Quantize batches of points and normals with SSE2 (x86) or NEON (ARM) instead of scalar code
+#define USE_SIMD_POINT_QUANTIZATION 1
+
+// Scan volume slices for occupied voxels with SSE2 (x86) or NEON (ARM) instead of scalar code
+#define USE_SIMD_VOLUME_SCAN 1
+
 //#define IMPORT_STATIC_POINT_CLOUD 1
 
 #define USE_STATIC_POINT_CLOUD 1
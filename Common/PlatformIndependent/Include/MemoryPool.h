@@ -31,6 +31,9 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
 
 namespace WVSClientCommon
@@ -39,43 +42,154 @@ namespace WVSClientCommon
 
 class MemoryPool
 {
+public:
+	// Bins are randomly accessed. Huge pages reduce the TLB misses of a traversal.
+	// HUGE_PAGES_TRANSPARENT asks the OS to back the bins with huge pages where it can.
+	// HUGE_PAGES_EXPLICIT takes the bins from the preallocated huge page pool of the OS. It falls
+	// back to transparent huge pages if the pool is too small.
+	enum HugePageMode
+	{
+		HUGE_PAGES_NONE = 0,
+		HUGE_PAGES_TRANSPARENT,
+		HUGE_PAGES_EXPLICIT
+	};
 
-	// Every bin saves the last 1024 free blocks
-	static const uint16_t INDEX_WITH_FREE_BLOCK_COUNT = 1024;
-
+private:
+	// Enough levels for 64^6 elements per bin
+	static const uint8_t MAX_BITMAP_LEVEL_COUNT = 6;
+	
+	// Bins reserve address space for all their elements but commit memory in chunks of about
+	// this size on demand. Chunks without elements are released.
+	static const size_t CHUNK_SIZE = 2 * 1024 * 1024;
+	static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+	
+	// Maximal number of free elements a thread caches per bin
+	static const size_t MAGAZINE_CAPACITY = 32;
+	
+	// Runs of consecutive elements are allocated as one element (e.g. the sibling nodes of the
+	// octree). They do not cross a word of the bitmap.
+	static const size_t MAX_RUN_LENGTH = 8;
+	
+	// Level 0 has one bit per element (set if the element is used). Every further level has one
+	// bit per word of the level below (set if the word is full). The top level is a single word.
+	// Thus a free element is found by descending from the top level with count-trailing-zeros.
+	// The parallel payload (optional) holds one element of parallelElementSize per element.
+	// No word of level 0 in front of runWordID[length - 1] has a free run of that length.
 	struct MemoryBin
 	{
-		uint8_t*	index;
-		uint8_t*	indexWithFreeBlock[INDEX_WITH_FREE_BLOCK_COUNT];
+		uint64_t*	usedBits[MAX_BITMAP_LEVEL_COUNT];
+		uint8_t		levelCount;
 		uint8_t*	payload;
+		uint8_t*	parallelPayload;
 		size_t		elementSize;
+		size_t		parallelElementSize;
 		size_t		elementCount;
+		size_t		usedElementCount;
+		size_t		chunkElementCount;
+		size_t		chunkCount;
+		size_t		committedChunkCount;
+		size_t		spareChunkID;
+		uint32_t*	chunkUsedElementCount;
+		bool*		isChunkCommitted;
+		bool		isExplicitHugePageBin;
+		size_t		magazineBatchSize;
+		size_t		runWordID[MAX_RUN_LENGTH];
 	};
+	
+	// Free elements cached by a thread. A magazine is refilled from and flushed to the bins in
+	// batches. Thus the pool lock is taken once per batch instead of once per element.
+	struct Magazine
+	{
+		MemoryPool*	pool;
+		Magazine*	next;
+		size_t*		elementCount;
+		void**		elements;
+	};
+	
+	const size_t		_binCount;
+	MemoryBin*			_bin;
+	const HugePageMode	_hugePageMode;
+	int32_t				_numaNode;
+	mutable volatile int32_t	_lock;
+	Magazine*			_magazines;
+#if defined(_WIN32)
+	uint32_t			_magazineKey;
+#else
+	pthread_key_t		_magazineKey;
+#endif
 
-	const size_t	_binCount;
-	MemoryBin*		_bin;
-
-	uint8_t countBitsInAByte(uint8_t byte) const;
-	uint8_t* popFreeBlockPointer(const size_t binID);
-	void pushFreeBlockPointer(const size_t binID, uint8_t* const ptr);
+	void acquireLock() const;
+	void releaseLock() const;
+	
+	void adviseMemory(const size_t binID, uint8_t* const ptr, const size_t size, const bool moveCommittedPages) const;
+	bool commitChunk(const size_t binID, const size_t chunkID);
+	void releaseChunk(const size_t binID, const size_t chunkID);
+	size_t findFreeElement(const size_t binID) const;
+	size_t findFreeRun(const size_t binID, const size_t count, const size_t firstElementID) const;
+	void* useElement(const size_t binID, const size_t elementID);
+	void* useRun(const size_t binID, const size_t firstElementID, const size_t count);
+	void* allocElement(const size_t binID);
+	void freeElement(const size_t binID, const void* const ptr);
 	
+	Magazine* getThreadMagazine();
+	void flushMagazine(Magazine* const magazine);
+
 public:
-	MemoryPool(const size_t binCount);
+	MemoryPool(const size_t binCount, const HugePageMode hugePageMode = HUGE_PAGES_NONE);
 	~MemoryPool();
 	
-	void setupElementBin(const size_t binID, const size_t elementSize, const size_t elementCount);
+	void setupElementBin(	const size_t binID,
+							const size_t elementSize,
+							const size_t poolSize,
+							const size_t parallelElementSize = 0);
+	
+	// Elements are allocated from and freed to a known bin in constant time
+	void* binAllocElement(const size_t binID);
+	void binFreeElement(const size_t binID, const void* const ptr);
+	
+	// Batches of elements are allocated and freed with a single lock
+	size_t binAllocElements(const size_t binID, void** const elements, const size_t count);
+	void binFreeElements(const size_t binID, void* const* const elements, const size_t count);
+	
+	// Runs are allocated from the lowest word with a free run. Their elements can be freed one
+	// by one, too.
+	void* binAllocElementRun(const size_t binID, const size_t count);
+	void binFreeElementRun(const size_t binID, const void* const ptr, const size_t count);
+	
+	// Elements are moved to lower addresses to empty chunks (see Octree::compactMemory)
+	bool binAllocElementRunAt(const size_t binID, const void* const ptr, const size_t count);
+	void* binAllocElementRunBehind(const size_t binID, const void* const ptr, const size_t count);
+	void* binRelocateElement(const size_t binID, const void* const ptr);
+	bool isElementUsed(const size_t binID, const void* const ptr) const;
+	void* findUsedElement(const size_t binID, const void* const ptr) const;
+	
+	// Elements are allocated from and freed to the magazine of the calling thread. Elements
+	// cached in magazines are counted as used by the bins.
+	void* threadAllocElement(const size_t binID);
+	void threadFreeElement(const size_t binID, const void* const ptr);
+	void flushThreadMagazine();
+	
+	// Bin is looked up by element size or address
 	void* binAlloc(const size_t size);
 	void binFree(const void* const ptr);
 	
 	size_t countElementsInBin(const size_t binID) const;
 	size_t getMaximalNumberOfElementsInBin(const size_t binID) const;
+	size_t countCommittedBytesInBin(const size_t binID) const;
 	
-	const void* const getIndexPointer(const size_t binID) const;
 	const void* const getPayloadPointer(const size_t binID) const;
+	void* const getParallelPayloadPointer(const size_t binID) const;
+	
+	bool bindToCurrentNUMANode();
 	
 	void printStatistics() const;
-};
 	
+	static size_t getPhysicalMemorySize();
+	
+	// Flushes and deletes the magazine of a thread on its exit
+	static void destroyThreadMagazine(void* const magazine);
+};
+
 
 }
 
@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef NORMAL_QUANTIZER_H
+#define NORMAL_QUANTIZER_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MiniGL.h"
+
+
+namespace WVSClientCommon
+{
+
+
+/**
+	Maps normals to the 7 bit normal index of a point (see QuantPoint::positionNormal).
+
+	The 128 normals of the codebook are distributed evenly on the unit sphere (spherical Fibonacci
+	lattice). The same codebook is uploaded to the point shader (normals[128]) to decode the index.
+
+	Instead of comparing a normal with all 128 codebook normals, the normal is projected onto a cube map.
+	Every texel of the cube map stores the codebook normal that is closest to the texel center. Thus
+	a lookup costs one division and a table read. The result differs from the exhaustive search only for
+	normals that are almost equally close to two codebook normals.
+ */
+class NormalQuantizer
+{
+	static const uint32_t	CUBE_MAP_FACE_EDGE_LENGTH = 64;
+
+	static float_t			_normals[];
+	static uint8_t			_cubeMap[];
+	static bool				_isInitialized;
+
+	static void calcCubeMapTexelDirection(	const uint32_t face,
+											const uint32_t u,
+											const uint32_t v,
+											VECTOR3* const outDirection);
+
+	static inline uint8_t lookupCubeMap(const uint32_t face, const int32_t u, const int32_t v);
+
+
+public:
+	static const uint32_t	NORMAL_COUNT = 128;
+
+	/**
+		Builds the codebook and the cube map. Must be called once before any other
+		function is used. Subsequent calls do nothing (not thread safe).
+	 */
+	static void init();
+
+	// Returns NORMAL_COUNT codebook normals (x, y, z)
+	static const float_t* getNormals();
+
+	// Exhaustive search over all codebook normals (reference for quantizeNormal)
+	static uint8_t findClosestNormal(const VECTOR3* const normal);
+
+	// Normals need not be normalized. A zero normal results in index 0.
+	static uint8_t quantizeNormal(const VECTOR3* const normal);
+
+	// Same as quantizeNormal for a batch of normals (SSE2/NEON, see USE_SIMD_POINT_QUANTIZATION)
+	static void quantizeNormals(const VECTOR3* const normals, const size_t count, uint8_t* const outNormalIndices);
+};
+
+
+}
+
+#endif // NORMAL_QUANTIZER_H
@@ -59,16 +59,18 @@ class Octree
 {
 
 
-// Magic byte sequence to identify locked nodes. The "1" in the on the LSB is necessary to ensure
-// we don't collide with a real node pointer address (they are always 2 byte aligned)
-#if PORTABLE_32_BIT
-static const int		OCTREE_LOCKED_NODE_IDENTIFIER = 0xBADBABE1;
-#elif PORTABLE_64_BIT
-static const int		OCTREE_LOCKED_NODE_IDENTIFIER = 0xFFFFFFFFBADBABE1;
-#endif
-
 public:
 
+	// Nodes reference each other by their position in the node bin of the memory pool plus one.
+	// Thus 0 means "no node" and the links have 32 bit on every architecture (see getNode).
+	// Siblings have consecutive positions (see Node::children).
+	typedef uint32_t		NodeIndex;
+	
+	// Point arrays are referenced by their position in the bin of their size class plus one. The
+	// size class follows from the point count of the node (see getPointArray). Thus 0 means "no
+	// points" and the reference has 32 bit on every architecture, too.
+	typedef uint32_t		PointArrayIndex;
+	
 	#if COMPACT_NODE_REGION_ENCODING
 	static const uint8_t	OCTREE_REGION_BITS_PER_DIMENSION	= 8;
 	#else
@@ -78,70 +80,120 @@ public:
 	static const uint8_t	OCTREE_NODES_IN_RESTORE_QUEUE		= 0x1;
 	static const uint8_t	OCTREE_RENDERING_CANCELED			= 0x2;
 	static const uint8_t	OCTREE_REGION_ORGIN_INVALID			= 0x4;
+	
+	// Replacement flags of a node (see Node::clockFlags and touchNode)
+	static const uint8_t	OCTREE_NODE_IN_CLOCK				= 0x1;
+	static const uint8_t	OCTREE_NODE_REFERENCED				= 0x2;
+	static const uint8_t	OCTREE_NODE_LOCKED					= 0x4;
 
-	struct QuantPointBlock
+	// Node fields that are only needed for eviction and point insertion. They are stored apart
+	// from the nodes in an array parallel to the node bin (see getNodeState). Thus the render
+	// traversal only touches the nodes it visits.
+	struct NodeState
 	{
-		QuantPoint			points[OCTREE_POINTS_PER_POINT_DATA_BLOCK];
-		QuantPointBlock*	next;
+		NodeIndex			parent;							// 4 byte
+		uint64_t			occupancy[8];					// 72 byte (incl. padding)
+		
+		void reset()
+		{
+			parent = 0;
+			
+			for (uint8_t i = 0; i < 8; i++) occupancy[i] = 0;
+		}
 		
-		inline void reset()
+		// Cell ID is the quantized position without normal (zzzyyyxxx)
+		inline bool isCellOccupied(const uint16_t cellID) const
 		{
-			memset(points, 0, sizeof(QuantPointBlock));
+			assert(cellID < 512);
+			return (occupancy[cellID >> 6] & (uint64_t(1) << (cellID & 63)));
+		}
+		
+		inline void setCellOccupied(const uint16_t cellID)
+		{
+			assert(cellID < 512);
+			occupancy[cellID >> 6] |= (uint64_t(1) << (cellID & 63));
+		}
+		
+		// Points are stored in the order of their cell IDs. Thus the index of a point is equal to
+		// the number of occupied cells in front of it.
+		inline uint16_t calcCellRank(const uint16_t cellID) const
+		{
+			assert(cellID < 512);
+			const uint8_t word = cellID >> 6;
+			
+			uint16_t rank = __builtin_popcountll(occupancy[word] & ((uint64_t(1) << (cellID & 63)) - 1));
+			for (uint8_t i = 0; i < word; ++i) rank += __builtin_popcountll(occupancy[i]);
+			
+			return rank;
 		}
 	};
 	
 	struct Node
 	{
-		Node*				prevUsedNode;					// 4 byte
-		Node*				nextUsedNode;					// 8 byte
-		QuantPointBlock*	data;							// 12 byte
-		Node*				parent;							// 16 byte
-		union												// 48 byte
-		{
-			// iPhone ARM is a 32bit architecture
-			// Thus sizeof(Node*) == sizeof(long) == 4
-			Node*				children[8];
-			long				childrenFilePosition[8];
-		};
-		uint16_t			quantPointCount;				// 50 byte
-		uint8_t				childrenInMemory;				// 51 byte
+		// Siblings are stored as one block in the order of their child IDs (see childMask). If
+		// the block is in memory, this is the index of its first node. Otherwise it is the file
+		// position handle of the first child (see BackingStore::storeFilePositions). 0 if there
+		// is no child. Fields are ordered by alignment.
+		PointArrayIndex		pointArray;						// 4 byte
+		uint32_t			children;						// 8 byte
+		uint16_t			quantPointCount;				// 10 byte
+		uint8_t				childMask;						// 11 byte
+		bool				childrenInMemory;				// 12 byte
+		uint8_t				clockFlags;						// 16 byte (incl. padding)
 		
 		void reset()
 		{
-			prevUsedNode = NULL;
-			nextUsedNode = NULL;
-			data = NULL;
-			parent = NULL;
+			pointArray = 0;
+			children = 0;
 			quantPointCount = 0;
-			childrenInMemory = 0xFF; // = all children in memory
-			
-			for (uint8_t i = 0; i < 8; i++)
-			{
-				children[i] = NULL;
-			}
+			childMask = 0;
+			childrenInMemory = true;
+			clockFlags = 0;
 		}
 		
-		inline bool isChildInMemory(const int8_t childID) const
+		// Child IDs are visited with a bit walk over these masks (lowest ID first), e.g.
+		// for (uint8_t mask = node->childMask; mask != 0; mask &= mask - 1) { __builtin_ctz(mask) ... }
+		inline bool hasChild(const uint8_t childID) const
 		{
 			assert(childID < 8);
-			return (childrenInMemory & (1 << childID));
+			return (childMask & (1 << childID));
 		}
 		
-		inline void setChildInMemory(const int8_t childID)
+		inline uint8_t getChildCount() const
 		{
-			assert(childID < 8);
-			childrenInMemory |= (1 << childID);
+			return __builtin_popcount(childMask);
 		}
 		
-		inline void unsetChildInMemory(const int8_t childID)
+		// Position of a child within the block of its siblings
+		inline uint8_t calcChildRank(const uint8_t childID) const
 		{
 			assert(childID < 8);
-			childrenInMemory &= ~(1 << childID);
+			return __builtin_popcount(childMask & ((1 << childID) - 1));
+		}
+		
+		inline uint8_t getChildrenInMemoryMask() const
+		{
+			return (childrenInMemory ? childMask : 0);
+		}
+		
+		inline uint8_t getSwappedChildrenMask() const
+		{
+			return (childrenInMemory ? 0 : childMask);
 		}
 		
-		inline bool isLocked() const
+		// Nodes without children have their (empty) block in memory
+		inline bool areChildrenInMemory() const
 		{
-			return (prevUsedNode == (Node*)OCTREE_LOCKED_NODE_IDENTIFIER);
+			return childrenInMemory;
+		}
+		
+		// Children is either a node index or a file position handle (see children)
+		inline void setChildren(const uint8_t mask, const uint32_t firstChild, const bool isInMemory)
+		{
+			assert((mask == 0) == (firstChild == 0));
+			childMask = mask;
+			children = firstChild;
+			childrenInMemory = isInMemory || (mask == 0);
 		}
 	};
 	
@@ -159,6 +211,46 @@ public:
 		Node*						node;
 		FIXPVECTOR3					center;
 	};
+	
+	
+	struct MortonPoint
+	{
+		uint64_t					mortonKey;
+		FIXPVECTOR3					position;
+		uint32_t					pointID;
+		
+		inline bool operator<(const MortonPoint& other) const
+		{
+			return (mortonKey < other.mortonKey);
+		}
+	};
+	
+	
+	struct LODCell
+	{
+		uint16_t					red;
+		uint16_t					green;
+		uint16_t					blue;
+		uint8_t						count;
+		uint8_t						normalIndex;
+	};
+	
+	
+	// Accumulates the points of all child nodes per cell of a node
+	struct LODGrid
+	{
+		uint64_t					occupancy[8];
+		LODCell						cells[8*8*8];
+	};
+	
+	
+	// Maps the source coordinates of a data set to octree coordinates (position * scale + translation).
+	// It is stored in the point cloud file (see BackingStore::writeFooter).
+	struct WorldTransform
+	{
+		float_t						scale;
+		VECTOR3						translation;
+	};
 
 
 private:
@@ -182,14 +274,29 @@ private:
 	uint32_t							_nodeCount;
 	uint32_t							_pointCount;
 	Node*								_rootNode;
-	Node*								_leastRecentlyUsedNode;
-	Node*								_mostRecentlyUsedNode;
+	uint32_t							_clockHand;
 	MemoryPool*							_memoryPool;
+	Node*								_firstNode;
+	NodeState*							_nodeStates;
+	QuantPoint*							_firstPointArray[OCTREE_POINT_ARRAY_SIZE_CLASS_COUNT];
 	BackingStore*						_backingStore;
 	Node*								_asyncRestoreRingBuffer[OCTREE_ASYNC_NODE_RESTORE_RING_BUFFER_LENGTH];
 	uint32_t							_asyncRestoreRingBufferTail;
 	bool								_instantNodeRestore;
 	uint32_t							_instantNodeRestoreCount;
+	bool								_isLockingEnabled;
+	bool								_isLODGenerationDeferred;
+	bool								_isStaticFile;
+	WorldTransform						_worldTransform;
+	uint8_t								_leafLevel;
+	
+	// Position of the incremental compaction in the depth-first order (see compactMemory)
+	Node*								_compactionPath[OCTREE_LEAF_LEVEL + 1];
+	uint8_t								_compactionChildID[OCTREE_LEAF_LEVEL + 1];
+	uint8_t								_compactionLevel;
+	uint32_t							_compactionNodeID;
+	uint32_t							_compactionRelocationCount;
+	bool								_isMemoryCompacted;
 	
 	uint32_t*							_regionLevelBuffer;
 	uint32_t*							_voxelBuffer;
@@ -204,18 +311,39 @@ private:
 	uint16_t*							_voxelAccu;
 #endif
 
-	void checkLRU();
+	void acquireLock(const uint32_t lockID) const;
+	void releaseLock(const uint32_t lockID) const;
+	
+	inline Node* getNode(const NodeIndex index) const;
+	inline NodeIndex getNodeIndex(const Node* const node) const;
+	inline Node* getChild(const Node* const node, const uint8_t childID) const;
+	inline NodeState* getNodeState(const NodeIndex index) const;
+	inline NodeState* getNodeState(const Node* const node) const;
+	inline QuantPoint* getPointArray(const Node* const node) const;
+	inline PointArrayIndex getPointArrayIndex(const QuantPoint* const pointArray, const uint16_t pointCount) const;
+	inline bool isNodeLocked(const Node* const node) const;
+	void resetNode(Node* const node);
+	
 	void touchNode(Node* const node);
 	void lockNode(Node* const node);
 	void unlockNode(Node* const node);
 	
-	void freeNodeFromMemory(const Node* const node);
+	Node* addChildNode(Node* const parentNode, const uint8_t childID);
+	void removeChildNode(Node* const parentNode, const uint8_t childID);
+	void moveNodeToSlot(Node* const node, Node* const target);
+	void freeChildBlockFromMemory(Node* const parentNode);
+	bool isChildBlockEvictable(const Node* const parentNode) const;
+	bool isChildBlockLocked(const Node* const parentNode) const;
+	
+	bool isNodeResident(const Node* const node) const;
+	void relocateChildBlock(Node* const parentNode, Node* const target);
+	void placeChildBlockInCompactionOrder(const uint8_t level);
+	void compactPointArray(Node* const node);
 	
-	void restoreChildNodesFromBackingStore(Node* parentNode);
-	bool restoreNodeFromBackingStore(Node* const parentNode, const uint8_t nodeID);
+	bool restoreChildNodesFromBackingStore(Node* const parentNode);
 	
-	void swapNodeToBackingStore(Node* node, int parentNodeID);
-	void swapLeastRecentlyUsedNodesToBackingStore();
+	void swapChildBlockToBackingStore(Node* const parentNode);
+	void swapUnreferencedNodeToBackingStore();
 	
 	void calcCenterOfChildNode(	FIXPVECTOR3* const center, 
 								const uint8_t childNodeID,
@@ -238,8 +366,56 @@ private:
 		Node* const node,
 		const QuantPoint::PositionNormal quantizedPosition,
 		QuantPoint** outQuantPoint);
+	
+	void rebuildOccupancy(Node* const node) const;
+	
+	static inline uint16_t calcPointArrayCapacity(const uint16_t pointCount)
+	{
+		// Smallest size class that holds the given number of points
+		uint16_t capacity = OCTREE_POINT_ARRAY_MIN_CAPACITY;
+		while (capacity < pointCount) capacity <<= 1;
+		
+		return capacity;
+	}
+	
+	// Bin of the memory pool that holds the size class (see calcPointArrayCapacity)
+	static inline uint8_t calcPointArrayBinID(const uint16_t pointCount)
+	{
+		const uint8_t binID = 1 + __builtin_ctz(calcPointArrayCapacity(pointCount) / OCTREE_POINT_ARRAY_MIN_CAPACITY);
+		assert(binID <= OCTREE_POINT_ARRAY_SIZE_CLASS_COUNT);
+		
+		return binID;
+	}
+	
+	void insertQuantPointIntoCachedNodes(
+		const FIXPVECTOR3* const position,
+		const uint16_t fiveBitColor,
+		const uint8_t normalIndex,
+		uint8_t level);
 		
-	void writeNodeToDisk(FILE* const file, Node* const node, uint32_t* numberOfPointsWrittenToDisk);
+	void writeNodeToDisk(	FILE* const file,
+							Node* const node,
+							const uint8_t level,
+							LODGrid* const grids,
+							uint32_t* numberOfPointsWrittenToDisk);
+	
+	void generateLODsOfNode(Node* const node, const uint8_t level, LODGrid* const grids);
+	void writeLODCells(Node* const node, const LODGrid* const grid);
+	
+	void freeSubtreeFromMemory(Node* const node);
+	void removeRegionFromTree(const VECTOR3* const regionMin, const VECTOR3* const regionMax);
+	bool removeRegionOfNode(	Node* const node,
+								const FIXPVECTOR3* const nodeCenter,
+								const uint8_t level,
+								const FIXPVECTOR3* const regionMin,
+								const FIXPVECTOR3* const regionMax,
+								LODGrid* const grids);
+	void removeRegionCells(	Node* const node,
+							const FIXPVECTOR3* const nodeCenter,
+							const uint8_t level,
+							const FIXPVECTOR3* const regionMin,
+							const FIXPVECTOR3* const regionMax,
+							const LODGrid* const grid);
 		
 		
 public:
@@ -249,11 +425,26 @@ public:
 			const bool isStaticFile,
 			const MiniGL::ViewFrustum* const viewFrustum,
 			const AppCore* const callbackObject,
-			const RenderCallbackMethodT callbackMethod);
+			const RenderCallbackMethodT callbackMethod,
+			const uint32_t memoryBudgetMB = OCTREE_MEMORY_BUDGET_MB);
 	~Octree();
 	
 	void saveToDisk(const char* const filename);
 	
+	void setWorldTransform(const WorldTransform* const transform);
+	const WorldTransform* getWorldTransform() const;
+	
+	// Depth of the octree (at most OCTREE_LEAF_LEVEL). Static files provide their own leaf level.
+	void setLeafLevel(const uint8_t leafLevel);
+	uint8_t getLeafLevel() const;
+	
+	void disableLocking();
+	
+	bool bindMemoryToCurrentNUMANode();
+	
+	void deferLODGeneration();
+	void generateLODs();
+	
 	void updateScreenSizeRelatedConstants();
 	
 #if USE_VOXEL_ACCU
@@ -265,7 +456,32 @@ public:
 		const FIXPVECTOR3* const referenceCenter,
 		const int8_t level) const;
 	
+	static bool isWithinOctreeBounds(const FIXPVECTOR3* const position);
+	static void calcWorldTransform(const VECTOR3* const min, const VECTOR3* const max, WorldTransform* const outTransform);
+	static const uint8_t calcInsertionLevel(const WVSPoint* const point, const uint8_t leafLevel);
+	static const uint64_t calcMortonKey(const FIXPVECTOR3* const position);
+	
+	// LOD synthesis of a node from the points of its child nodes (see generateLODs)
+	static void accumulateLODCells(	LODGrid* const grid,
+									const QuantPoint* const childPoints,
+									const uint16_t childPointCount,
+									const uint8_t childID);
+	static void calcLODPoint(const LODCell* const cell, const uint16_t cellID, QuantPoint* const outQuantPoint);
+	
+	static void quantizePoints(	const WVSPoint* const points,
+								const size_t count,
+								FIXPVECTOR3* const outPositions,
+								uint16_t* const outFiveBitColors,
+								bool* const outIsWithinBounds);
+	
 	void addPoint(const WVSPoint* const point);
+	void addPoints(const WVSPoint* const points, const size_t count);
+	
+	bool removeRegion(const VECTOR3* const regionMin, const VECTOR3* const regionMax);
+	bool replaceRegion(	const VECTOR3* const regionMin,
+						const VECTOR3* const regionMax,
+						const WVSPoint* const points,
+						const size_t count);
 	
 	void copyPointsToBuffer(
 		const float_t projectedVoxelSizeThreshold,
@@ -290,8 +506,70 @@ public:
 	void printStatistics() const;
 	
 	void restoreNodes(const uint32_t nodeCount);
+	void compactMemory(const uint32_t maxNodeCount);
 };
+
+
+inline Octree::Node* Octree::getNode(const NodeIndex index) const
+{
+	return (index == 0) ? NULL : &(_firstNode[index - 1]);
+}
+
+
+inline Octree::NodeIndex Octree::getNodeIndex(const Node* const node) const
+{
+	return (node == NULL) ? 0 : NodeIndex(node - _firstNode) + 1;
+}
+
+
+// Must only be called for children in memory (see Node::areChildrenInMemory)
+inline Octree::Node* Octree::getChild(const Node* const node, const uint8_t childID) const
+{
+	assert(node->areChildrenInMemory() && node->hasChild(childID));
+	return getNode(node->children) + node->calcChildRank(childID);
+}
+
+
+inline Octree::NodeState* Octree::getNodeState(const NodeIndex index) const
+{
+	assert(index != 0);
+	return &(_nodeStates[index - 1]);
+}
+
+
+// Node state shares the position of the node in the node bin
+inline Octree::NodeState* Octree::getNodeState(const Node* const node) const
+{
+	assert(node != NULL);
+	return &(_nodeStates[node - _firstNode]);
+}
+
+
+// The point count of the node must match the size class of its array (see calcPointArrayBinID)
+inline QuantPoint* Octree::getPointArray(const Node* const node) const
+{
+	if (node->pointArray == 0) return NULL;
+	
+	const uint8_t sizeClass = calcPointArrayBinID(node->quantPointCount) - 1;
+	return _firstPointArray[sizeClass] + size_t(node->pointArray - 1) * (OCTREE_POINT_ARRAY_MIN_CAPACITY << sizeClass);
+}
+
+
+inline Octree::PointArrayIndex Octree::getPointArrayIndex(	const QuantPoint* const pointArray,
+															const uint16_t pointCount) const
+{
+	if (pointArray == NULL) return 0;
 	
+	const uint8_t sizeClass = calcPointArrayBinID(pointCount) - 1;
+	return PointArrayIndex((pointArray - _firstPointArray[sizeClass]) / (OCTREE_POINT_ARRAY_MIN_CAPACITY << sizeClass)) + 1;
+}
+
+
+inline bool Octree::isNodeLocked(const Node* const node) const
+{
+	return (node->clockFlags & OCTREE_NODE_LOCKED);
+}
+
 	
 }
 
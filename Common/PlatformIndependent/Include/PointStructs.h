@@ -76,6 +76,23 @@ struct QuantPoint
 		static const uint16_t positionMask = (1 << 16) - (1 << 7);
 		return (positionNormal & positionMask);
 	}
+	
+	// Averages the color with a 15bit color and sets the native bit
+	inline void mergeColor(const uint16_t fiveBitColor, const uint16_t nativeBit)
+	{
+		static const uint16_t redMask = 31; 
+		static const uint16_t greenMask = 31 << 5;
+		static const uint16_t blueMask = 31 << 10;
+		
+		const uint16_t red = (((colorNative & redMask) + 
+							  (fiveBitColor & redMask)) >> 1) & redMask;
+		const uint16_t green = (((colorNative & greenMask) + 
+								(fiveBitColor & greenMask)) >> 1) & greenMask;
+		const uint16_t blue = (((colorNative & blueMask) + 
+							   (fiveBitColor & blueMask)) >> 1) & blueMask;
+		
+		colorNative = red | green | blue | nativeBit;
+	}
 };
 
 
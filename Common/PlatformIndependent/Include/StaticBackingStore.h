@@ -49,10 +49,17 @@ public:
 						const Octree::Node* const firstNodePointer);
 	~StaticBackingStore();
 	
-	bool open(const char* const filename, Octree::Node* const node);
+	bool open(	const char* const filename,
+				Octree::Node* const node,
+				Octree::WorldTransform* const outTransform,
+				uint8_t* const outLeafLevel);
 	
-	bool readNode(const long position, Octree::Node* const outNode) const;
-	bool writeNode(const Octree::Node* const node, long* const outPosition) const;
+	bool readNode(const long position, Octree::Node* const outNode);
+	bool writeNode(	const Octree::Node* const node,
+					const QuantPoint* const quantPoints,
+					long* const outPosition) const;
+	void moveNode(const Octree::Node* const node, const Octree::Node* const target);
+	void releaseNode(const Octree::Node* const node);
 };
 	
 
@@ -31,9 +31,15 @@
 #include "DebugConfig.h"
 #include "PerformanceTests.h"
 #include "Octree.h"
+#include "MemoryPool.h"
+#include "NormalQuantizer.h"
+#include <algorithm>
 
 #if IMPORT_STATIC_POINT_CLOUD == 1
 //#include "ImportHelper.h"
+//#include "ParallelOctreeBuilder.h"
+//#include "StaticOctreeBuilder.h"
+//#include "StaticOctreeMerger.h"
 #endif
 
 #if DIRECT_VBO
@@ -71,6 +77,15 @@ AppCore::AppCore(MiniGL::Camera* const camera) :
 	APIFactory::GetInstance().getCachePathASCII(backingStoreFile, 2048, OCTREE_BACKING_STORE_FILENAME);
 #endif
 
+	// Use a share of the physical memory as node cache if it exceeds the default budget
+	uint64_t memoryBudgetMB = uint64_t(MemoryPool::getPhysicalMemorySize()) / (1024 * 1024) *
+								OCTREE_MEMORY_BUDGET_PHYSICAL_MEMORY_PERCENT / 100;
+#if PORTABLE_32_BIT
+	// Budget is reserved as address space
+	memoryBudgetMB = std::min<uint64_t>(memoryBudgetMB, 1024);
+#endif
+	memoryBudgetMB = std::max<uint64_t>(memoryBudgetMB, OCTREE_MEMORY_BUDGET_MB);
+
 	_viewFrustum = new MiniGL::ViewFrustum(_camera);
 	_viewFrustum->updateCameraViewParameterCache();
 	_octree = new Octree(	GPU_MAX_POINTS, 
@@ -78,7 +93,8 @@ AppCore::AppCore(MiniGL::Camera* const camera) :
 							isStaticPointCloud, 
 							_viewFrustum,
 							this,
-							&AppCore::renderCallbackHandler);
+							&AppCore::renderCallbackHandler,
+							uint32_t(memoryBudgetMB));
 							
 #if USE_VOXEL_ACCU
 	_octree->setVoxelAccuThreshold(OCTREE_POINT_ACCU_THRESHOLD);
@@ -148,8 +164,11 @@ AppCore::AppCore(MiniGL::Camera* const camera) :
 //	
 //	_octree->printStatistics();
 
-//	ImportHelper::ImportPLYFormat(_octree, "/Volumes/Data/MasterThesis/PointCloudSource/lucy_gedreht.ply", 343, 14027872);
-//	ImportHelper::ImportPLYFormat(_octree, "/Volumes/Data/MasterThesis/PointCloudSource/manuscript.ply", 341, 2155617);
+//	ImportHelper::ImportPLYFormat(_octree, "/Volumes/Data/MasterThesis/PointCloudSource/lucy_gedreht.ply", 5.0f, Vec3(0.0f, 0.0f, 0.0f));
+//	ImportHelper::ImportPLYFormat(_octree, "/Volumes/Data/MasterThesis/PointCloudSource/manuscript.ply", 25.0f, Vec3(0.0f, 0.0f, 2500.0f));
+
+//	Import all Berlin tiles listed in a manifest (one tile filename per line)
+//	ImportHelper::ImportRicoTiles(_octree, "/Volumes/Data/MasterThesis/Berlin/AlexUndHBF/tiles.txt");
 
 //ImportHelper::ImportRicoFormat(_octree,"/Volumes/Data/MasterThesis/Berlin/AlexUndHBF/41717.tfw-color.xyzrgba");
 //ImportHelper::ImportRicoFormat(_octree,"/Volumes/Data/MasterThesis/Berlin/AlexUndHBF/41718.tfw-color.xyzrgba");
@@ -192,10 +211,39 @@ AppCore::AppCore(MiniGL::Camera* const camera) :
 //ImportHelper::ImportRicoFormat(_octree,"/Volumes/Data/MasterThesis/Berlin/AlexUndHBF/42221.tfw-color.xyzrgba");
 //ImportHelper::ImportRicoFormat(_octree,"/Volumes/Data/MasterThesis/Berlin/AlexUndHBF/42222.tfw-color.xyzrgba");
 //	ImportHelper::ImportCTFormat(_octree, "/CTModell-Binary-8bit-256x512x171.raw");
-//ImportHelper::ImportPLYFormat(_octree, "/abc.ply", 335, 2741093);
+//	ImportHelper::ImportVolume(_octree, "/CTModell-Binary-8bit-256x512x171.raw", 256, 512, 171, Vec3(5.0f, 5.0f, 5.0f), 1, true);
+//ImportHelper::ImportPLYFormat(_octree, "/abc.ply", 5.0f, Vec3(0.0f, 0.0f, 0.0f));
+//	Fit the data set into the octree instead of hand-tuning scale and translation
+//	Octree::WorldTransform transform;
+//	if (ImportHelper::FitPLYFormat("/abc.ply", &transform))
+//	{
+//		_octree->setWorldTransform(&transform);
+//		_octree->setLeafLevel(12);
+//		ImportHelper::ImportPLYFormat(_octree, "/abc.ply", transform.scale, transform.translation);
+//	}
 //
 //	_octree->saveToDisk("/neu.dat");
 //	exit(0);
+
+//	Build the static point cloud file with one worker per core (see ParallelOctreeBuilder)
+//	ParallelOctreeBuilder builder(32, 2, "/Volumes/Data/MasterThesis/Temp/berlin");
+//	ImportHelper::ImportRicoTiles(&builder, "/Volumes/Data/MasterThesis/Berlin/AlexUndHBF/tiles.txt");
+//	builder.build("/berlin.dat");
+//	exit(0);
+
+//	Add a new tile to an existing static point cloud file (see StaticOctreeMerger)
+//	ParallelOctreeBuilder builder(32, 2, "/Volumes/Data/MasterThesis/Temp/berlin");
+//	ImportHelper::ImportRicoFormat(&builder, "/Volumes/Data/MasterThesis/Berlin/AlexUndHBF/42223.tfw-color.xyzrgba");
+//	builder.build("/berlin-delta.dat");
+//	StaticOctreeMerger merger;
+//	merger.merge("/berlin.dat", "/berlin-delta.dat", "/berlin-new.dat");
+//	exit(0);
+
+//	Build the static point cloud file out-of-core with bounded memory (see StaticOctreeBuilder)
+//	StaticOctreeBuilder builder(64 * 1024 * 1024, "/Volumes/Data/MasterThesis/Temp/berlin");
+//	ImportHelper::ImportRicoFormat(&builder,"/Volumes/Data/MasterThesis/Berlin/AlexUndHBF/41717.tfw-color.xyzrgba");
+//	builder.build("/berlin.dat");
+//	exit(0);
 #endif
 
 }
@@ -244,6 +292,12 @@ void AppCore::initOpenGL()
 //	loadPostProcessingShaderProgram(_postProcessingShaderProgram);
 	loadTextureShaderProgram(_textureShaderProgram);	
 	
+	// The normal codebook is constant (see NormalQuantizer)
+	NormalQuantizer::init();
+	glUseProgram(_pointShaderProgram.handle);
+	glUniform3fv(	_pointShaderProgram.uniforms[POINT_SHADER_UNIFORM_NORMALS_ARRAY],
+					NormalQuantizer::NORMAL_COUNT, NormalQuantizer::getNormals());
+	
 	// Setup point VBO
 	_pointsToRenderCount = 0;
 	
@@ -568,6 +622,9 @@ void AppCore::mainLoop(void* context, const GLuint* const frameBuffer,
 	}
 	
 	initOpenGL();
+	
+	// The octree is traversed by this thread
+	if (OCTREE_BIND_MEMORY_TO_RENDER_NUMA_NODE) _octree->bindMemoryToCurrentNUMANode();
 			
 	while(true)
 	{
@@ -697,6 +754,10 @@ bool AppCore::render()
 	if (!_renderingRequired)
 	{
 		APIFactory::GetInstance().unlock(OPENGL_LOCK);
+		
+		// Use the idle frame to move nodes that are traversed together close to each other
+		_octree->compactMemory(OCTREE_COMPACTION_NODES_PER_IDLE_FRAME);
+		
 		APIFactory::GetInstance().processUserInterfaceEvents();
 		return false;
 	}
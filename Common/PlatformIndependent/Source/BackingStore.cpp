@@ -29,19 +29,48 @@
 #include <iostream>
 #include "DebugConfig.h"
 #include <fcntl.h>
+#include <string.h>
 
 
 namespace WVSClientCommon
 {
 
 
+// Identifies the footer at the end of a point cloud file. Older files end with a node.
+static const char		FOOTER_MAGIC_V1[8] = {'W', 'V', 'S', 'X', 'F', 'R', 'M', '1'};
+static const char		FOOTER_MAGIC_V2[8] = {'W', 'V', 'S', 'X', 'F', 'R', 'M', '2'};
+
+// Version 1 stores the world transform only (leaf level OCTREE_LEAF_LEVEL)
+struct FooterRecordV1
+{
+	float_t				scale;
+	float_t				translation[3];
+	char				magic[8];
+};
+
+struct FooterRecordV2
+{
+	float_t				scale;
+	float_t				translation[3];
+	uint8_t				leafLevel;
+	uint8_t				reserved[3];
+	char				magic[8];
+};
+
+
 BackingStore::BackingStore()
 {
+	_filePositionCapacity = INITIAL_FILE_POSITION_CAPACITY;
+	_filePositions = new long[_filePositionCapacity];
+	_filePositionCount = 0;
+	
+	for (uint8_t i = 0; i < 8; ++i) _firstFreeFilePositionHandle[i] = 0;
 }
 
 
 BackingStore::~BackingStore()
 {
+	delete[] _filePositions;
 }
 
 
@@ -72,23 +101,84 @@ bool BackingStore::close() const
 }
 	
 	
-bool BackingStore::readNode(const long position, Octree::Node* const outNode) const
+uint32_t BackingStore::storeFilePositions(const long* const positions, const uint8_t count)
+{
+	assert((count > 0) && (count <= 8));
+	
+	uint32_t handle = _firstFreeFilePositionHandle[count - 1];
+	if (handle != 0)
+	{
+		_firstFreeFilePositionHandle[count - 1] = uint32_t(_filePositions[handle - 1]);
+	}
+	else
+	{
+		if (_filePositionCount + count > _filePositionCapacity)
+		{
+			long* const filePositions = new long[2 * _filePositionCapacity];
+			memcpy(filePositions, _filePositions, _filePositionCount * sizeof(long));
+			delete[] _filePositions;
+			_filePositions = filePositions;
+			_filePositionCapacity *= 2;
+		}
+		handle = _filePositionCount + 1;
+		_filePositionCount += count;
+	}
+	
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		assert(positions[i] != 0);
+		_filePositions[handle - 1 + i] = positions[i];
+	}
+	
+	return handle;
+}
+
+
+void BackingStore::releaseFilePositions(const uint32_t handle, const uint8_t count)
+{
+	assert((count > 0) && (count <= 8));
+	assert((handle > 0) && (handle - 1 + count <= _filePositionCount));
+	_filePositions[handle - 1] = _firstFreeFilePositionHandle[count - 1];
+	_firstFreeFilePositionHandle[count - 1] = handle;
+}
+
+
+void BackingStore::storeChildFilePositions(const long childrenFilePosition[8], Octree::Node* const outNode)
+{
+	long positions[8];
+	uint8_t mask = 0;
+	uint8_t count = 0;
+	
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		if (childrenFilePosition[i] == 0) continue;
+		positions[count++] = childrenFilePosition[i];
+		mask |= (1 << i);
+	}
+	
+	outNode->setChildren(mask, (count > 0) ? storeFilePositions(positions, count) : 0, false);
+}
+
+
+bool BackingStore::readNode(const long position, Octree::Node* const outNode)
 {
 	outNode->reset();
 	
+	// Files store the children as file positions with the size of a pointer
+	long childrenFilePosition[8];
 	fseek(_file, position, SEEK_SET);
-	fread(outNode->children, sizeof(Octree::Node*), 8, _file);
+	fread(childrenFilePosition, sizeof(Octree::Node*), 8, _file);
 	fread(&(outNode->quantPointCount), sizeof(uint16_t), 1, _file);
 	
-	for (uint8_t i = 0; i < 8; ++i) if (outNode->children[i] != NULL) outNode->unsetChildInMemory(i);
+	storeChildFilePositions(childrenFilePosition, outNode);
 
 	return true; // TODO: File exception handling
 }
 
 
-bool BackingStore::readQuantPointBlock(	long position, 
-										const uint32_t numberOfBlocks,
-										Octree::QuantPointBlock* const outfirstQuantPointBlock) const
+bool BackingStore::readQuantPoints(	long position, 
+									const uint16_t quantPointCount,
+									QuantPoint* const outQuantPoints) const
 {
 			
 	long offset =	sizeof(Octree::Node*) * 8
@@ -97,62 +187,149 @@ bool BackingStore::readQuantPointBlock(	long position,
 	position += offset;
 	fseek(_file, position, SEEK_SET);
 
-	Octree::QuantPointBlock* block = outfirstQuantPointBlock;
-	for (int i = 0; i < numberOfBlocks; ++i)
-	{
-		// Make sure a block exists to write into
-		assert(block);
-		
-		// Read file data and write it into block
-		fread(block, sizeof(QuantPoint), OCTREE_POINTS_PER_POINT_DATA_BLOCK, _file);
-		
-		// Jump to the next block
-		block = block->next;
-	}
-	
-	// Make sure we reached the last block
-	assert(block == NULL);
+	// Points are read in one go. Padding of the last block is skipped.
+	fread(outQuantPoints, sizeof(QuantPoint), quantPointCount, _file);
 	
 	return true; // TODO: File exception handling
 }
 
 
-bool BackingStore::writeNode(const Octree::Node* const node, long* const outPosition) const
+bool BackingStore::writeNode(	const Octree::Node* const node,
+								const QuantPoint* const quantPoints,
+								long* const outPosition) const
+{
+	return writeNodeToFile(_file, node, quantPoints, outPosition);
+}
+
+
+// Nodes are stored by the file positions of their children. Their slot in memory doesn't matter.
+void BackingStore::moveNode(const Octree::Node* const /* node */, const Octree::Node* const /* target */)
+{
+}
+
+
+void BackingStore::releaseNode(const Octree::Node* const /* node */)
 {
-	return writeNodeToFile(_file, node, outPosition);
 }
 
 
 bool BackingStore::writeNodeToFile(	FILE* const file, 
 									const Octree::Node* const node,
+									const QuantPoint* const quantPoints,
 									long* const outPosition) const
 {
 	// Make sure the node has no children that are in memory
-	for (uint8_t i = 0; i < 8; ++i) 
-		assert(!((node->children[i] != NULL) && (node->isChildInMemory(i))));
+	assert(node->getChildrenInMemoryMask() == 0);
+	
+	long childrenFilePosition[8];
+	uint8_t rank = 0;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		childrenFilePosition[i] = node->hasChild(i) ? getFilePosition(node->children + rank++) : 0;
+	}
 	
 	// Right now we always append the file (will leave gaps)
 	fseek(file, 0, SEEK_END);
 	*outPosition = ftell(file);
 	
 	// Write node meta info
-	fwrite(node->children, sizeof(Octree::Node*), 8, file);
+	fwrite(childrenFilePosition, sizeof(Octree::Node*), 8, file);
 	fwrite(&(node->quantPointCount), sizeof(uint16_t), 1, file);
 	
 	// Write node data
-	Octree::QuantPointBlock* block = node->data;
+	// Points are padded to a multiple of OCTREE_POINTS_PER_POINT_DATA_BLOCK to stay compatible
+	// with the file format
+	static const QuantPoint padding[OCTREE_POINTS_PER_POINT_DATA_BLOCK] = {};
 	
-	while (block != NULL)
+	if (node->quantPointCount > 0)
 	{
-		assert(node->quantPointCount > 0);
-		
-		fwrite(block, sizeof(QuantPoint), OCTREE_POINTS_PER_POINT_DATA_BLOCK, file);
-				
-		// Jump to next block
-		block = block->next;
+		fwrite(quantPoints, sizeof(QuantPoint), node->quantPointCount, file);
+		fwrite(	padding, sizeof(QuantPoint),
+				(OCTREE_POINTS_PER_POINT_DATA_BLOCK - node->quantPointCount % OCTREE_POINTS_PER_POINT_DATA_BLOCK) %
+					OCTREE_POINTS_PER_POINT_DATA_BLOCK,
+				file);
 	}
 	
 	return true; // TODO: File exception handling
 }
 
-}
\ No newline at end of file
+
+
+bool BackingStore::writeFooter(	FILE* const file,
+								const Octree::WorldTransform* const transform,
+								const uint8_t leafLevel)
+{
+	FooterRecordV2 record;
+	memset(&record, 0, sizeof(FooterRecordV2));
+	record.scale = transform->scale;
+	record.translation[0] = transform->translation.x;
+	record.translation[1] = transform->translation.y;
+	record.translation[2] = transform->translation.z;
+	record.leafLevel = leafLevel;
+	memcpy(record.magic, FOOTER_MAGIC_V2, sizeof(record.magic));
+	
+	fseek(file, 0, SEEK_END);
+	return (fwrite(&record, sizeof(FooterRecordV2), 1, file) == 1);
+}
+
+
+long BackingStore::readFooter(	FILE* const file,
+								Octree::WorldTransform* const outTransform,
+								uint8_t* const outLeafLevel)
+{
+	outTransform->scale = 1.0f;
+	outTransform->translation.x = 0.0f;
+	outTransform->translation.y = 0.0f;
+	outTransform->translation.z = 0.0f;
+	*outLeafLevel = OCTREE_LEAF_LEVEL;
+	
+	fseek(file, 0, SEEK_END);
+	const long fileSize = ftell(file);
+	
+	// Root node and footer
+	if (fileSize < long(8 * sizeof(Octree::Node*) + sizeof(FooterRecordV1))) return fileSize;
+	
+	// The magic is the last member of both versions
+	char magic[8];
+	fseek(file, fileSize - long(sizeof(magic)), SEEK_SET);
+	if (fread(magic, sizeof(magic), 1, file) != 1) return fileSize;
+	
+	if (memcmp(magic, FOOTER_MAGIC_V1, sizeof(magic)) == 0)
+	{
+		FooterRecordV1 record;
+		fseek(file, fileSize - long(sizeof(FooterRecordV1)), SEEK_SET);
+		if (fread(&record, sizeof(FooterRecordV1), 1, file) != 1) return fileSize;
+		
+		outTransform->scale = record.scale;
+		outTransform->translation.x = record.translation[0];
+		outTransform->translation.y = record.translation[1];
+		outTransform->translation.z = record.translation[2];
+		
+		return fileSize - long(sizeof(FooterRecordV1));
+	}
+	
+	if (memcmp(magic, FOOTER_MAGIC_V2, sizeof(magic)) != 0) return fileSize;
+	if (fileSize < long(8 * sizeof(Octree::Node*) + sizeof(FooterRecordV2))) return fileSize;
+	
+	FooterRecordV2 record;
+	fseek(file, fileSize - long(sizeof(FooterRecordV2)), SEEK_SET);
+	if (fread(&record, sizeof(FooterRecordV2), 1, file) != 1) return fileSize;
+	
+	outTransform->scale = record.scale;
+	outTransform->translation.x = record.translation[0];
+	outTransform->translation.y = record.translation[1];
+	outTransform->translation.z = record.translation[2];
+	
+	if ((record.leafLevel > 0) && (record.leafLevel <= OCTREE_LEAF_LEVEL))
+	{
+		*outLeafLevel = record.leafLevel;
+	}
+	else
+	{
+		logError("Reading leaf level failed. Reason: Level %u is not supported.\n", record.leafLevel);
+	}
+	
+	return fileSize - long(sizeof(FooterRecordV2));
+}
+
+}
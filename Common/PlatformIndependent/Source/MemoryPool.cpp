@@ -27,219 +27,883 @@
 
 #include "MemoryPool.h"
 #include "DebugConfig.h"
+#include <algorithm>
 #include <iomanip>
 #include <limits>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 
 
 namespace WVSClientCommon
 {
 
 
-MemoryPool::MemoryPool(const size_t binCount) :
-	_binCount(binCount)
+#if defined(__linux__)
+// NUMA policy constants of <numaif.h>. The syscalls are used directly to not depend on libnuma.
+static const int			NUMA_POLICY_PREFERRED = 1;
+static const unsigned int	NUMA_MOVE_PAGES = 1 << 1;
+static const size_t			NUMA_NODE_MASK_WORD_COUNT = 16;
+#endif
+
+
+// Address space is reserved without memory. Memory is committed and released in pages.
+static size_t getPageSize()
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+
+// Explicit huge pages are taken from the huge page pool of the OS right away. Thus a pool that is
+// too small fails here and not on first access.
+static uint8_t* reserveAddressSpace(const size_t size, const size_t alignment, const bool useExplicitHugePages)
+{
+#if defined(_WIN32)
+	return (uint8_t*)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+	int flags = MAP_PRIVATE | MAP_ANON;
+	if (useExplicitHugePages)
+	{
+	#ifdef MAP_HUGETLB
+		void* const ptr = mmap(NULL, size, PROT_NONE, flags | MAP_HUGETLB, -1, 0);
+		return (ptr == MAP_FAILED) ? NULL : (uint8_t*)ptr;
+	#else
+		return NULL;
+	#endif
+	}
+	
+	#ifdef MAP_NORESERVE
+	flags |= MAP_NORESERVE;
+	#endif
+	
+	// Reserve more and unmap the ends to align the address space (e.g. to huge pages)
+	void* const ptr = mmap(NULL, size + alignment, PROT_NONE, flags, -1, 0);
+	if (ptr == MAP_FAILED) return NULL;
+	
+	uint8_t* const alignedPtr = (uint8_t*)((size_t(ptr) + alignment - 1) & ~(alignment - 1));
+	const size_t headSize = alignedPtr - (uint8_t*)ptr;
+	if (headSize != 0) munmap(ptr, headSize);
+	munmap(alignedPtr + size, alignment - headSize);
+	return alignedPtr;
+#endif
+}
+
+
+static void freeAddressSpace(uint8_t* const ptr, const size_t size)
+{
+#if defined(_WIN32)
+	VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+	munmap(ptr, size);
+#endif
+}
+
+
+static bool commitMemory(uint8_t* const ptr, const size_t size)
+{
+#if defined(_WIN32)
+	return (VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != NULL);
+#else
+	return (mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0);
+#endif
+}
+
+
+// Pages are returned to the OS. Committing them again yields zeroed memory.
+static void releaseMemory(uint8_t* const ptr, const size_t size, const bool isExplicitHugePageMemory)
+{
+#if defined(_WIN32)
+	VirtualFree(ptr, size, MEM_DECOMMIT);
+#else
+	int flags = MAP_PRIVATE | MAP_ANON | MAP_FIXED;
+	#ifdef MAP_HUGETLB
+	if (isExplicitHugePageMemory) flags |= MAP_HUGETLB;
+	#endif
+	mmap(ptr, size, PROT_NONE, flags, -1, 0);
+#endif
+}
+
+
+static void yieldThread()
+{
+#if defined(_WIN32)
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+
+#if defined(_WIN32)
+static void NTAPI destroyThreadMagazineCallback(void* magazine)
+{
+	if (magazine != NULL) MemoryPool::destroyThreadMagazine(magazine);
+}
+#endif
+
+
+static size_t calcGreatestCommonDivisor(size_t a, size_t b)
+{
+	while (b != 0)
+	{
+		const size_t r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+
+MemoryPool::MemoryPool(const size_t binCount, const HugePageMode hugePageMode) :
+	_binCount(binCount),
+	_hugePageMode(hugePageMode),
+	_numaNode(-1),
+	_lock(0),
+	_magazines(NULL)
 {
 	_bin = new MemoryBin[binCount];
 	
 	for (size_t i = 0; i < _binCount; ++i)
 	{
-		_bin[i].index = NULL;
-		
-		for (uint32_t j = 0; j < INDEX_WITH_FREE_BLOCK_COUNT; ++j)
-		{
-			_bin[i].indexWithFreeBlock[j] = NULL;
-		}
+		_bin[i].payload = NULL;
+		_bin[i].parallelPayload = NULL;
+		_bin[i].levelCount = 0;
+		_bin[i].elementSize = 0;
+		_bin[i].parallelElementSize = 0;
+		_bin[i].elementCount = 0;
+		_bin[i].usedElementCount = 0;
+		_bin[i].chunkCount = 0;
+		_bin[i].committedChunkCount = 0;
+		_bin[i].chunkUsedElementCount = NULL;
+		_bin[i].isChunkCommitted = NULL;
+		_bin[i].isExplicitHugePageBin = false;
+		_bin[i].magazineBatchSize = 0;
 	}
+
+#if defined(_WIN32)
+	_magazineKey = FlsAlloc(destroyThreadMagazineCallback);
+#else
+	pthread_key_create(&_magazineKey, destroyThreadMagazine);
+#endif
 }
 
 
 MemoryPool::~MemoryPool()
 {
+	// Freeing the key flushes the magazines of running threads on Windows only
+#if defined(_WIN32)
+	FlsFree(_magazineKey);
+#else
+	pthread_key_delete(_magazineKey);
+#endif
+	while (_magazines != NULL)
+	{
+		Magazine* const magazine = _magazines;
+		_magazines = magazine->next;
+		delete[] magazine->elementCount;
+		delete[] magazine->elements;
+		delete magazine;
+	}
+	
 	for (size_t i = 0; i < _binCount; i++)
 	{
-		if (_bin[i].index != NULL) free(_bin[i].index);
+		MemoryBin* const bin = &(_bin[i]);
+		if (bin->payload != NULL) freeAddressSpace(bin->payload, bin->elementCount * bin->elementSize);
+		if (bin->parallelPayload != NULL)
+			freeAddressSpace(bin->parallelPayload, bin->elementCount * bin->parallelElementSize);
+		
+		for (uint8_t level = 0; level < bin->levelCount; ++level) delete[] bin->usedBits[level];
+		delete[] bin->chunkUsedElementCount;
+		delete[] bin->isChunkCommitted;
 	}
 	
 	delete[] _bin;
 }
 
 
+/**
+	Sets up a bin for elements of a fixed size. Address space for all elements is reserved right
+	away. Memory is committed in chunks when elements are allocated.
+	@param poolSizeInBytes Maximal memory of the bin (including the parallel payload)
+	@param parallelElementSizeInBytes Size of the parallel payload elements (0 for none). The
+	parallel payload is an array with one element per bin element (see getParallelPayloadPointer).
+ */
 void MemoryPool::setupElementBin(	const size_t binID, 
 									const size_t elementSizeInBytes,
-									const size_t poolSizeInBytes)
+									const size_t poolSizeInBytes,
+									const size_t parallelElementSizeInBytes)
 {
 	assert(binID < _binCount);
 	assert(poolSizeInBytes != 0);
-	assert((poolSizeInBytes % 4096) == 0);
+	assert(elementSizeInBytes != 0);
 	
-	// Attention: Multiply 8 sperate because poolSizeInBytes * 8 might exceed 32 bit integer
-	size_t elementCount = 8 * (poolSizeInBytes / (1 + 8 * elementSizeInBytes));
-	elementCount -= (elementCount % 32 == 0 ? 0 : elementCount % 32);
-	assert(elementCount > 0);
-	assert((elementCount % 32) == 0);
+	MemoryBin* const bin = &(_bin[binID]);
+	const size_t pageSize = (_hugePageMode == HUGE_PAGES_NONE) ? getPageSize() : HUGE_PAGE_SIZE;
+	const size_t bytesPerElement = elementSizeInBytes + parallelElementSizeInBytes;
 	
-	_bin[binID].elementSize = elementSizeInBytes;
-	_bin[binID].elementCount = elementCount;
-	_bin[binID].index = (uint8_t*)malloc(poolSizeInBytes);
-	_bin[binID].indexWithFreeBlock[0] = _bin[binID].index;
-	_bin[binID].payload = _bin[binID].index + elementCount / 8;	
-	memset(_bin[binID].index, 0, poolSizeInBytes);
+	// Chunks hold a multiple of this element count. Thus every chunk starts at a (huge) page
+	// boundary in the payload and in the parallel payload.
+	size_t granularity = pageSize / calcGreatestCommonDivisor(elementSizeInBytes, pageSize);
+	if (parallelElementSizeInBytes != 0)
+	{
+		const size_t parallelGranularity =
+			pageSize / calcGreatestCommonDivisor(parallelElementSizeInBytes, pageSize);
+		granularity *= parallelGranularity / calcGreatestCommonDivisor(granularity, parallelGranularity);
+	}
+	
+	bin->chunkElementCount = granularity * std::max<size_t>(1, CHUNK_SIZE / (granularity * elementSizeInBytes));
+	bin->chunkCount = poolSizeInBytes / (bin->chunkElementCount * bytesPerElement);
+	if (bin->chunkCount == 0)
+	{
+		// Pool is smaller than a chunk
+		bin->chunkCount = 1;
+		bin->chunkElementCount = granularity * std::max<size_t>(1, poolSizeInBytes / (granularity * bytesPerElement));
+	}
+	
+	bin->elementSize = elementSizeInBytes;
+	bin->parallelElementSize = parallelElementSizeInBytes;
+	bin->elementCount = bin->chunkCount * bin->chunkElementCount;
+	bin->usedElementCount = 0;
+	bin->committedChunkCount = 0;
+	bin->spareChunkID = bin->chunkCount;
+	for (size_t i = 0; i < MAX_RUN_LENGTH; ++i) bin->runWordID[i] = 0;
+	
+	// Small bins are not drained by the magazines of a few threads
+	bin->magazineBatchSize = std::min<size_t>(MAGAZINE_CAPACITY / 2, std::max<size_t>(1, bin->elementCount / 1024));
+	bin->chunkUsedElementCount = new uint32_t[bin->chunkCount];
+	bin->isChunkCommitted = new bool[bin->chunkCount];
+	for (size_t i = 0; i < bin->chunkCount; ++i)
+	{
+		bin->chunkUsedElementCount[i] = 0;
+		bin->isChunkCommitted[i] = false;
+	}
+	
+	// Explicit huge pages fall back to transparent ones if the huge page pool of the OS is too small
+	bin->isExplicitHugePageBin = (_hugePageMode == HUGE_PAGES_EXPLICIT);
+	while (true)
+	{
+		bin->payload = reserveAddressSpace(	bin->elementCount * elementSizeInBytes,
+											pageSize,
+											bin->isExplicitHugePageBin);
+		bin->parallelPayload = (parallelElementSizeInBytes == 0) ? NULL :
+			reserveAddressSpace(bin->elementCount * parallelElementSizeInBytes, pageSize, bin->isExplicitHugePageBin);
+		
+		const bool isReserved = (bin->payload != NULL) &&
+								((parallelElementSizeInBytes == 0) || (bin->parallelPayload != NULL));
+		if (isReserved || !bin->isExplicitHugePageBin) break;
+		
+		logError("MemPool: Not enough huge pages for bin %li. Using transparent huge pages.\n", binID);
+		if (bin->payload != NULL) freeAddressSpace(bin->payload, bin->elementCount * elementSizeInBytes);
+		if (bin->parallelPayload != NULL)
+			freeAddressSpace(bin->parallelPayload, bin->elementCount * parallelElementSizeInBytes);
+		bin->isExplicitHugePageBin = false;
+	}
+	if ((bin->payload == NULL) || ((parallelElementSizeInBytes != 0) && (bin->parallelPayload == NULL)))
+	{
+		logError("MemPool: Reserving %.2f MB of address space for bin %li failed.\n",
+			float(bin->elementCount * bytesPerElement) / (1024*1024), binID);
+		assert(false);
+	}
+	
+	// Bits beyond the last element (or word) of a level are set. Thus they are never selected.
+	size_t bitCount = bin->elementCount;
+	bin->levelCount = 0;
+	do
+	{
+		assert(bin->levelCount < MAX_BITMAP_LEVEL_COUNT);
+		
+		const size_t wordCount = (bitCount + 63) / 64;
+		uint64_t* const bits = new uint64_t[wordCount];
+		memset(bits, 0, wordCount * sizeof(uint64_t));
+		if ((bitCount % 64) != 0) bits[wordCount - 1] = ~uint64_t(0) << (bitCount % 64);
+		
+		bin->usedBits[bin->levelCount++] = bits;
+		bitCount = wordCount;
+	}
+	while (bitCount > 1);
+	
+	logInfo("MemPool: Bin ID:%li ElementSize:%li Bytes ElementCount:%li Memory:%.2f MB Chunks:%li x %.2f MB",
+		binID, elementSizeInBytes, bin->elementCount, float(bin->elementCount * bytesPerElement)/(1024*1024),
+		bin->chunkCount, float(bin->chunkElementCount * bytesPerElement)/(1024*1024));
+}
 
-	logInfo("MemPool: Bin ID:%li ElementSize:%li Bytes ElementCount:%li Memory:%.2f MB Padding:%li Bytes",
-		binID, elementSizeInBytes, elementCount, float(poolSizeInBytes)/(1024*1024),
-		poolSizeInBytes - (elementCount / 8) - elementCount * elementSizeInBytes);
+
+/**
+	Asks the OS for transparent huge pages and places the pages on the bound NUMA node. Both are
+	properties of the mapping. Released chunks are mapped anew, thus every commit repeats this.
+	@param moveCommittedPages Migrates pages that are already committed to the bound NUMA node
+ */
+void MemoryPool::adviseMemory(	const size_t binID,
+								uint8_t* const ptr,
+								const size_t size,
+								const bool moveCommittedPages) const
+{
+#if defined(__linux__)
+	#ifdef MADV_HUGEPAGE
+	if ((_hugePageMode != HUGE_PAGES_NONE) && (!_bin[binID].isExplicitHugePageBin)) madvise(ptr, size, MADV_HUGEPAGE);
+	#endif
+	
+	#ifdef SYS_mbind
+	if (_numaNode >= 0)
+	{
+		unsigned long nodeMask[NUMA_NODE_MASK_WORD_COUNT] = {0};
+		nodeMask[_numaNode / (8 * sizeof(unsigned long))] = 1UL << (_numaNode % (8 * sizeof(unsigned long)));
+		syscall(SYS_mbind, ptr, size, NUMA_POLICY_PREFERRED, nodeMask, 8 * sizeof(nodeMask),
+			moveCommittedPages ? NUMA_MOVE_PAGES : 0);
+	}
+	#endif
+#endif
 }
 
 
-void MemoryPool::pushFreeBlockPointer(const size_t binID, uint8_t* const ptr)
+bool MemoryPool::commitChunk(const size_t binID, const size_t chunkID)
 {
-	uint16_t freeBlockID = 0;
-	while (	(_bin[binID].indexWithFreeBlock[freeBlockID] != NULL) && 
-			(freeBlockID < INDEX_WITH_FREE_BLOCK_COUNT))
-		freeBlockID++;
-		
-	if (freeBlockID < INDEX_WITH_FREE_BLOCK_COUNT)
+	MemoryBin* const bin = &(_bin[binID]);
+	assert(!bin->isChunkCommitted[chunkID]);
+	
+	const size_t firstElementID = chunkID * bin->chunkElementCount;
+	if (!commitMemory(bin->payload + firstElementID * bin->elementSize, bin->chunkElementCount * bin->elementSize))
+		return false;
+	
+	if ((bin->parallelPayload != NULL) &&
+		(!commitMemory(	bin->parallelPayload + firstElementID * bin->parallelElementSize,
+						bin->chunkElementCount * bin->parallelElementSize)))
 	{
-		_bin[binID].indexWithFreeBlock[freeBlockID] = ptr;
+		releaseMemory(	bin->payload + firstElementID * bin->elementSize,
+						bin->chunkElementCount * bin->elementSize,
+						bin->isExplicitHugePageBin);
+		return false;
 	}
-	else
+	
+	adviseMemory(binID, bin->payload + firstElementID * bin->elementSize, bin->chunkElementCount * bin->elementSize, false);
+	if (bin->parallelPayload != NULL)
 	{
-		// No free block in free-block list left, search the entire memory pool for a block
-		//logInfo("MemPool: Free block was not set. List for pool %li is full.\n", binID);
+		adviseMemory(	binID,
+						bin->parallelPayload + firstElementID * bin->parallelElementSize,
+						bin->chunkElementCount * bin->parallelElementSize,
+						false);
 	}
+	
+	bin->isChunkCommitted[chunkID] = true;
+	++bin->committedChunkCount;
+	return true;
 }
 
 
-uint8_t* MemoryPool::popFreeBlockPointer(const size_t binID)
+void MemoryPool::releaseChunk(const size_t binID, const size_t chunkID)
 {
-	uint16_t freeBlockID = 0;
-	while (	(_bin[binID].indexWithFreeBlock[freeBlockID] == NULL) && 
-			(freeBlockID < INDEX_WITH_FREE_BLOCK_COUNT))
-		freeBlockID++;
+	MemoryBin* const bin = &(_bin[binID]);
+	assert(bin->isChunkCommitted[chunkID]);
+	assert(bin->chunkUsedElementCount[chunkID] == 0);
 	
-	uint8_t* ptr;
-	if (freeBlockID < INDEX_WITH_FREE_BLOCK_COUNT)
+	const size_t firstElementID = chunkID * bin->chunkElementCount;
+	releaseMemory(	bin->payload + firstElementID * bin->elementSize,
+					bin->chunkElementCount * bin->elementSize,
+					bin->isExplicitHugePageBin);
+	if (bin->parallelPayload != NULL)
 	{
-		// Read pointer from list
-		ptr = _bin[binID].indexWithFreeBlock[freeBlockID];
-		
-		// Reset list position
-		_bin[binID].indexWithFreeBlock[freeBlockID] = NULL;
+		releaseMemory(	bin->parallelPayload + firstElementID * bin->parallelElementSize,
+						bin->chunkElementCount * bin->parallelElementSize,
+						bin->isExplicitHugePageBin);
 	}
-	else
+	
+	bin->isChunkCommitted[chunkID] = false;
+	--bin->committedChunkCount;
+}
+
+
+// Bins are shared by all threads. The lock is only held for a few bitmap operations. Thus
+// waiting threads yield instead of sleeping.
+void MemoryPool::acquireLock() const
+{
+	while (__sync_lock_test_and_set(&_lock, 1))
 	{
-		// No free block in free-block list left, search the entire memory pool for a block
-		//logInfo("MemPool: No free block on free-block-list in pool %li. Entire search necessary.\n", binID);
-		ptr = _bin[binID].index;		
-		while ((*((uint32_t*)(ptr)) == 0xFFFFFFFF) && (ptr < _bin[binID].payload)) ptr += 4;
-		while ((*((uint16_t*)(ptr)) == 0xFFFF) && (ptr < _bin[binID].payload)) ptr += 2;
-		while ((*ptr == 0xFF) && (ptr < _bin[binID].payload)) ptr++;
+		while (_lock != 0) yieldThread();
 	}
+}
+
+
+void MemoryPool::releaseLock() const
+{
+	__sync_lock_release(&_lock);
+}
+
+
+// Returns the lowest free element or the element count if the bin is full
+size_t MemoryPool::findFreeElement(const size_t binID) const
+{
+	assert(binID < _binCount);
+	const MemoryBin* const bin = &(_bin[binID]);
 	
-	return ptr;
+	const uint8_t topLevel = bin->levelCount - 1;
+	if (bin->usedBits[topLevel][0] == ~uint64_t(0)) return bin->elementCount;
+	
+	// Descend to the first free element. The bit found on a level is the word on the level below.
+	size_t elementID = 0;
+	for (int8_t level = topLevel; level >= 0; --level)
+		elementID = (elementID << 6) | __builtin_ctzll(~bin->usedBits[level][elementID]);
+	assert(elementID < bin->elementCount);
+	
+	return elementID;
 }
 
 
-void* MemoryPool::binAlloc(const size_t size)
+// Marks a free element as used. Its chunk is committed if necessary.
+void* MemoryPool::useElement(const size_t binID, const size_t elementID)
+{
+	MemoryBin* const bin = &(_bin[binID]);
+	assert(elementID < bin->elementCount);
+	assert(!(bin->usedBits[0][elementID >> 6] & (uint64_t(1) << (elementID & 63))));
+	
+	const size_t chunkID = elementID / bin->chunkElementCount;
+	if ((!bin->isChunkCommitted[chunkID]) && (!commitChunk(binID, chunkID)))
+	{
+		logError("MemPool: Committing a chunk of bin %li failed.\n", binID);
+		return NULL;
+	}
+	if (bin->spareChunkID == chunkID) bin->spareChunkID = bin->chunkCount;
+	++bin->chunkUsedElementCount[chunkID];
+	
+	// Set element used. A full word sets its bit on the level above.
+	size_t bitID = elementID;
+	for (uint8_t level = 0; level < bin->levelCount; ++level)
+	{
+		uint64_t* const word = &(bin->usedBits[level][bitID >> 6]);
+		*word |= (uint64_t(1) << (bitID & 63));
+		if (*word != ~uint64_t(0)) break;
+		bitID >>= 6;
+	}
+	
+	++bin->usedElementCount;
+	
+	return bin->payload + elementID * bin->elementSize;
+}
+
+
+/**
+	Returns the first element of the lowest free run at or behind the given element or the element
+	count if there is none. Runs do not cross a word. Thus a word has a run of count free elements
+	if its free bits are still set after count - 1 shifts. Full words are skipped with level 1.
+ */
+size_t MemoryPool::findFreeRun(const size_t binID, const size_t count, const size_t firstElementID) const
 {
-	size_t binID = 0;
-	while ((size != _bin[binID].elementSize) && (binID < _binCount)) binID++;
 	assert(binID < _binCount);
+	assert((count > 0) && (count <= MAX_RUN_LENGTH));
+	const MemoryBin* const bin = &(_bin[binID]);
 	
-	uint8_t* ptr = popFreeBlockPointer(binID);
+	const size_t wordCount = (bin->elementCount + 63) / 64;
+	size_t wordID = firstElementID >> 6;
+	uint64_t startMask = ~uint64_t(0) << (firstElementID & 63);
 	
-	if ((*ptr != 0xFF) && (ptr < _bin[binID].payload))
+	while (wordID < wordCount)
 	{
-		// Free mem avialable
-		
-		// Find free block
-		uint8_t j = 0;
-		uint8_t v = *ptr;
-		while ((~v & (1 << j)) == 0) j++;
-		assert(j < 8);
+		if ((bin->levelCount > 1) && (bin->usedBits[1][wordID >> 6] == ~uint64_t(0)))
+		{
+			wordID = (wordID | 63) + 1;
+			startMask = ~uint64_t(0);
+			continue;
+		}
 		
-		// Set block used
-		(*ptr) |= (1 << j);
+		// Bits beyond the last element are set. Thus they are never part of a run.
+		const uint64_t freeBits = ~bin->usedBits[0][wordID] & startMask;
+		uint64_t runs = freeBits;
+		for (size_t i = 1; (i < count) && (runs != 0); ++i) runs &= (freeBits >> i);
 		
-		// If the chuck has still free blocks, push it the the free pointer list
-		// If not check the next chunk
-		if ((*ptr != 0xFF) && (ptr < _bin[binID].payload)) pushFreeBlockPointer(binID, ptr);
-		else if ((*(ptr+1) != 0xFF) && ((ptr+1) < _bin[binID].payload)) pushFreeBlockPointer(binID, (ptr+1));
-				
-		void* address = _bin[binID].payload + ((ptr - _bin[binID].index) * 8 + j) * _bin[binID].elementSize;
+		if (runs != 0) return (wordID << 6) | __builtin_ctzll(runs);
 		
-		// Make sure the newly allocated address space is clean
-		// This should not be necessary...
-		//memset(address, 0, _bin[binID].elementSize);
+		++wordID;
+		startMask = ~uint64_t(0);
+	}
+	
+	return bin->elementCount;
+}
+
+
+// Marks a run of free elements as used. Nothing is used if a chunk cannot be committed.
+void* MemoryPool::useRun(const size_t binID, const size_t firstElementID, const size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (useElement(binID, firstElementID + i) != NULL) continue;
 		
-		return address;
+		MemoryBin* const bin = &(_bin[binID]);
+		while (i > 0) freeElement(binID, bin->payload + (firstElementID + --i) * bin->elementSize);
+		return NULL;
 	}
-	else
+	
+	return _bin[binID].payload + firstElementID * _bin[binID].elementSize;
+}
+
+
+void* MemoryPool::allocElement(const size_t binID)
+{
+	const size_t elementID = findFreeElement(binID);
+	if (elementID == _bin[binID].elementCount)
 	{
 		//printf("Error: Bin %li is full.\n", binID);
 		return NULL;
 	}
+	
+	return useElement(binID, elementID);
 }
 
 
-
-void MemoryPool::binFree(const void* const ptr)
+void MemoryPool::freeElement(const size_t binID, const void* const ptr)
 {
-	// Find bin that contains the given address
-	for (size_t i = 0; i < _binCount; i++)
+	assert(binID < _binCount);
+	MemoryBin* const bin = &(_bin[binID]);
+	
+	assert(ptr >= bin->payload);
+	const size_t elementID = ((const uint8_t*)ptr - bin->payload) / bin->elementSize;
+	assert(elementID < bin->elementCount);
+	assert(bin->usedBits[0][elementID >> 6] & (uint64_t(1) << (elementID & 63)));
+	
+	// Unset element. A word that was full clears its bit on the level above.
+	size_t bitID = elementID;
+	for (uint8_t level = 0; level < bin->levelCount; ++level)
 	{
-		// Check if pointer is within the memory of the bin
-		if ((_bin[i].payload <= ptr) && (ptr <= _bin[i].payload + _bin[i].elementSize * _bin[i].elementCount))
-		{
-			// Bin found			
-			uint32_t elementID = ((uint8_t*)ptr - _bin[i].payload) / _bin[i].elementSize;
-			assert(elementID < _bin[i].elementCount);
-			
-			uint8_t bitID = elementID % 8;
-			assert(bitID < 8);
-			
-			uint32_t byteID = (elementID - bitID) / 8;
-			uint8_t* byte = _bin[i].index + byteID;
-			assert(byte < _bin[i].payload);
-			
-			// Unset block
-			*byte &= ~(1 << bitID);
-			
-			// Push free block to free block pointer list
-			pushFreeBlockPointer(i, byte);
-						
-			return;
-		}
+		uint64_t* const word = &(bin->usedBits[level][bitID >> 6]);
+		const bool wasFull = (*word == ~uint64_t(0));
+		*word &= ~(uint64_t(1) << (bitID & 63));
+		if (!wasFull) break;
+		bitID >>= 6;
 	}
+	
+	--bin->usedElementCount;
+	
+	// The word might have a free run now
+	for (size_t i = 0; i < MAX_RUN_LENGTH; ++i)
+		if (bin->runWordID[i] > (elementID >> 6)) bin->runWordID[i] = elementID >> 6;
+	
+	// Empty chunks are released. The last one is kept as spare to avoid releasing and committing
+	// a chunk over and over if elements are allocated and freed at its boundary.
+	const size_t chunkID = elementID / bin->chunkElementCount;
+	assert(bin->chunkUsedElementCount[chunkID] > 0);
+	if (--bin->chunkUsedElementCount[chunkID] == 0)
+	{
+		if (bin->spareChunkID != bin->chunkCount) releaseChunk(binID, bin->spareChunkID);
+		bin->spareChunkID = chunkID;
+	}
+}
+
+
+void* MemoryPool::binAllocElement(const size_t binID)
+{
+	acquireLock();
+	void* const ptr = allocElement(binID);
+	releaseLock();
+	return ptr;
+}
+
+
+void MemoryPool::binFreeElement(const size_t binID, const void* const ptr)
+{
+	acquireLock();
+	freeElement(binID, ptr);
+	releaseLock();
+}
+
+
+void* MemoryPool::binAllocElementRun(const size_t binID, const size_t count)
+{
+	assert(binID < _binCount);
+	MemoryBin* const bin = &(_bin[binID]);
+	
+	acquireLock();
+	size_t* const runWordID = &(bin->runWordID[count - 1]);
+	const size_t elementID = findFreeRun(binID, count, *runWordID << 6);
+	*runWordID = elementID >> 6;
+	void* const ptr = (elementID < bin->elementCount) ? useRun(binID, elementID, count) : NULL;
+	releaseLock();
+	
+	return ptr;
+}
+
+
+void MemoryPool::binFreeElementRun(const size_t binID, const void* const ptr, const size_t count)
+{
+	assert(binID < _binCount);
+	const size_t elementSize = _bin[binID].elementSize;
+	
+	acquireLock();
+	for (size_t i = 0; i < count; ++i) freeElement(binID, (const uint8_t*)ptr + i * elementSize);
+	releaseLock();
+}
+
+
+// Allocates the run at the given address. Returns false if one of its elements is used. This run
+// may cross words.
+bool MemoryPool::binAllocElementRunAt(const size_t binID, const void* const ptr, const size_t count)
+{
+	assert(binID < _binCount);
+	const MemoryBin* const bin = &(_bin[binID]);
+	const size_t elementID = ((const uint8_t*)ptr - bin->payload) / bin->elementSize;
+	if (elementID + count > bin->elementCount) return false;
+	
+	acquireLock();
+	bool isFree = true;
+	for (size_t i = elementID; (i < elementID + count) && isFree; ++i)
+		isFree = !(bin->usedBits[0][i >> 6] & (uint64_t(1) << (i & 63)));
+	const bool isAllocated = isFree && (useRun(binID, elementID, count) != NULL);
+	releaseLock();
+	
+	return isAllocated;
+}
+
+
+// Allocates the lowest free run at or behind the given address. Returns NULL if there is none.
+void* MemoryPool::binAllocElementRunBehind(const size_t binID, const void* const ptr, const size_t count)
+{
+	assert(binID < _binCount);
+	const MemoryBin* const bin = &(_bin[binID]);
+	const size_t firstElementID = ((const uint8_t*)ptr - bin->payload) / bin->elementSize;
+	if (firstElementID >= bin->elementCount) return NULL;
+	
+	acquireLock();
+	const size_t elementID = findFreeRun(binID, count, firstElementID);
+	void* const run = (elementID < bin->elementCount) ? useRun(binID, elementID, count) : NULL;
+	releaseLock();
+	
+	return run;
+}
+
+
+// Allocates the lowest free element if it is in front of the given element. Otherwise NULL is
+// returned. The caller moves the content and frees the given element.
+void* MemoryPool::binRelocateElement(const size_t binID, const void* const ptr)
+{
+	assert(binID < _binCount);
+	const MemoryBin* const bin = &(_bin[binID]);
+	const size_t elementID = ((const uint8_t*)ptr - bin->payload) / bin->elementSize;
+	
+	acquireLock();
+	const size_t freeElementID = findFreeElement(binID);
+	void* const freeElement = (freeElementID < elementID) ? useElement(binID, freeElementID) : NULL;
+	releaseLock();
+	
+	return freeElement;
+}
+
+
+// Used elements are either allocated or cached in a magazine. Their chunk is committed.
+bool MemoryPool::isElementUsed(const size_t binID, const void* const ptr) const
+{
+	assert(binID < _binCount);
+	const MemoryBin* const bin = &(_bin[binID]);
+	if ((ptr < bin->payload) || (ptr >= bin->payload + bin->elementCount * bin->elementSize)) return false;
+	const size_t elementID = ((const uint8_t*)ptr - bin->payload) / bin->elementSize;
+	
+	acquireLock();
+	const bool isUsed = (bin->usedBits[0][elementID >> 6] & (uint64_t(1) << (elementID & 63)));
+	releaseLock();
+	
+	return isUsed;
+}
+
+
+// Returns the first used element at or behind the given address or NULL if there is none. Words
+// of free elements are skipped (see Octree::swapUnreferencedNodeToBackingStore).
+void* MemoryPool::findUsedElement(const size_t binID, const void* const ptr) const
+{
+	assert(binID < _binCount);
+	const MemoryBin* const bin = &(_bin[binID]);
+	assert(ptr >= bin->payload);
+	size_t elementID = ((const uint8_t*)ptr - bin->payload) / bin->elementSize;
+	if (elementID >= bin->elementCount) return NULL;
+	
+	const size_t wordCount = (bin->elementCount + 63) / 64;
+	size_t wordID = elementID >> 6;
+	
+	acquireLock();
+	uint64_t word = bin->usedBits[0][wordID] & (~uint64_t(0) << (elementID & 63));
+	while ((word == 0) && (++wordID < wordCount)) word = bin->usedBits[0][wordID];
+	releaseLock();
+	
+	// Bits beyond the last element are set
+	if (word == 0) return NULL;
+	elementID = (wordID << 6) | __builtin_ctzll(word);
+	if (elementID >= bin->elementCount) return NULL;
+	
+	return bin->payload + elementID * bin->elementSize;
+}
+
+
+// Returns the number of allocated elements. It is less than count if the bin is full.
+size_t MemoryPool::binAllocElements(const size_t binID, void** const elements, const size_t count)
+{
+	size_t allocatedCount = 0;
+	
+	acquireLock();
+	while ((allocatedCount < count) && ((elements[allocatedCount] = allocElement(binID)) != NULL))
+		++allocatedCount;
+	releaseLock();
+	
+	return allocatedCount;
+}
+
+
+void MemoryPool::binFreeElements(const size_t binID, void* const* const elements, const size_t count)
+{
+	acquireLock();
+	for (size_t i = 0; i < count; ++i) freeElement(binID, elements[i]);
+	releaseLock();
 }
 
 
-// see http://www.keil.com/support/docs/194.htm
-// or http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetKernighan
-uint8_t MemoryPool::countBitsInAByte(uint8_t byte) const
+MemoryPool::Magazine* MemoryPool::getThreadMagazine()
 {
-	uint8_t count;
+#if defined(_WIN32)
+	Magazine* magazine = (Magazine*)FlsGetValue(_magazineKey);
+#else
+	Magazine* magazine = (Magazine*)pthread_getspecific(_magazineKey);
+#endif
+	if (magazine != NULL) return magazine;
+	
+	magazine = new Magazine;
+	magazine->pool = this;
+	magazine->elementCount = new size_t[_binCount];
+	magazine->elements = new void*[_binCount * MAGAZINE_CAPACITY];
+	for (size_t i = 0; i < _binCount; ++i) magazine->elementCount[i] = 0;
+	
+	acquireLock();
+	magazine->next = _magazines;
+	_magazines = magazine;
+	releaseLock();
+
+#if defined(_WIN32)
+	FlsSetValue(_magazineKey, magazine);
+#else
+	pthread_setspecific(_magazineKey, magazine);
+#endif
+	return magazine;
+}
 
-	for (count = 0; byte != 0; count++)
+
+void MemoryPool::flushMagazine(Magazine* const magazine)
+{
+	acquireLock();
+	for (size_t binID = 0; binID < _binCount; ++binID)
 	{
-		byte &= byte - 1; // this clears the LSB-most set bit
+		void** const elements = magazine->elements + binID * MAGAZINE_CAPACITY;
+		for (size_t i = 0; i < magazine->elementCount[binID]; ++i) freeElement(binID, elements[i]);
+		magazine->elementCount[binID] = 0;
 	}
+	releaseLock();
+}
 
-	return (count);
+
+void MemoryPool::destroyThreadMagazine(void* const ptr)
+{
+	Magazine* const magazine = (Magazine*)ptr;
+	MemoryPool* const pool = magazine->pool;
+	pool->flushMagazine(magazine);
+	
+	pool->acquireLock();
+	Magazine** link = &(pool->_magazines);
+	while (*link != magazine) link = &((*link)->next);
+	*link = magazine->next;
+	pool->releaseLock();
+	
+	delete[] magazine->elementCount;
+	delete[] magazine->elements;
+	delete magazine;
 }
 
 
-size_t MemoryPool::countElementsInBin(const size_t binID) const
+/**
+	Allocates an element from the magazine of the calling thread. An empty magazine is refilled
+	with a batch of elements from the bin. The bin hands out elements at the lowest free addresses
+	first. The magazine keeps this order to keep the bin packed.
+ */
+void* MemoryPool::threadAllocElement(const size_t binID)
 {
-	size_t count = 0;
-	uint8_t* i = _bin[binID].index;
+	assert(binID < _binCount);
+	Magazine* const magazine = getThreadMagazine();
+	size_t* const count = &(magazine->elementCount[binID]);
+	void** const elements = magazine->elements + binID * MAGAZINE_CAPACITY;
 	
-	while (i < _bin[binID].payload)
+	if (*count == 0)
 	{
-		count += countBitsInAByte(*i);
-		i++;
+		*count = binAllocElements(binID, elements, _bin[binID].magazineBatchSize);
+		if (*count == 0) return NULL;
+		std::reverse(elements, elements + *count);
 	}
 	
-	return count;
+	return elements[--(*count)];
+}
+
+
+/**
+	Frees an element to the magazine of the calling thread. A full magazine returns the batch of
+	elements that were freed first to the bin. The recently freed ones are likely still cached.
+ */
+void MemoryPool::threadFreeElement(const size_t binID, const void* const ptr)
+{
+	assert(binID < _binCount);
+	Magazine* const magazine = getThreadMagazine();
+	size_t* const count = &(magazine->elementCount[binID]);
+	void** const elements = magazine->elements + binID * MAGAZINE_CAPACITY;
+	const size_t batchSize = _bin[binID].magazineBatchSize;
+	
+	if (*count == 2 * batchSize)
+	{
+		binFreeElements(binID, elements, batchSize);
+		memmove(elements, elements + batchSize, batchSize * sizeof(void*));
+		*count = batchSize;
+	}
+	
+	elements[(*count)++] = (void*)ptr;
+}
+
+
+// Returns all elements cached by the calling thread to the bins
+void MemoryPool::flushThreadMagazine()
+{
+	flushMagazine(getThreadMagazine());
+}
+
+
+void* MemoryPool::binAlloc(const size_t size)
+{
+	size_t binID = 0;
+	while ((binID < _binCount) && (size != _bin[binID].elementSize)) binID++;
+	assert(binID < _binCount);
+	
+	return binAllocElement(binID);
+}
+
+
+void MemoryPool::binFree(const void* const ptr)
+{
+	// Find bin that contains the given address
+	for (size_t i = 0; i < _binCount; i++)
+	{
+		// Check if pointer is within the memory of the bin
+		if ((_bin[i].payload <= ptr) && (ptr < _bin[i].payload + _bin[i].elementSize * _bin[i].elementCount))
+		{
+			binFreeElement(i, ptr);
+			return;
+		}
+	}
+}
+
+
+size_t MemoryPool::countElementsInBin(const size_t binID) const
+{
+	return _bin[binID].usedElementCount;
 }
 
 
@@ -249,9 +913,10 @@ size_t MemoryPool::getMaximalNumberOfElementsInBin(const size_t binID) const
 }
 
 
-const void* const MemoryPool::getIndexPointer(const size_t binID) const
+size_t MemoryPool::countCommittedBytesInBin(const size_t binID) const
 {
-	return _bin[binID].index;
+	const MemoryBin* const bin = &(_bin[binID]);
+	return bin->committedChunkCount * bin->chunkElementCount * (bin->elementSize + bin->parallelElementSize);
 }
 
 
@@ -261,6 +926,44 @@ const void* const MemoryPool::getPayloadPointer(const size_t binID) const
 }
 
 
+void* const MemoryPool::getParallelPayloadPointer(const size_t binID) const
+{
+	return _bin[binID].parallelPayload;
+}
+
+
+/**
+	Places the memory of all bins on the NUMA node of the calling thread (e.g. the thread that
+	traverses the octree). Committed pages are moved there. Returns false if the OS lacks NUMA
+	support.
+ */
+bool MemoryPool::bindToCurrentNUMANode()
+{
+#if defined(__linux__) && defined(SYS_getcpu) && defined(SYS_mbind)
+	unsigned int cpu = 0;
+	unsigned int node = 0;
+	if ((syscall(SYS_getcpu, &cpu, &node, NULL) != 0) || (node >= 8 * sizeof(unsigned long) * NUMA_NODE_MASK_WORD_COUNT))
+		return false;
+	
+	acquireLock();
+	_numaNode = node;
+	for (size_t i = 0; i < _binCount; ++i)
+	{
+		MemoryBin* const bin = &(_bin[i]);
+		if (bin->payload != NULL) adviseMemory(i, bin->payload, bin->elementCount * bin->elementSize, true);
+		if (bin->parallelPayload != NULL)
+			adviseMemory(i, bin->parallelPayload, bin->elementCount * bin->parallelElementSize, true);
+	}
+	releaseLock();
+	
+	logInfo("MemPool: Bound to NUMA node %u", node);
+	return true;
+#else
+	return false;
+#endif
+}
+
+
 void MemoryPool::printStatistics() const
 {
 	std::cout << std::endl << ">> Memory Pool Statistics" << std::endl;
@@ -269,14 +972,26 @@ void MemoryPool::printStatistics() const
 		uint32_t count = countElementsInBin(i);
 		std::cout	<< "Bin " << i << " Used: << " << count << " ("  
 					<< std::setprecision(2) << std::fixed << 100.0f * float(count) / float(_bin[i].elementCount)
-					<< "%)" << std::endl;
+					<< "%) Committed: " << float(countCommittedBytesInBin(i)) / (1024*1024) << " MB" << std::endl;
 	}
 	std::cout << std::endl;	
 }
 
 
+size_t MemoryPool::getPhysicalMemorySize()
+{
+#if defined(_WIN32)
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	GlobalMemoryStatusEx(&status);
+	return status.ullTotalPhys;
+#else
+	return size_t(sysconf(_SC_PHYS_PAGES)) * getPageSize();
+#endif
+}
+
+
 
 
 
 }
-	
\ No newline at end of file
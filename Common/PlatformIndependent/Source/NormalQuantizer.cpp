@@ -0,0 +1,291 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "NormalQuantizer.h"
+#include "DebugConfig.h"
+#include <cmath>
+#include <assert.h>
+
+#if USE_SIMD_POINT_QUANTIZATION
+	#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define SSE_NORMAL_QUANTIZATION 1
+	#elif defined(__ARM_NEON__) && defined(__aarch64__)
+	// vdivq_f32 is not available on ARMv7
+	#include <arm_neon.h>
+	#define NEON_NORMAL_QUANTIZATION 1
+	#endif
+#endif
+
+
+namespace WVSClientCommon
+{
+
+
+float_t NormalQuantizer::_normals[NormalQuantizer::NORMAL_COUNT * 3];
+uint8_t NormalQuantizer::_cubeMap[6 * NormalQuantizer::CUBE_MAP_FACE_EDGE_LENGTH * NormalQuantizer::CUBE_MAP_FACE_EDGE_LENGTH];
+bool NormalQuantizer::_isInitialized = false;
+
+
+void NormalQuantizer::init()
+{
+	if (_isInitialized) return;
+
+	// Spherical Fibonacci lattice
+	const float_t goldenAngle = float_t(M_PI * (3.0 - sqrt(5.0)));
+	for (uint32_t i = 0; i < NORMAL_COUNT; ++i)
+	{
+		const float_t z = 1.0f - (2.0f * i + 1.0f) / NORMAL_COUNT;
+		const float_t radius = sqrtf(1.0f - z * z);
+		const float_t phi = goldenAngle * i;
+
+		_normals[3*i+0] = radius * cosf(phi);
+		_normals[3*i+1] = radius * sinf(phi);
+		_normals[3*i+2] = z;
+	}
+
+	// Every cube map texel points to the codebook normal closest to the texel center
+	for (uint32_t face = 0; face < 6; ++face)
+	{
+		for (uint32_t v = 0; v < CUBE_MAP_FACE_EDGE_LENGTH; ++v)
+		{
+			for (uint32_t u = 0; u < CUBE_MAP_FACE_EDGE_LENGTH; ++u)
+			{
+				VECTOR3 direction;
+				calcCubeMapTexelDirection(face, u, v, &direction);
+				_cubeMap[(face * CUBE_MAP_FACE_EDGE_LENGTH + v) * CUBE_MAP_FACE_EDGE_LENGTH + u] =
+					findClosestNormal(&direction);
+			}
+		}
+	}
+
+	_isInitialized = true;
+}
+
+
+const float_t* NormalQuantizer::getNormals()
+{
+	assert(_isInitialized);
+	return _normals;
+}
+
+
+/**
+	A face is defined by the major axis of a normal (0 = x, 1 = y, 2 = z) and its sign:
+	face = 2 * axis + (negative ? 1 : 0). The texel coordinates u and v are the two other
+	axes in cyclic order (x: y/z, y: z/x, z: x/y).
+ */
+void NormalQuantizer::calcCubeMapTexelDirection(	const uint32_t face,
+													const uint32_t u,
+													const uint32_t v,
+													VECTOR3* const outDirection)
+{
+	const uint32_t axis = face / 2;
+	const float_t halfEdgeLength = float_t(CUBE_MAP_FACE_EDGE_LENGTH / 2);
+
+	float_t direction[3];
+	direction[axis] = (face % 2 == 0) ? 1.0f : -1.0f;
+	direction[(axis + 1) % 3] = (float_t(u) + 0.5f) / halfEdgeLength - 1.0f;
+	direction[(axis + 2) % 3] = (float_t(v) + 0.5f) / halfEdgeLength - 1.0f;
+
+	const float_t length = sqrtf(	direction[0] * direction[0] +
+									direction[1] * direction[1] +
+									direction[2] * direction[2]);
+
+	outDirection->x = direction[0] / length;
+	outDirection->y = direction[1] / length;
+	outDirection->z = direction[2] / length;
+}
+
+
+uint8_t NormalQuantizer::findClosestNormal(const VECTOR3* const normal)
+{
+	uint8_t closestNormal = 0;
+	float_t bestDot = -2.0f;
+	for (uint32_t i = 0; i < NORMAL_COUNT; ++i)
+	{
+		const float_t dot =	normal->x * _normals[3*i+0] +
+							normal->y * _normals[3*i+1] +
+							normal->z * _normals[3*i+2];
+
+		if (dot > bestDot)
+		{
+			bestDot = dot;
+			closestNormal = i;
+		}
+	}
+
+	assert(closestNormal < NORMAL_COUNT);
+	return closestNormal;
+}
+
+
+inline uint8_t NormalQuantizer::lookupCubeMap(const uint32_t face, const int32_t u, const int32_t v)
+{
+	// Rounding errors might move a normal slightly over the edge of a face
+	const int32_t maxCoordinate = CUBE_MAP_FACE_EDGE_LENGTH - 1;
+	const int32_t clampedU = (u < 0) ? 0 : ((u > maxCoordinate) ? maxCoordinate : u);
+	const int32_t clampedV = (v < 0) ? 0 : ((v > maxCoordinate) ? maxCoordinate : v);
+
+	return _cubeMap[(face * CUBE_MAP_FACE_EDGE_LENGTH + clampedV) * CUBE_MAP_FACE_EDGE_LENGTH + clampedU];
+}
+
+
+uint8_t NormalQuantizer::quantizeNormal(const VECTOR3* const normal)
+{
+	assert(_isInitialized);
+
+	const float_t absX = fabsf(normal->x);
+	const float_t absY = fabsf(normal->y);
+	const float_t absZ = fabsf(normal->z);
+
+	uint32_t axis;
+	float_t major, u, v;
+	if ((absX >= absY) && (absX >= absZ))
+	{
+		axis = 0; major = normal->x; u = normal->y; v = normal->z;
+	}
+	else if (absY >= absZ)
+	{
+		axis = 1; major = normal->y; u = normal->z; v = normal->x;
+	}
+	else
+	{
+		axis = 2; major = normal->z; u = normal->x; v = normal->y;
+	}
+
+	const float_t absMajor = fabsf(major);
+	if (!(absMajor > 0.0f)) return 0;
+
+	// Separate statements keep the compiler from fusing multiply and add (same result as quantizeNormals)
+	const float_t halfEdgeLength = float_t(CUBE_MAP_FACE_EDGE_LENGTH / 2);
+	const float_t scale = halfEdgeLength / absMajor;
+	const float_t scaledU = u * scale;
+	const float_t scaledV = v * scale;
+
+	return lookupCubeMap(	2 * axis + ((major < 0.0f) ? 1 : 0),
+							int32_t(scaledU + halfEdgeLength),
+							int32_t(scaledV + halfEdgeLength));
+}
+
+
+void NormalQuantizer::quantizeNormals(const VECTOR3* const normals, const size_t count, uint8_t* const outNormalIndices)
+{
+	assert(_isInitialized);
+
+	size_t i = 0;
+
+#if SSE_NORMAL_QUANTIZATION || NEON_NORMAL_QUANTIZATION
+	const float_t halfEdgeLength = float_t(CUBE_MAP_FACE_EDGE_LENGTH / 2);
+	int32_t face[4], u[4], v[4], isValid[4];
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const VECTOR3* const n = &(normals[i]);
+
+	#if SSE_NORMAL_QUANTIZATION
+		const __m128 x = _mm_setr_ps(n[0].x, n[1].x, n[2].x, n[3].x);
+		const __m128 y = _mm_setr_ps(n[0].y, n[1].y, n[2].y, n[3].y);
+		const __m128 z = _mm_setr_ps(n[0].z, n[1].z, n[2].z, n[3].z);
+
+		const __m128 signBit = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+		const __m128 absX = _mm_andnot_ps(signBit, x);
+		const __m128 absY = _mm_andnot_ps(signBit, y);
+		const __m128 absZ = _mm_andnot_ps(signBit, z);
+
+		// Major axis (same tie breaking as quantizeNormal)
+		const __m128 isX = _mm_and_ps(_mm_cmpge_ps(absX, absY), _mm_cmpge_ps(absX, absZ));
+		const __m128 isY = _mm_andnot_ps(isX, _mm_cmpge_ps(absY, absZ));
+		const __m128 isZ = _mm_andnot_ps(_mm_or_ps(isX, isY), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+
+		const __m128 major = _mm_or_ps(_mm_or_ps(_mm_and_ps(isX, x), _mm_and_ps(isY, y)), _mm_and_ps(isZ, z));
+		const __m128 minorU = _mm_or_ps(_mm_or_ps(_mm_and_ps(isX, y), _mm_and_ps(isY, z)), _mm_and_ps(isZ, x));
+		const __m128 minorV = _mm_or_ps(_mm_or_ps(_mm_and_ps(isX, z), _mm_and_ps(isY, x)), _mm_and_ps(isZ, y));
+
+		// face = 2 * axis + negative
+		const __m128i axis = _mm_or_si128(	_mm_and_si128(_mm_castps_si128(isY), _mm_set1_epi32(1)),
+											_mm_and_si128(_mm_castps_si128(isZ), _mm_set1_epi32(2)));
+		const __m128i isNegative = _mm_srli_epi32(_mm_castps_si128(_mm_cmplt_ps(major, _mm_setzero_ps())), 31);
+
+		const __m128 absMajor = _mm_andnot_ps(signBit, major);
+		const __m128 half = _mm_set1_ps(halfEdgeLength);
+		const __m128 scale = _mm_div_ps(half, absMajor);
+
+		_mm_storeu_si128((__m128i*)face, _mm_add_epi32(_mm_add_epi32(axis, axis), isNegative));
+		_mm_storeu_si128((__m128i*)u, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(minorU, scale), half)));
+		_mm_storeu_si128((__m128i*)v, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(minorV, scale), half)));
+		_mm_storeu_si128((__m128i*)isValid, _mm_castps_si128(_mm_cmpgt_ps(absMajor, _mm_setzero_ps())));
+	#else
+		// Deinterleave 4 normals (xyzxyz... -> xxxx, yyyy, zzzz)
+		assert(sizeof(VECTOR3) == 3 * sizeof(float32_t));
+		const float32x4x3_t xyz = vld3q_f32(&(n[0].x));
+		const float32x4_t x = xyz.val[0];
+		const float32x4_t y = xyz.val[1];
+		const float32x4_t z = xyz.val[2];
+
+		const float32x4_t absX = vabsq_f32(x);
+		const float32x4_t absY = vabsq_f32(y);
+		const float32x4_t absZ = vabsq_f32(z);
+
+		// Major axis (same tie breaking as quantizeNormal)
+		const uint32x4_t isX = vandq_u32(vcgeq_f32(absX, absY), vcgeq_f32(absX, absZ));
+		const uint32x4_t isY = vbicq_u32(vcgeq_f32(absY, absZ), isX);
+		const uint32x4_t isZ = vmvnq_u32(vorrq_u32(isX, isY));
+
+		const float32x4_t major = vbslq_f32(isX, x, vbslq_f32(isY, y, z));
+		const float32x4_t minorU = vbslq_f32(isX, y, vbslq_f32(isY, z, x));
+		const float32x4_t minorV = vbslq_f32(isX, z, vbslq_f32(isY, x, y));
+
+		// face = 2 * axis + negative
+		const uint32x4_t axis = vorrq_u32(vandq_u32(isY, vdupq_n_u32(1)), vandq_u32(isZ, vdupq_n_u32(2)));
+		const uint32x4_t isNegative = vshrq_n_u32(vcltq_f32(major, vdupq_n_f32(0.0f)), 31);
+
+		const float32x4_t absMajor = vabsq_f32(major);
+		const float32x4_t half = vdupq_n_f32(halfEdgeLength);
+		const float32x4_t scale = vdivq_f32(half, absMajor);
+
+		vst1q_s32(face, vreinterpretq_s32_u32(vaddq_u32(vaddq_u32(axis, axis), isNegative)));
+		vst1q_s32(u, vcvtq_s32_f32(vaddq_f32(vmulq_f32(minorU, scale), half)));
+		vst1q_s32(v, vcvtq_s32_f32(vaddq_f32(vmulq_f32(minorV, scale), half)));
+		vst1q_s32(isValid, vreinterpretq_s32_u32(vcgtq_f32(absMajor, vdupq_n_f32(0.0f))));
+	#endif
+
+		for (uint32_t j = 0; j < 4; ++j)
+		{
+			outNormalIndices[i + j] = isValid[j] ? lookupCubeMap(face[j], u[j], v[j]) : 0;
+		}
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		outNormalIndices[i] = quantizeNormal(&(normals[i]));
+	}
+}
+
+
+}
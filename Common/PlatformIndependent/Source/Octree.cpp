@@ -32,21 +32,48 @@
 #include "MiniGL.h"
 #include <cmath>
 #include <limits>
+#include <algorithm>
 #include "MemoryPool.h"
 #include "APIFactory.h"
 #include "BackingStore.h"
 #include "StaticBackingStore.h"
 
+#if USE_SIMD_POINT_QUANTIZATION
+	#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define SSE_POINT_QUANTIZATION 1
+	#elif defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define NEON_POINT_QUANTIZATION 1
+	#endif
+#endif
+
 				
 #if USE_MEMORY_POOL
-#define OCTREE_MALLOC( pointer, type )	while (!(pointer = (type *)_memoryPool->binAlloc(sizeof(type))))\
-											swapLeastRecentlyUsedNodesToBackingStore()
-#define OCTREE_FREE( pointer)			_memoryPool->binFree( pointer )
+#if USE_MEMORY_POOL_MAGAZINES
+#define POOL_ALLOC_ELEMENT	threadAllocElement
+#define POOL_FREE_ELEMENT	threadFreeElement
+#else
+#define POOL_ALLOC_ELEMENT	binAllocElement
+#define POOL_FREE_ELEMENT	binFreeElement
+#endif
+// Blocks are runs of sibling nodes (bin 0, see Node::children). Arrays are point arrays of the
+// size class that holds count.
+#define OCTREE_MALLOC_BLOCK( pointer, count )	while (!(pointer = (Node *)_memoryPool->binAllocElementRun(0, count)))\
+													swapUnreferencedNodeToBackingStore()
+#define OCTREE_MALLOC_ARRAY( pointer, type, count )	while (!(pointer = (type *)_memoryPool->POOL_ALLOC_ELEMENT(calcPointArrayBinID(count))))\
+														swapUnreferencedNodeToBackingStore()
+#define OCTREE_FREE_BLOCK( pointer, count )	_memoryPool->binFreeElementRun(0, pointer, count)
+#define OCTREE_FREE_ARRAY( pointer, count )	_memoryPool->POOL_FREE_ELEMENT(calcPointArrayBinID(count), pointer)
 #else
-#define OCTREE_MALLOC( pointer, type )	pointer = (type *)malloc(sizeof(type))
+// Nodes are addressed by their index in the node bin (see Octree::NodeIndex)
+#error "The octree requires USE_MEMORY_POOL"
+#define OCTREE_MALLOC_BLOCK( pointer, count )	pointer = (Node *)malloc(sizeof(Node) * (count))
+#define OCTREE_MALLOC_ARRAY( pointer, type, count )	pointer = (type *)malloc(sizeof(type) * (count))
 // Cast to (void*) is necessary to remove any "const".
 // see http://stackoverflow.com/questions/2819535/unable-to-free-const-pointers-in-c
-#define OCTREE_FREE( pointer)			free( (void*)pointer )
+#define OCTREE_FREE_BLOCK( pointer, count )	free( (void*)pointer )
+#define OCTREE_FREE_ARRAY( pointer, count )	free( (void*)pointer )
 #endif
 
 
@@ -62,12 +89,79 @@ static const int32_t		OCTREE_WORLD_EDGE_LENGTH = 8 * (1 << (OCTREE_LEAF_LEVEL +
 static const int32_t		OCTREE_WORLD_HALF_EDGE_LENGTH = 4 * (1 << (OCTREE_LEAF_LEVEL + 1));
 
 
+static bool isQuantPointPositionSmaller(const QuantPoint& a, const QuantPoint& b)
+{
+	return (a.getPosition() < b.getPosition());
+}
+
+
+#if SSE_POINT_QUANTIZATION || NEON_POINT_QUANTIZATION
+// Returns the normal index and the color of a point in one word (bbbbbbbb|gggggggg|rrrrrrrr|nnnnnnnn)
+static inline uint32_t loadNormalColorWord(const WVSPoint* const point)
+{
+	uint32_t word;
+	memcpy(&word, &(point->normalIndex), sizeof(uint32_t));
+	return word;
+}
+#endif
+
+
+#if SSE_POINT_QUANTIZATION
+// Same as roundf (halfway cases are rounded away from zero)
+static inline __m128i roundToNearestInt(const __m128 x)
+{
+	const __m128i truncated = _mm_cvttps_epi32(x);
+	const __m128 fraction = _mm_sub_ps(x, _mm_cvtepi32_ps(truncated));
+	const __m128 absFraction = _mm_and_ps(fraction, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)));
+	
+	// +1/-1 if the absolute fraction is at least 0.5 (sign of the fraction)
+	const __m128i isRounded = _mm_castps_si128(_mm_cmpge_ps(absFraction, _mm_set1_ps(0.5f)));
+	const __m128i sign = _mm_srai_epi32(_mm_castps_si128(fraction), 31);
+	const __m128i one = _mm_and_si128(isRounded, _mm_set1_epi32(1));
+	
+	return _mm_add_epi32(truncated, _mm_sub_epi32(_mm_xor_si128(one, sign), sign));
+}
+
+
+static inline __m128i isWithinBounds(const __m128i coordinate)
+{
+	return _mm_and_si128(	_mm_cmpgt_epi32(coordinate, _mm_set1_epi32(-OCTREE_WORLD_HALF_EDGE_LENGTH)),
+							_mm_cmplt_epi32(coordinate, _mm_set1_epi32(OCTREE_WORLD_HALF_EDGE_LENGTH)));
+}
+#endif
+
+
+#if NEON_POINT_QUANTIZATION
+// Same as roundf (halfway cases are rounded away from zero)
+static inline int32x4_t roundToNearestInt(const float32x4_t x)
+{
+	const int32x4_t truncated = vcvtq_s32_f32(x);
+	const float32x4_t fraction = vsubq_f32(x, vcvtq_f32_s32(truncated));
+	
+	// +1/-1 if the absolute fraction is at least 0.5 (sign of the fraction)
+	const int32x4_t isRounded = vreinterpretq_s32_u32(vcgeq_f32(vabsq_f32(fraction), vdupq_n_f32(0.5f)));
+	const int32x4_t sign = vshrq_n_s32(vreinterpretq_s32_f32(fraction), 31);
+	const int32x4_t one = vandq_s32(isRounded, vdupq_n_s32(1));
+	
+	return vaddq_s32(truncated, vsubq_s32(veorq_s32(one, sign), sign));
+}
+
+
+static inline uint32x4_t isWithinBounds(const int32x4_t coordinate)
+{
+	return vandq_u32(	vcgtq_s32(coordinate, vdupq_n_s32(-OCTREE_WORLD_HALF_EDGE_LENGTH)),
+						vcltq_s32(coordinate, vdupq_n_s32(OCTREE_WORLD_HALF_EDGE_LENGTH)));
+}
+#endif
+
+
 Octree::Octree(	const uint32_t maxPointsInBuffer,
 				const char* const backingStoreFilename,
 				const bool isStaticFile,
 				const MiniGL::ViewFrustum* const viewFrustum,
 				const AppCore* const callbackObject,
-				const RenderCallbackMethodT callbackMethod) :
+				const RenderCallbackMethodT callbackMethod,
+				const uint32_t memoryBudgetMB) :
 				_maxPointsInBuffer(maxPointsInBuffer),
 				_renderViewFrustum(viewFrustum),
 				_renderCallbackObject(callbackObject),
@@ -125,19 +219,41 @@ Octree::Octree(	const uint32_t maxPointsInBuffer,
 
 #if USE_MEMORY_POOL
 	// Initilize memory pool
-	_memoryPool = new MemoryPool(2);
-	_memoryPool->setupElementBin(0, sizeof(Node), OCTREE_NODE_MEMORY_MB * 1024 * 1024);
-	_memoryPool->setupElementBin(1, sizeof(QuantPointBlock), OCTREE_QUANT_POINT_BLOCK_MEMORY_MB * 1024 * 1024);
+	// Bin 0 holds the nodes, all other bins hold the point arrays of one size class each
+	_memoryPool = new MemoryPool(	1 + OCTREE_POINT_ARRAY_SIZE_CLASS_COUNT,
+									MemoryPool::HugePageMode(OCTREE_HUGE_PAGE_MODE));
+	
+	// Budget is divided by the memory weights
+	uint32_t memoryWeight = OCTREE_NODE_MEMORY_WEIGHT;
+	for (uint8_t i = 0; i < OCTREE_POINT_ARRAY_SIZE_CLASS_COUNT; ++i) memoryWeight += OCTREE_POINT_ARRAY_MEMORY_WEIGHT[i];
+	const size_t memoryBudget = size_t(memoryBudgetMB) * 1024 * 1024;
+	
+	// The node states are the parallel payload of the node bin. Thus both share the node memory.
+	_memoryPool->setupElementBin(	0,
+									sizeof(Node),
+									memoryBudget / memoryWeight * OCTREE_NODE_MEMORY_WEIGHT,
+									sizeof(NodeState));
+	for (uint8_t i = 0; i < OCTREE_POINT_ARRAY_SIZE_CLASS_COUNT; ++i)
+	{
+		_memoryPool->setupElementBin(	1 + i,
+										sizeof(QuantPoint) * (OCTREE_POINT_ARRAY_MIN_CAPACITY << i),
+										memoryBudget / memoryWeight * OCTREE_POINT_ARRAY_MEMORY_WEIGHT[i]);
+	}
+	
+	// Node indices are relative to the first node of the bin (see getNode)
+	_firstNode = (Node*)_memoryPool->getPayloadPointer(0);
+	_nodeStates = (NodeState*)_memoryPool->getParallelPayloadPointer(0);
+	
+	// Point array indices are relative to the first array of their bin (see getPointArray)
+	for (uint8_t i = 0; i < OCTREE_POINT_ARRAY_SIZE_CLASS_COUNT; ++i)
+		_firstPointArray[i] = (QuantPoint*)_memoryPool->getPayloadPointer(1 + i);
 #endif
 	
-	// Allocate rootnode. Rootnode must never be in the RLU list.
-	// Means prevUsedNode/nextUsedNode is always NULL
-	OCTREE_MALLOC(_rootNode, Node);
-	_rootNode->reset();
-	lockNode(_rootNode);
-		
-	_leastRecentlyUsedNode = NULL;
-	_mostRecentlyUsedNode = NULL;
+	// Allocate rootnode (as a block without siblings). Rootnode is never in the clock (see touchNode).
+	OCTREE_MALLOC_BLOCK(_rootNode, 1);
+	resetNode(_rootNode);
+	
+	_clockHand = 0;
 	
 	// Root node is present
 	_nodeCount = 1;
@@ -145,12 +261,33 @@ Octree::Octree(	const uint32_t maxPointsInBuffer,
 	// We have no points inserted, yet
 	_pointCount = 0;
 	
+	// By default the octree is shared with the render and restore threads
+	_isLockingEnabled = true;
+	_isLODGenerationDeferred = false;
+	_isStaticFile = isStaticFile;
+	
+	// Data sets are imported without transformation by default
+	_worldTransform.scale = 1.0f;
+	_worldTransform.translation.x = 0.0f;
+	_worldTransform.translation.y = 0.0f;
+	_worldTransform.translation.z = 0.0f;
+	_leafLevel = OCTREE_LEAF_LEVEL;
+	
+	_compactionChildID[0] = 0;
+	_compactionLevel = 0;
+	_compactionNodeID = 0;
+	_compactionRelocationCount = 0;
+	_isMemoryCompacted = false;
+	
 #if USE_BACKING_STORE
 	if (isStaticFile)
 	{
 		_backingStore = new StaticBackingStore(	_memoryPool->getMaximalNumberOfElementsInBin(0),
 												(Octree::Node*)_memoryPool->getPayloadPointer(0));
-		((StaticBackingStore*)_backingStore)->open(backingStoreFilename, _rootNode);
+		((StaticBackingStore*)_backingStore)->open(	backingStoreFilename,
+														_rootNode,
+														&_worldTransform,
+														&_leafLevel);
 	}
 	else
 	{
@@ -169,13 +306,14 @@ Octree::Octree(	const uint32_t maxPointsInBuffer,
 Octree::~Octree()
 {
 	// Destroy tree recursive
-	OCTREE_FREE(_rootNode);
+	OCTREE_FREE_BLOCK(_rootNode, 1);
 	
 #if USE_MEMORY_POOL
 	delete _memoryPool;
 #endif
 
 #if USE_BACKING_STORE
+	_backingStore->close();
 	delete _backingStore;
 #endif
 
@@ -197,6 +335,38 @@ Octree::~Octree()
 }
 
 
+// Octrees that are only accessed by a single thread (e.g. the workers of the
+// ParallelOctreeBuilder) don't need the global locks. Otherwise all octree instances would
+// contend for the same OCTREE_LOCK and BACKINGSTORE_LOCK.
+void Octree::disableLocking()
+{
+	_isLockingEnabled = false;
+}
+
+
+// Should be called by the thread that traverses the octree (see MemoryPool::bindToCurrentNUMANode)
+bool Octree::bindMemoryToCurrentNUMANode()
+{
+#if USE_MEMORY_POOL
+	return _memoryPool->bindToCurrentNUMANode();
+#else
+	return false;
+#endif
+}
+
+
+void Octree::acquireLock(const uint32_t lockID) const
+{
+	if (_isLockingEnabled) APIFactory::GetInstance().lock(lockID);
+}
+
+
+void Octree::releaseLock(const uint32_t lockID) const
+{
+	if (_isLockingEnabled) APIFactory::GetInstance().unlock(lockID);
+}
+
+
 void Octree::updateScreenSizeRelatedConstants()
 {
 #if USE_VOXEL_ACCU
@@ -227,468 +397,692 @@ void Octree::setVoxelAccuThreshold(const uint16_t threshold)
 #endif
 
 	
-void Octree::writeNodeToDisk(FILE* const file, Node* const node, uint32_t* numberOfPointsWrittenToDisk)
+// Writes the nodes in post-order. If LODs are deferred (grids != NULL) they are generated on
+// the fly. Every node is complete once its children are written.
+void Octree::writeNodeToDisk(	FILE* const file,
+								Node* const node,
+								const uint8_t level,
+								LODGrid* const grids,
+								uint32_t* numberOfPointsWrittenToDisk)
 {
-	// Traverse childs first
-	for (uint8_t i = 0; i < 8; ++i)
+	LODGrid* const grid = (grids != NULL) ? &(grids[level]) : NULL;
+	if (grid != NULL) for (uint8_t i = 0; i < 8; ++i) grid->occupancy[i] = 0;
+	
+	// Node must stay in memory while the child nodes are restored and its LOD points are allocated
+	lockNode(node);
+	
+	// Restore children from backing store if not present
+	if ((!node->areChildrenInMemory()) && (!restoreChildNodesFromBackingStore(node)))
+		logError("Writing node failed. Reason: Backing store node restore failed.\n");
+	
+	// Traverse childs first. The block stays in memory until all siblings are written, because
+	// the child in the recursion is locked.
+	long childrenFilePosition[8];
+	uint8_t rank = 0;
+	for (uint8_t mask = node->childMask; mask != 0; mask &= mask - 1, ++rank)
 	{
-		if (node->children[i] != NULL)
-		{
-			// Restore child from backing store if not present
-			if (node->isChildInMemory(i) == false)
-			{
-				restoreNodeFromBackingStore(node, i);
-			}
-			
-			// Traverse child
-			writeNodeToDisk(file, node->children[i], numberOfPointsWrittenToDisk);
-			
-			// Points per node is limited to quantization grid
-			assert(node->quantPointCount <= OCTREE_NODE_EDGE_SEGEMENTATION *
-											OCTREE_NODE_EDGE_SEGEMENTATION *
-											OCTREE_NODE_EDGE_SEGEMENTATION);
-
-			Node* child = node->children[i];
-			_backingStore->writeNodeToFile(file, child, &(node->childrenFilePosition[i]));
-			node->unsetChildInMemory(i);
-			
-			*numberOfPointsWrittenToDisk += child->quantPointCount;
-			
-			if (node != _rootNode) touchNode(node);
-			if (_mostRecentlyUsedNode != child) freeNodeFromMemory(child);
-		}
+		const uint8_t i = __builtin_ctz(mask);
+		Node* child = getChild(node, i);
+		
+		// Traverse child
+		writeNodeToDisk(file, child, level + 1, grids, numberOfPointsWrittenToDisk);
+		
+		// Points per node is limited to quantization grid
+		assert(node->quantPointCount <= OCTREE_NODE_EDGE_SEGEMENTATION *
+										OCTREE_NODE_EDGE_SEGEMENTATION *
+										OCTREE_NODE_EDGE_SEGEMENTATION);
+		
+		// Root node holds no points
+		if ((grid != NULL) && (level > 0)) accumulateLODCells(grid, getPointArray(child), child->quantPointCount, i);
+		
+		_backingStore->writeNodeToFile(file, child, getPointArray(child), &(childrenFilePosition[rank]));
+		
+		*numberOfPointsWrittenToDisk += child->quantPointCount;
+	}
+	
+	if (rank > 0)
+	{
+		freeChildBlockFromMemory(node);
+		node->setChildren(node->childMask, _backingStore->storeFilePositions(childrenFilePosition, rank), false);
 	}
+	
+	if (grid != NULL) writeLODCells(node, grid);
+	
+	if (node != _rootNode) unlockNode(node);
 }
 	
 
 void Octree::saveToDisk(const char* const filename)
 {
-	for (uint8_t i = 0; i < 8; ++i)
-		if ((_rootNode->children[i] != NULL) && (_rootNode->isChildInMemory(i))) touchNode(_rootNode->children[i]);
+	for (uint8_t mask = _rootNode->getChildrenInMemoryMask(); mask != 0; mask &= mask - 1)
+		touchNode(getChild(_rootNode, __builtin_ctz(mask)));
 
 	// Free some memory
 	while (_nodeCount > 32)
 	{
-		swapLeastRecentlyUsedNodesToBackingStore();
+		swapUnreferencedNodeToBackingStore();
 	}
 
-	APIFactory::GetInstance().lock(OCTREE_LOCK);
+	acquireLock(OCTREE_LOCK);
 	
 	uint32_t numberOfPointsWrittenToDisk = 0;
+	long rootChildrenFilePosition[8] = {0, 0, 0, 0, 0, 0, 0, 0};
 	
 	// Write point cloud to file
 	FILE* pointFile = fopen(filename, "wb");
 	
 	// Reserve space for the root node at the beginning of the file
 	fseek(pointFile, 0, SEEK_SET);
-	fwrite(_rootNode->children, sizeof(Octree::Node*), 8, pointFile);
+	fwrite(rootChildrenFilePosition, sizeof(Octree::Node*), 8, pointFile);
 	
 	// Write all child nodes
-	writeNodeToDisk(pointFile, _rootNode, &numberOfPointsWrittenToDisk);
+	LODGrid* grids = NULL;
+	if (_isLODGenerationDeferred) grids = new LODGrid[OCTREE_LEAF_LEVEL + 1];
+	
+	writeNodeToDisk(pointFile, _rootNode, 0, grids, &numberOfPointsWrittenToDisk);
+	
+	delete[] grids;
 	
 	// Check if all root node children are swapped
-	for (uint8_t i = 0; i < 8; ++i) 
-		assert(!((_rootNode->children[i] != NULL) && (_rootNode->isChildInMemory(i))));
+	assert(_rootNode->getChildrenInMemoryMask() == 0);
 		
+	BackingStore::writeFooter(pointFile, &_worldTransform, _leafLevel);
+	
 	// Update root node
+	uint8_t rank = 0;
+	for (uint8_t mask = _rootNode->childMask; mask != 0; mask &= mask - 1, ++rank)
+	{
+		const uint8_t i = __builtin_ctz(mask);
+		rootChildrenFilePosition[i] = _backingStore->getFilePosition(_rootNode->children + rank);
+	}
 	fseek(pointFile, 0, SEEK_SET);
-	fwrite(_rootNode->children, sizeof(Octree::Node*), 8, pointFile);
+	fwrite(rootChildrenFilePosition, sizeof(Octree::Node*), 8, pointFile);
 	
 	fclose(pointFile);
 	
 	printf("points: %u\n", numberOfPointsWrittenToDisk);
-	APIFactory::GetInstance().unlock(OCTREE_LOCK);
+	releaseLock(OCTREE_LOCK);
 	
-	_leastRecentlyUsedNode = NULL;
-	_mostRecentlyUsedNode = NULL;
+	_clockHand = 0;
 	_nodeCount = 1;
 }
 
 
-const float_t* Octree::getRegionOrginArray() const
+// The transform is written to the point cloud file by saveToDisk. The points must already be
+// transformed (see ImportHelper).
+void Octree::setWorldTransform(const WorldTransform* const transform)
 {
-	return &(_regionOriginFloat[0].x);
+	_worldTransform = *transform;
 }
 
 
-const float_t* Octree::getVoxelIncircleDiameterArray() const
+const Octree::WorldTransform* Octree::getWorldTransform() const
 {
-	return _voxelIncircleDiameter;
+	return &_worldTransform;
 }
 
 
-const float_t Octree::getVoxelCircumcircleRadius(const uint8_t level) const
+// Points with a smaller radius than the voxels of the leaf level are inserted at the leaf level.
+// Thus a small leaf level trades resolution for fewer nodes. The world size and the fixed point
+// format do not depend on the leaf level. Must be called before any point is inserted.
+void Octree::setLeafLevel(const uint8_t leafLevel)
 {
-	assert(level <= OCTREE_LEAF_LEVEL);
-	return _voxelCircumcircleRadius[level];
+	assert(!_isStaticFile);
+	assert(_rootNode->childMask == 0);
+	
+	if ((leafLevel == 0) || (leafLevel > OCTREE_LEAF_LEVEL))
+	{
+		logError("Setting leaf level failed. Reason: Level %u is not supported.\n", leafLevel);
+		return;
+	}
+	
+	_leafLevel = leafLevel;
 }
 
 
-const float_t* Octree::getNodeIncircleDiameterArray() const
+uint8_t Octree::getLeafLevel() const
 {
-	return _nodeIncircleDiameter;
+	return _leafLevel;
 }
 
 
-void Octree::touchNode(Node* const node)
+// Points are only inserted at their insertion level. The coarser levels are synthesized by
+// generateLODs (or saveToDisk) once all points are inserted. This saves the insertion into every
+// level of the path to the root node per point.
+void Octree::deferLODGeneration()
 {
-	assert(node);
+	_isLODGenerationDeferred = true;
+}
+
+
+// Synthesizes the points of all inner nodes bottom-up from the points of their child nodes
+void Octree::generateLODs()
+{
+	acquireLock(OCTREE_LOCK);
 	
-	// If a locked node is touched, nothing happens
-	if (node->prevUsedNode == (Node*)OCTREE_LOCKED_NODE_IDENTIFIER) return;
+	// One grid per level to accumulate the points of the child nodes
+	LODGrid* grids = new LODGrid[OCTREE_LEAF_LEVEL + 1];
+	generateLODsOfNode(_rootNode, 0, grids);
+	delete[] grids;
 	
-	// Root node is not allowed in LRU
-	if (node == _rootNode) return;
+	releaseLock(OCTREE_LOCK);
+}
+
+
+/**
+	Traverses the child nodes first and merges their points into the cells of the node afterwards.
+	
+	@param grids Accumulation grids for the level of the node and all levels below
+ */
+void Octree::generateLODsOfNode(Node* const node, const uint8_t level, LODGrid* const grids)
+{
+	if (node->childMask == 0) return;
+	
+	// Node must stay in memory while the child nodes are restored
+	lockNode(node);
 	
-	// No node is in the queue, yet
-	if ((_leastRecentlyUsedNode == NULL) || (_mostRecentlyUsedNode == NULL))
+	LODGrid* const grid = &(grids[level]);
+	for (uint8_t i = 0; i < 8; ++i) grid->occupancy[i] = 0;
+	
+	for (uint8_t mask = node->childMask; mask != 0; mask &= mask - 1)
 	{
-		_leastRecentlyUsedNode = node;
-		_mostRecentlyUsedNode = node;
-		node->nextUsedNode = NULL;
-		node->prevUsedNode = NULL;
-		return;
-	}
-
-	// One node is the queue
-	if ((_leastRecentlyUsedNode == node) && (_mostRecentlyUsedNode == node)) return;
+		const uint8_t i = __builtin_ctz(mask);
 		
-	if ((node->prevUsedNode != NULL) && (node->nextUsedNode != NULL))
-	{
-		// Node is somewhere in the chain, close the gap
-		node->prevUsedNode->nextUsedNode = node->nextUsedNode;
-		node->nextUsedNode->prevUsedNode = node->prevUsedNode;
-	}
-	else if ((node->prevUsedNode != NULL) && (node->nextUsedNode == NULL))
-	{
-		// Node is already most recently used
-		assert(_mostRecentlyUsedNode == node);
-		return;
-	}
-	else if ((node->prevUsedNode == NULL) && (node->nextUsedNode != NULL))
-	{
-		// Node is least recently used Node
-		assert(_leastRecentlyUsedNode == node);
+		// Restore children from backing store if not present. Children that could not be read
+		// are removed.
+		if ((!node->areChildrenInMemory()) && (!restoreChildNodesFromBackingStore(node)))
+			logError("Generating LODs failed. Reason: Backing store node restore failed.\n");
 		
-		// Set new last node
-		_leastRecentlyUsedNode = node->nextUsedNode;
-		_leastRecentlyUsedNode->prevUsedNode = NULL;
+		if (!node->hasChild(i)) continue;
 		
-		assert(_leastRecentlyUsedNode->nextUsedNode != NULL);
-		assert(_leastRecentlyUsedNode->prevUsedNode == NULL);
+		Node* const child = getChild(node, i);
+		generateLODsOfNode(child, level + 1, grids);
+		
+		// Root node holds no points
+		if (level > 0) accumulateLODCells(grid, getPointArray(child), child->quantPointCount, i);
 	}
 	
-	assert(_mostRecentlyUsedNode != NULL);
-	
-	// Put node into the front
-	_mostRecentlyUsedNode->nextUsedNode = node;	
-	node->prevUsedNode = _mostRecentlyUsedNode;
-	node->nextUsedNode = NULL;
-	_mostRecentlyUsedNode = node;
+	writeLODCells(node, grid);
 	
-//#ifdef DEBUG
-//	checkLRU();
-//#endif
-		
-	assert(_leastRecentlyUsedNode != NULL);
-	assert(_mostRecentlyUsedNode != NULL);
-	assert(_leastRecentlyUsedNode->nextUsedNode != NULL);
-	assert(_leastRecentlyUsedNode->prevUsedNode == NULL);
-	assert(_mostRecentlyUsedNode->nextUsedNode == NULL);
-	assert(_mostRecentlyUsedNode->prevUsedNode != NULL);
+	if (node != _rootNode) unlockNode(node);
 }
 
 
-// Check LRU chain in both directions
-void Octree::checkLRU()
+// Adds the points of a child node to the cells of its parent. Every cell of the parent covers
+// 2x2x2 cells of the child.
+void Octree::accumulateLODCells(	LODGrid* const grid,
+									const QuantPoint* const childPoints,
+									const uint16_t childPointCount,
+									const uint8_t childID)
 {
-	Node* n = _leastRecentlyUsedNode;
-	int i = 0;
-	while ((n != _mostRecentlyUsedNode) && (i < _nodeCount))
+	// Child node covers one octant of the parent. The child cell coordinates are halved to get
+	// the cell within the octant (zzzyyyxxx).
+	const uint16_t octantCellID = ((childID & 1) << 2) | ((childID & 2) << 4) | ((childID & 4) << 6);
+	
+	for (uint16_t i = 0; i < childPointCount; ++i)
 	{
-		assert(n->nextUsedNode);
-		n = n->nextUsedNode;
-		++i;
+		const QuantPoint* const childPoint = &(childPoints[i]);
+		const uint16_t cellID = octantCellID | ((childPoint->getPosition() >> 8) & 0xDB);
+		LODCell* const cell = &(grid->cells[cellID]);
+		
+		if (!(grid->occupancy[cellID >> 6] & (uint64_t(1) << (cellID & 63))))
+		{
+			grid->occupancy[cellID >> 6] |= (uint64_t(1) << (cellID & 63));
+			cell->red = 0;
+			cell->green = 0;
+			cell->blue = 0;
+			cell->count = 0;
+			cell->normalIndex = childPoint->positionNormal & 127;
+		}
+		
+		cell->red += childPoint->colorNative & 31;
+		cell->green += (childPoint->colorNative >> 5) & 31;
+		cell->blue += (childPoint->colorNative >> 10) & 31;
+		++(cell->count);
 	}
-	
-	n = _mostRecentlyUsedNode;
-	while ((n != _leastRecentlyUsedNode) && (i > 0))
+}
+
+
+// Cells that hold a native point keep it. All other cells get the average color of the child
+// points within the cell.
+void Octree::writeLODCells(Node* const node, const LODGrid* const grid)
+{
+	// Cells are written in order of their cell IDs
+	for (uint8_t i = 0; i < 8; ++i)
 	{
-		assert(n->prevUsedNode);
-		n = n->prevUsedNode;
-		--i;
+		uint64_t occupancy = grid->occupancy[i];
+		
+		while (occupancy != 0)
+		{
+			const uint16_t cellID = (i << 6) | __builtin_ctzll(occupancy);
+			const LODCell* const cell = &(grid->cells[cellID]);
+			occupancy &= occupancy - 1;
+			
+			QuantPoint* quantPoint;
+			if (retrieveQuantPointInNode(node, cellID << 7, &quantPoint))
+			{
+				// Native points are kept
+				if (quantPoint->isNative()) continue;
+			}
+			else
+			{
+				++_pointCount;
+			}
+			
+			calcLODPoint(cell, cellID, quantPoint);
+		}
 	}
-	assert(i == 0);
 }
 
 
-void Octree::lockNode(Node* const node)
+// LOD point of a cell with the average color of the accumulated child points
+void Octree::calcLODPoint(const LODCell* const cell, const uint16_t cellID, QuantPoint* const outQuantPoint)
+{
+	const uint16_t roundingOffset = cell->count >> 1;
+	outQuantPoint->positionNormal = (cellID << 7) | cell->normalIndex;
+	outQuantPoint->colorNative =	((cell->red + roundingOffset) / cell->count) |
+									(((cell->green + roundingOffset) / cell->count) << 5) |
+									(((cell->blue + roundingOffset) / cell->count) << 10);
+}
+
+
+const float_t* Octree::getRegionOrginArray() const
+{
+	return &(_regionOriginFloat[0].x);
+}
+
+
+const float_t* Octree::getVoxelIncircleDiameterArray() const
+{
+	return _voxelIncircleDiameter;
+}
+
+
+const float_t Octree::getVoxelCircumcircleRadius(const uint8_t level) const
+{
+	assert(level <= OCTREE_LEAF_LEVEL);
+	return _voxelCircumcircleRadius[level];
+}
+
+
+const float_t* Octree::getNodeIncircleDiameterArray() const
+{
+	return _nodeIncircleDiameter;
+}
+
+
+/**
+	Sets the reference bit of a node. The first touch puts the node into the clock, i.e. it can be
+	evicted by swapUnreferencedNodeToBackingStore. Only the node itself is written, thus the render
+	traversal does not touch the cache lines of other nodes.
+ */
+void Octree::touchNode(Node* const node)
 {
 	assert(node);
 	
-	// Do nothing if the node is already locked
-	if (node->prevUsedNode == (Node*)OCTREE_LOCKED_NODE_IDENTIFIER) return;
+	// If a locked node is touched, nothing happens
+	if (node->clockFlags & OCTREE_NODE_LOCKED) return;
 	
-	// Root node cannot be locked
+	// Root node is not allowed in the clock
 	if (node == _rootNode) return;
 	
-//	#ifdef DEBUG
-//	checkLRU();
-//	#endif
-	
-	// Extract node out of LRU list (if in there)
-	if (node->prevUsedNode == NULL)
-	{
-		assert(node == _leastRecentlyUsedNode);
-		_leastRecentlyUsedNode = node->nextUsedNode;
-	}
-	else
-	{
-		node->prevUsedNode->nextUsedNode = node->nextUsedNode;
-	}
-	
-	if (node->nextUsedNode == NULL)
-	{
-		assert(node == _mostRecentlyUsedNode);
-		_mostRecentlyUsedNode = node->prevUsedNode;
-	}
-	else
-	{
-		node->nextUsedNode->prevUsedNode = node->prevUsedNode;
-	}
-	
-//	#ifdef DEBUG
-//	checkLRU();
-//	#endif
+	node->clockFlags = OCTREE_NODE_IN_CLOCK | OCTREE_NODE_REFERENCED;
+}
+
+
+// A locked node keeps its siblings in memory, because blocks are evicted as a whole (see
+// isChildBlockEvictable)
+void Octree::lockNode(Node* const node)
+{
+	assert(node);
 	
-	// Set magic byte sequence to identify locked nodes
-	node->prevUsedNode = (Node*)OCTREE_LOCKED_NODE_IDENTIFIER;
-	node->nextUsedNode = NULL;
+	// Root node cannot be locked
+	if (node == _rootNode) return;
 	
-//	#ifdef DEBUG
-//	checkLRU();
-//	#endif
+	// Locked nodes are skipped by the clock hand
+	node->clockFlags |= OCTREE_NODE_LOCKED;
 }
 
 
 void Octree::unlockNode(Node* const node)
 {
-	// Check if the node is locked
-	assert(node->prevUsedNode == (Node*)OCTREE_LOCKED_NODE_IDENTIFIER);
-	assert(node->nextUsedNode == NULL);
-	
 	// Root node cannot be locked
 	if (node == _rootNode) return;
 	
-	// Clear magic byte sequence
-	node->prevUsedNode = NULL;
+	// Check if the node is locked
+	assert(node->clockFlags & OCTREE_NODE_LOCKED);
 	
-	// Put into LRU, again
-	touchNode(node);
+	// Put into the clock, again
+	node->clockFlags = OCTREE_NODE_IN_CLOCK | OCTREE_NODE_REFERENCED;
 }
 
 
-/**
-	Frees all memory that is occpuied by a given node (including points associated to that node).
-	@param node Node to be freed. This node must not have any child nodes in memory.
+// Resets a newly allocated node and its state
+void Octree::resetNode(Node* const node)
+{
+	node->reset();
+	getNodeState(node)->reset();
+	_isMemoryCompacted = false;
+}
 
+
+/**
+	Adds an empty child to a node. The children of a node are stored as one block (see
+	Node::children). Thus the siblings are shifted within the block if the slot behind it is free.
+	Otherwise they are moved to a new block with one more slot.
+	@returns Returns the new child node.
  */
-void Octree::freeNodeFromMemory(const Node* const node)
+Octree::Node* Octree::addChildNode(Node* const parentNode, const uint8_t childID)
 {
-	// Never free the most recently used node
-	assert(_mostRecentlyUsedNode != node);
-	assert(node->nextUsedNode != NULL);
+	assert(parentNode->areChildrenInMemory());
+	assert(!parentNode->hasChild(childID));
+	assert(!isChildBlockLocked(parentNode));
 	
-	// Never free root node
-	assert(node != _rootNode);
-	
-	// Never free a node that has children in memory
-	for (int i = 0; i < 8; ++i) assert(!((node->children[i] != NULL) && (node->isChildInMemory(i))));
-
-	// Never free a locked node
-	assert(!node->isLocked());
+	const uint8_t count = parentNode->getChildCount();
+	const uint8_t rank = parentNode->calcChildRank(childID);
+	Node* const siblings = getNode(parentNode->children);
+	Node* block = siblings;
 	
-	// Remove node from LRU list
-	if ((node->prevUsedNode != NULL) && (node->nextUsedNode != NULL))
+	if ((count > 0) && _memoryPool->binAllocElementRunAt(0, &(siblings[count]), 1))
 	{
-		// Node is somewhere in the chain, close the gap
-		assert(node->prevUsedNode->nextUsedNode);
-		assert(node->nextUsedNode->prevUsedNode);
-		node->prevUsedNode->nextUsedNode = node->nextUsedNode;
-		node->nextUsedNode->prevUsedNode = node->prevUsedNode;
+		// Following siblings move up by one slot (last one first)
+		for (uint8_t i = count; i > rank; --i) moveNodeToSlot(&(siblings[i - 1]), &(siblings[i]));
 	}
-	else if ((node->prevUsedNode == NULL) && (node->nextUsedNode != NULL))
+	else
 	{
-		// Node is least recently used Node
-		assert(_leastRecentlyUsedNode == node);
+		// Parent and siblings must stay in memory while the new block is allocated
+		const bool isParentLockedHere = (parentNode != _rootNode) && (!isNodeLocked(parentNode));
+		if (isParentLockedHere) lockNode(parentNode);
+		for (uint8_t i = 0; i < count; ++i) lockNode(&(siblings[i]));
 		
-		// Set new last node
-		_leastRecentlyUsedNode = node->nextUsedNode;
-		_leastRecentlyUsedNode->prevUsedNode = NULL;
+		OCTREE_MALLOC_BLOCK(block, count + 1);
 		
-		assert(_leastRecentlyUsedNode->nextUsedNode != NULL);
-		assert(_leastRecentlyUsedNode->prevUsedNode == NULL);
-	}
-
-	// Remove all data blocks from memory
-	QuantPointBlock* block = node->data;
-	QuantPointBlock* nextBlock;
-
-	while (block != NULL)
-	{
-		nextBlock = block->next;
-		OCTREE_FREE(block);
-				
-		// Jump to next block
-		block = nextBlock;
+		for (uint8_t i = 0; i < count; ++i)
+		{
+			Node* const target = &(block[i + (i >= rank)]);
+			moveNodeToSlot(&(siblings[i]), target);
+			unlockNode(target);
+		}
+		if (count > 0) OCTREE_FREE_BLOCK(siblings, count);
+		
+		if (isParentLockedHere) unlockNode(parentNode);
 	}
-
-	// Remove node from memory
-	OCTREE_FREE(node);
+	
+	Node* const child = &(block[rank]);
+	resetNode(child);
+	getNodeState(child)->parent = getNodeIndex(parentNode);
+	parentNode->setChildren(parentNode->childMask | (1 << childID), getNodeIndex(block), true);
+	touchNode(child);
+	
+	// New node created
+	++_nodeCount;
+	
+	return child;
 }
 
 
-void Octree::restoreChildNodesFromBackingStore(Node* parentNode)
+/**
+	Removes a child and its subtree from a node. Following siblings in memory move down by one
+	slot. A swapped child is dropped without restoring it (its space in the backing store file is
+	not reclaimed).
+ */
+void Octree::removeChildNode(Node* const parentNode, const uint8_t childID)
 {
-	// Make sure the parent node has no parent being the least recently used node
-//	Node* parent = parentNode;
-//	int levels = 0;
-//	while (parent != _rootNode)
-//	{
-//		touchNode(parent);
-//		parent = parent->parent;
-//		levels++;
-//		// Make sure we need at most octree_leaf_levels to the root (= circle check)
-//		// Should never happen
-//		assert(levels <= OCTREE_LEAF_LEVEL);
-//	}
+	assert(parentNode->hasChild(childID));
+	
+	const uint8_t count = parentNode->getChildCount();
+	const uint8_t rank = parentNode->calcChildRank(childID);
+	const uint8_t mask = parentNode->childMask & ~(1 << childID);
 	
-	// Load all children of the node				
-	for (uint8_t j = 0; j < 8; ++j)
+	if (!parentNode->areChildrenInMemory())
 	{
-		if (!(parentNode->isChildInMemory(j)) && 
-			 (parentNode->children[j] != NULL))
+#if USE_BACKING_STORE
+		long filePositions[8];
+		uint8_t remainingCount = 0;
+		for (uint8_t i = 0; i < count; ++i)
 		{
-			restoreNodeFromBackingStore(parentNode, j);
+			if (i != rank) filePositions[remainingCount++] = _backingStore->getFilePosition(parentNode->children + i);
 		}
+		
+		_backingStore->releaseFilePositions(parentNode->children, count);
+		parentNode->setChildren(	mask,
+									(remainingCount > 0) ? _backingStore->storeFilePositions(filePositions, remainingCount) : 0,
+									false);
+#endif
+		return;
 	}
+	
+	Node* const block = getNode(parentNode->children);
+	freeSubtreeFromMemory(&(block[rank]));
+	
+	for (uint8_t i = rank + 1; i < count; ++i) moveNodeToSlot(&(block[i]), &(block[i - 1]));
+	OCTREE_FREE_BLOCK(&(block[count - 1]), 1);
+	
+	parentNode->setChildren(mask, (count > 1) ? parentNode->children : 0, true);
 }
 
 
 /**
-	Reads a node from backing store
-	@param parentNode Parent node of the node that is going to be restored.
-	@param nodeID Node ID that identifies the child of the parentNode that is going to be restored.
-	@returns Returns true if the operation was successful.
+	Moves a node to a free slot of the node bin. The parent links of its children in memory are
+	redirected. The link of the parent is updated by the caller, because siblings are moved
+	together (see Node::children).
  */
-bool Octree::restoreNodeFromBackingStore(Node* const parentNode, const uint8_t nodeID)
+void Octree::moveNodeToSlot(Node* const node, Node* const target)
 {
-#if USE_BACKING_STORE == 1
-
-	// Make sure the child that is going to be restored is not yet in memory
-	assert(parentNode->isChildInMemory(nodeID) == false);
-	
-	// Child does exist but is located on backing store
-	bool success;
-	Node* restoredNode;
-	
-	// Save file position of the node
-	long pos = parentNode->childrenFilePosition[nodeID];
+	assert(node != _rootNode);
+	assert(node != target);
 	
-	// Allocate a new node
-	OCTREE_MALLOC(restoredNode, Node);
-	restoredNode->reset();
+	*target = *node;
+	*getNodeState(target) = *getNodeState(node);
 	
-	// Restore node from from backing store
-	APIFactory::GetInstance().lock(BACKINGSTORE_LOCK);
+	const NodeIndex targetIndex = getNodeIndex(target);
+	if (target->getChildrenInMemoryMask() != 0)
+	{
+		Node* const block = getNode(target->children);
+		for (uint8_t i = 0; i < target->getChildCount(); ++i) getNodeState(&(block[i]))->parent = targetIndex;
+	}
 	
-	success = _backingStore->readNode(pos, restoredNode);
+#if USE_BACKING_STORE
+	_backingStore->moveNode(node, target);
+#endif
 	
-	// Points per node is limited to quantization grid
-	assert(restoredNode->quantPointCount <= OCTREE_NODE_EDGE_SEGEMENTATION *
-											OCTREE_NODE_EDGE_SEGEMENTATION *
-											OCTREE_NODE_EDGE_SEGEMENTATION);
+	// The clock flags moved with the node
+	node->clockFlags = 0;
+	_isMemoryCompacted = false;
+}
+
 
-	APIFactory::GetInstance().unlock(BACKINGSTORE_LOCK);
+/**
+	Frees the children of a node from memory (including their points). The file positions of their
+	swapped children are released. The node and point counts are updated by the caller.
+	@param parentNode Parent of the block. Its children must not have children in memory.
+ */
+void Octree::freeChildBlockFromMemory(Node* const parentNode)
+{
+	assert(parentNode->areChildrenInMemory());
+	
+	const uint8_t count = parentNode->getChildCount();
+	Node* const block = getNode(parentNode->children);
 	
-	if (!success)
+	for (uint8_t i = 0; i < count; ++i)
 	{
-		logError("Node I/O Error. Read failure.");
+		Node* const node = &(block[i]);
 		
-		// Free node from memory
-		freeNodeFromMemory(restoredNode);
-		parentNode->children[nodeID] = NULL;
-		parentNode->setChildInMemory(nodeID);
+		// Never free a node that has children in memory
+		assert(node->getChildrenInMemoryMask() == 0);
 		
-		return false;
+		// Never free a locked node
+		assert(!isNodeLocked(node));
+		
+		// Free slots are never in the clock
+		node->clockFlags = 0;
+		
+#if USE_BACKING_STORE
+		if (node->childMask != 0) _backingStore->releaseFilePositions(node->children, node->getChildCount());
+#endif
+
+		// Remove point array from memory
+		if (node->pointArray != 0) OCTREE_FREE_ARRAY(getPointArray(node), node->quantPointCount);
+	}
+
+	// Remove nodes from memory
+	if (count > 0) OCTREE_FREE_BLOCK(block, count);
+	_isMemoryCompacted = false;
+}
+
+
+// A block is evicted as a whole. Thus all its nodes must be in the clock without reference and
+// lock and must not have children in memory.
+bool Octree::isChildBlockEvictable(const Node* const parentNode) const
+{
+	const Node* const block = getNode(parentNode->children);
+	for (uint8_t i = 0; i < parentNode->getChildCount(); ++i)
+	{
+		if (block[i].clockFlags != OCTREE_NODE_IN_CLOCK) return false;
+		if (block[i].getChildrenInMemoryMask() != 0) return false;
 	}
 	
-	++_nodeCount;
-	_pointCount += restoredNode->quantPointCount;
+	return true;
+}
+
 
-	// Make this not the most recently used node (to avoid swapping in the near future)
-	touchNode(restoredNode);
+bool Octree::isChildBlockLocked(const Node* const parentNode) const
+{
+	const Node* const block = getNode(parentNode->children);
+	for (uint8_t i = 0; i < parentNode->getChildCount(); ++i)
+	{
+		if (isNodeLocked(&(block[i]))) return true;
+	}
 	
-	// Connect restored node to parent node
-	restoredNode->parent = parentNode;
+	return false;
+}
+
+
+/**
+	Restores the swapped children of a node as one block. The block is allocated first. Afterwards
+	all records and then all points are read in the order of their file positions, each with a
+	single acquisition of the backing store lock. The block is connected to the parent once the
+	points are read. Until then swapUnreferencedNodeToBackingStore cannot reach it.
+	@param parentNode Parent node of the children that are going to be restored.
+	@returns Returns true if all children were restored. Children that could not be read are removed.
+ */
+bool Octree::restoreChildNodesFromBackingStore(Node* const parentNode)
+{
+	if (parentNode->areChildrenInMemory()) return true;
+	
+#if USE_BACKING_STORE
+	// Parent must stay in memory while the block and the point arrays are allocated
+	const bool isParentLockedHere = (parentNode != _rootNode) && (!isNodeLocked(parentNode));
+	if (isParentLockedHere) lockNode(parentNode);
 	
-	// Notifiy parent node that child node is in memory
-	parentNode->children[nodeID] = restoredNode;
+	const uint8_t count = parentNode->getChildCount();
+	Node* block;
+	OCTREE_MALLOC_BLOCK(block, count);
 	
-	parentNode->setChildInMemory(nodeID);
+	long filePositions[8];
+	bool success[8];
+	uint8_t order[8];
 	
-	// Check if the node has quant points, load them
-	if (restoredNode->quantPointCount > 0)
+	for (uint8_t i = 0; i < count; ++i)
 	{
-		uint32_t blockCount = ((restoredNode->quantPointCount - 1) / OCTREE_POINTS_PER_POINT_DATA_BLOCK) + 1;
+		resetNode(&(block[i]));
+		filePositions[i] = _backingStore->getFilePosition(parentNode->children + i);
 		
-		assert(blockCount > 0);
-		assert(((blockCount-1) * OCTREE_POINTS_PER_POINT_DATA_BLOCK) < restoredNode->quantPointCount);
-		assert(restoredNode->quantPointCount <= (blockCount * OCTREE_POINTS_PER_POINT_DATA_BLOCK));
-		assert(((blockCount-1) * OCTREE_POINTS_PER_POINT_DATA_BLOCK) + (restoredNode->quantPointCount % OCTREE_POINTS_PER_POINT_DATA_BLOCK == 0 ? OCTREE_POINTS_PER_POINT_DATA_BLOCK : restoredNode->quantPointCount % OCTREE_POINTS_PER_POINT_DATA_BLOCK)== restoredNode->quantPointCount);
-		
-		// Allocate memory for QuantPoints
-		QuantPointBlock* block;
-		for (uint32_t i = 0; i < blockCount; ++i)
+		// Sort the children by file position
+		uint8_t j = i;
+		while ((j > 0) && (filePositions[order[j - 1]] > filePositions[i]))
 		{
-			if (i == 0)
-			{
-				OCTREE_MALLOC(restoredNode->data, QuantPointBlock);
-				block = restoredNode->data;
-			}
-			else
-			{
-				OCTREE_MALLOC(block->next, QuantPointBlock);
-				block = block->next;
-			}
+			order[j] = order[j - 1];
+			--j;
 		}
+		order[j] = i;
+	}
+	
+	acquireLock(BACKINGSTORE_LOCK);
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		const uint8_t rank = order[i];
+		success[rank] = _backingStore->readNode(filePositions[rank], &(block[rank]));
 		
-		// Last block has no successor
-		// More data initialization is not necessary because readQuantPointBlock will overwrite
-		// everything
-		block->next = NULL;
+		// Points per node is limited to quantization grid
+		assert(block[rank].quantPointCount <=	OCTREE_NODE_EDGE_SEGEMENTATION *
+												OCTREE_NODE_EDGE_SEGEMENTATION *
+												OCTREE_NODE_EDGE_SEGEMENTATION);
+	}
+	releaseLock(BACKINGSTORE_LOCK);
+	
+	// No data initialization is necessary because readQuantPoints will overwrite everything
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		Node* const node = &(block[order[i]]);
+		if ((!success[order[i]]) || (node->quantPointCount == 0)) continue;
 		
-		APIFactory::GetInstance().lock(BACKINGSTORE_LOCK);
-		success = _backingStore->readQuantPointBlock(pos, blockCount, restoredNode->data);
-		APIFactory::GetInstance().unlock(BACKINGSTORE_LOCK);
+		QuantPoint* pointArray;
+		OCTREE_MALLOC_ARRAY(pointArray, QuantPoint, calcPointArrayCapacity(node->quantPointCount));
+		node->pointArray = getPointArrayIndex(pointArray, node->quantPointCount);
+	}
+	
+	acquireLock(BACKINGSTORE_LOCK);
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		const uint8_t rank = order[i];
+		Node* const node = &(block[rank]);
+		if ((!success[rank]) || (node->quantPointCount == 0)) continue;
+		
+		success[rank] = _backingStore->readQuantPoints(filePositions[rank], node->quantPointCount, getPointArray(node));
+	}
+	releaseLock(BACKINGSTORE_LOCK);
+	
+	// Children that could not be read are dropped. The others move down to close the gaps.
+	uint8_t restoredMask = 0;
+	uint8_t restoredCount = 0;
+	uint8_t rank = 0;
+	for (uint8_t mask = parentNode->childMask; mask != 0; mask &= mask - 1, ++rank)
+	{
+		Node* node = &(block[rank]);
 		
-		if (!success)
+		if (!success[rank])
 		{
-			logError("QuantPointBlock I/O Error. Read failure.");
+			logError("Node I/O Error. Read failure.");
 			
-			freeNodeFromMemory(restoredNode);
-			parentNode->children[nodeID] = NULL;
-			parentNode->setChildInMemory(nodeID);
+			if (node->childMask != 0) _backingStore->releaseFilePositions(node->children, node->getChildCount());
+			if (node->pointArray != 0) OCTREE_FREE_ARRAY(getPointArray(node), node->quantPointCount);
 			
-			return false;
+			// The slot may be the target of a following move
+			_backingStore->releaseNode(node);
+			continue;
 		}
+		
+		if (restoredCount != rank) moveNodeToSlot(node, &(block[restoredCount]));
+		node = &(block[restoredCount++]);
+		
+		if (node->quantPointCount > 0) rebuildOccupancy(node);
+		
+		++_nodeCount;
+		_pointCount += node->quantPointCount;
+		
+		getNodeState(node)->parent = getNodeIndex(parentNode);
+		restoredMask |= (1 << __builtin_ctz(mask));
 	}
 	
-	return true;
+	if (restoredCount < count)
+	{
+		for (uint8_t i = restoredCount; i < count; ++i) _backingStore->releaseNode(&(block[i]));
+		OCTREE_FREE_BLOCK(&(block[restoredCount]), count - restoredCount);
+	}
+	
+	// Connect restored nodes to parent node
+	_backingStore->releaseFilePositions(parentNode->children, count);
+	parentNode->setChildren(restoredMask, (restoredCount > 0) ? getNodeIndex(block) : 0, true);
+	
+	// Put the restored nodes into the clock (to avoid swapping in the near future)
+	for (uint8_t i = 0; i < restoredCount; ++i) touchNode(&(block[i]));
+	
+	if (isParentLockedHere) unlockNode(parentNode);
+	return (restoredCount == count);
 
 #else
-	parentNode->children[nodeID] = NULL;
-	parentNode->setChildInMemory(nodeID);
+	parentNode->setChildren(0, 0, true);
 		
 	return false;
 #endif
@@ -696,87 +1090,102 @@ bool Octree::restoreNodeFromBackingStore(Node* const parentNode, const uint8_t n
 
 
 /**
-	Checks if a node has children. If this is the case the function will call itself recursivly
-	on the children. If no children are present the node including all QuantPointBlocks is written
-	to backing store. The pointer of the parent to this node is changed to the backing store
-	location and the "backing-store-bit" is set.
+	Writes the children of a node including their points to backing store and frees them. The
+	parent keeps the file position handle of the first child instead of the block. Thus the
+	"backing-store-bit" of the parent is unset.
 	
-	@param node Node that is going to to be swapped to backing store.
-	@param parentNodeID ID that determines the place of Node in parent node.
+	@param parentNode Parent of the block that is going to be swapped. Its children must not have
+		children in memory.
  */
-void Octree::swapNodeToBackingStore(Node* node, int parentNodeID)
+void Octree::swapChildBlockToBackingStore(Node* const parentNode)
 {
-	// Never swap the most recently used node
-	assert(_mostRecentlyUsedNode != node);
-	assert(node->nextUsedNode != NULL);
+	assert(parentNode->getChildrenInMemoryMask() != 0);
 	
-	// Never swap the root node
-	assert(node != _rootNode);
+	const uint8_t count = parentNode->getChildCount();
+	Node* const block = getNode(parentNode->children);
 	
-	// Never swap a locked node
-	assert(!node->isLocked());
-
-	// Never swap a node that has children in memory
-	for (int i = 0; i < 8; ++i) assert(!((node->children[i] != NULL) && (node->isChildInMemory(i))));
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		--_nodeCount;
+		_pointCount -= block[i].quantPointCount;
+	}
 	
-	// Write node and node data to backing store and store location
+	// Write nodes and node data to backing store and store their locations
 #if USE_BACKING_STORE
-	bool success;
-	APIFactory::GetInstance().lock(BACKINGSTORE_LOCK);
+	bool success = true;
+	long filePositions[8];
+	acquireLock(BACKINGSTORE_LOCK);
 	
-	// Points per node is limited to quantization grid
-	assert(node->quantPointCount <= OCTREE_NODE_EDGE_SEGEMENTATION *
-									OCTREE_NODE_EDGE_SEGEMENTATION *
-									OCTREE_NODE_EDGE_SEGEMENTATION);
-
-	success = _backingStore->writeNode(node, &(node->parent->childrenFilePosition[parentNodeID]));
-	APIFactory::GetInstance().unlock(BACKINGSTORE_LOCK);
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		// Points per node is limited to quantization grid
+		assert(block[i].quantPointCount <=	OCTREE_NODE_EDGE_SEGEMENTATION *
+											OCTREE_NODE_EDGE_SEGEMENTATION *
+											OCTREE_NODE_EDGE_SEGEMENTATION);
+		
+		if (!_backingStore->writeNode(&(block[i]), getPointArray(&(block[i])), &(filePositions[i]))) success = false;
+	}
+	
+	releaseLock(BACKINGSTORE_LOCK);
 	if (!success) logError("Node I/O Error. Write failure.");
-
-	node->parent->unsetChildInMemory(parentNodeID);
+	
+	freeChildBlockFromMemory(parentNode);
+	parentNode->setChildren(parentNode->childMask, _backingStore->storeFilePositions(filePositions, count), false);
 #else
-	node->parent->children[parentNodeID] = NULL;
+	freeChildBlockFromMemory(parentNode);
+	parentNode->setChildren(0, 0, true);
 #endif
-	freeNodeFromMemory(node);
-	
-	--_nodeCount;
-	_pointCount -= node->quantPointCount;
 }
 
 
-void Octree::swapLeastRecentlyUsedNodesToBackingStore()
+/**
+	Evicts a block of sibling nodes with the CLOCK (second chance) policy. The clock hand sweeps
+	the used slots of the node bin. Referenced nodes lose their reference bit and are passed. An
+	unreferenced node is evicted with its siblings if none of them is referenced, locked or has
+	children in memory. Inner nodes follow once their children are swapped.
+ */
+void Octree::swapUnreferencedNodeToBackingStore()
 {
-	// The least recent node (node to be swapped)
-	assert(_leastRecentlyUsedNode != NULL);
-	assert(_leastRecentlyUsedNode->parent != NULL);
-	assert(_leastRecentlyUsedNode->nextUsedNode != NULL);
-	assert(_leastRecentlyUsedNode->prevUsedNode == NULL);
-	assert(_leastRecentlyUsedNode != _rootNode);
-
-	// Find first leaf node of the least recently used node
-	uint8_t i = 0;
-	Node* node = _leastRecentlyUsedNode;
-	while (i < 8)
+	const uint32_t slotCount = _memoryPool->getMaximalNumberOfElementsInBin(0);
+	uint8_t roundCount = 0;
+	Node* parent = NULL;
+	
+	while (parent == NULL)
 	{
-		if ((node->children[i] != NULL) && (node->isChildInMemory(i)))
+		Node* const candidate = (_clockHand < slotCount) ?
+			(Node*)_memoryPool->findUsedElement(0, &(_firstNode[_clockHand])) : NULL;
+		
+		// Wrap around
+		if (candidate == NULL)
 		{
-			node = node->children[i];
-			i = 0;
+			_clockHand = 0;
+			if (++roundCount > 2)
+			{
+				logError("Octree: No node can be swapped.\n");
+				assert(false);
+				return;
+			}
+			continue;
 		}
-		else
+		
+		_clockHand = (candidate - _firstNode) + 1;
+		
+		// Root, locked and not yet connected nodes are not in the clock
+		if ((candidate->clockFlags & (OCTREE_NODE_IN_CLOCK | OCTREE_NODE_LOCKED)) != OCTREE_NODE_IN_CLOCK) continue;
+		
+		// Second chance
+		if (candidate->clockFlags & OCTREE_NODE_REFERENCED)
 		{
-			++i;
+			candidate->clockFlags = OCTREE_NODE_IN_CLOCK;
+			continue;
 		}
+		
+		assert(getNodeState(candidate)->parent != 0);
+		Node* const candidateParent = getNode(getNodeState(candidate)->parent);
+		if (isChildBlockEvictable(candidateParent)) parent = candidateParent;
 	}
 	
-	// Find parentNodeID of the node
-	uint8_t parentNodeID = 0;
-	while (	(node->parent->children[parentNodeID] != node) && 
-			(parentNodeID < 8))
-			++parentNodeID;
-	assert(parentNodeID < 8);
-
-	swapNodeToBackingStore(node, parentNodeID);
+	swapChildBlockToBackingStore(parent);
 }
 
 
@@ -805,138 +1214,338 @@ const QuantPoint::PositionNormal Octree::quantizeRelativePosition(
 }
 
 
+// Returns true if the cell of the position holds a point. Otherwise a point is inserted into the
+// cell and counted by the node. Either way outQuantPoint is set to the point of the cell.
 bool Octree::retrieveQuantPointInNode(
 	Node* const node,
 	const QuantPoint::PositionNormal quantizedPosition,
 	QuantPoint** outQuantPoint)
 {
-	if (node->data == NULL)
+	const uint16_t cellID = quantizedPosition >> 7;
+	NodeState* const state = getNodeState(node);
+	const uint16_t index = state->calcCellRank(cellID);
+	
+	QuantPoint* pointArray = getPointArray(node);
+	
+	if (state->isCellOccupied(cellID))
 	{
-		// Node does not have a data block, create one and add first point
-		OCTREE_MALLOC(node->data, QuantPointBlock);
-		node->data->reset();
-		*outQuantPoint = &(node->data->points[0]);
-		return false;
+		*outQuantPoint = &(pointArray[index]);
+		assert((*outQuantPoint)->getPosition() == quantizedPosition);
+		return true;
 	}
+	
+	const uint16_t count = node->quantPointCount;
+	
+	if (pointArray == NULL)
+	{
+		// Node does not have a point array, create one and add first point
+		OCTREE_MALLOC_ARRAY(pointArray, QuantPoint, OCTREE_POINT_ARRAY_MIN_CAPACITY);
+	}
+	else if (count == calcPointArrayCapacity(count))
+	{
+		// Point array is full. Relocate the points to an array of the next size class and leave
+		// room for the new point.
+		QuantPoint* data;
+		OCTREE_MALLOC_ARRAY(data, QuantPoint, 2 * count);
+		memcpy(data, pointArray, index * sizeof(QuantPoint));
+		memcpy(data + index + 1, pointArray + index, (count - index) * sizeof(QuantPoint));
+		OCTREE_FREE_ARRAY(pointArray, count);
+		pointArray = data;
+	}
+	else
+	{
+		// Make room for new element
+		memmove(pointArray + index + 1, pointArray + index, (count - index) * sizeof(QuantPoint));
+	}
+	
+	// The point count selects the size class of the array (see getPointArray)
+	node->quantPointCount = count + 1;
+	node->pointArray = getPointArrayIndex(pointArray, node->quantPointCount);
+	
+	state->setCellOccupied(cellID);
+	*outQuantPoint = &(pointArray[index]);
+	return false;
+}
 
-// Macros to help unroll the bsearch loop
-#define INNER_BSEARCH(smaller, midValue, greater) \
-	cmp = quantizedPosition - (*outQuantPoint = base + midValue)->getPosition();\
-	if (cmp > 0) {greater}\
-	else if (cmp < 0) {smaller}\
-	else {return true;}
-		
-// Note: *outQuantPoint is not set in the cmp>0, cmp<0 branches. Profiling showed slower results
-// propably related to branch prediction?!
-#define LEAF_BSEARCH(midValue) \
-	cmp = quantizedPosition - (*outQuantPoint = base + midValue)->getPosition();\
-	if (cmp == 0) {return true;}\
-	else if ((cmp > 0) && (quantizedPosition - (base + (midValue + 1))->getPosition() == 0))\
-		{*outQuantPoint = base + (midValue + 1); return true;}\
-	else if ((cmp < 0) && (quantizedPosition - (base + (midValue - 1))->getPosition() == 0))\
-		{*outQuantPoint = base + (midValue - 1); return true;}	
-	
-	int cmp;
-	QuantPoint* base;
-	QuantPointBlock* block = node->data;
-	uint16_t fullBlockCount = node->quantPointCount / OCTREE_POINTS_PER_POINT_DATA_BLOCK;
-	
-	// Iterate through all full blocks
-	for (uint16_t i = 0; i < fullBlockCount; ++i)
-	{
-		if (i > 0) block = block->next;
-		base = &(block->points[0]);
-		
-		INNER_BSEARCH(
-			INNER_BSEARCH(
-				INNER_BSEARCH(LEAF_BSEARCH(1), 3, LEAF_BSEARCH(5)),
-				7,
-				INNER_BSEARCH(LEAF_BSEARCH(9), 11, LEAF_BSEARCH(13))),
-			15,
-			INNER_BSEARCH(
-				INNER_BSEARCH(LEAF_BSEARCH(17), 19, LEAF_BSEARCH(21)),
-				23,
-				INNER_BSEARCH(LEAF_BSEARCH(25), 27, LEAF_BSEARCH(29))));
-	}
-
-	// Check if the last full block has a successor
-	if ((block->next == NULL) && (fullBlockCount > 0))
-	{
-		// All blocks are full. Add a new block and add new point
-		OCTREE_MALLOC(block->next, QuantPointBlock);
-		block->next->reset();
-		*outQuantPoint = &(block->next->points[0]);
-		return false;
+
+void Octree::rebuildOccupancy(Node* const node) const
+{
+	assert(node->quantPointCount <= OCTREE_NODE_EDGE_SEGEMENTATION *
+									OCTREE_NODE_EDGE_SEGEMENTATION *
+									OCTREE_NODE_EDGE_SEGEMENTATION);
+	
+	// Files written by older versions are only sorted within blocks of
+	// OCTREE_POINTS_PER_POINT_DATA_BLOCK points. Points must be sorted by their cell IDs across
+	// the entire node to be found by their rank.
+	QuantPoint* const pointArray = getPointArray(node);
+	for (uint16_t i = 1; i < node->quantPointCount; ++i)
+	{
+		if (pointArray[i - 1].getPosition() > pointArray[i].getPosition())
+		{
+			std::sort(pointArray, pointArray + node->quantPointCount, isQuantPointPositionSmaller);
+			break;
+		}
 	}
-	else if (fullBlockCount > 0)
+	
+	NodeState* const state = getNodeState(node);
+	for (uint8_t i = 0; i < 8; ++i) state->occupancy[i] = 0;
+	for (uint16_t i = 0; i < node->quantPointCount; ++i)
 	{
-		// Successor of last block is only relevant if there was at least one full block
-		block = block->next;
+		assert(!state->isCellOccupied(pointArray[i].getPosition() >> 7));
+		state->setCellOccupied(pointArray[i].getPosition() >> 7);
 	}
+}
+
+
+void Octree::calcCenterOfChildNode(	FIXPVECTOR3* const center, 
+									const uint8_t childNodeID,
+									const uint8_t level) const
+{
+	center->x = center->x + (childNodeID & 1 ? 1 : -1) * _nodeIncircleRadius[level];
+	center->y = center->y + (childNodeID & 2 ? 1 : -1) * _nodeIncircleRadius[level];
+	center->z = center->z + (childNodeID & 4 ? 1 : -1) * _nodeIncircleRadius[level];
+}
 
-	// Last block is partially filled
-	// Search for element
-	base = &(block->points[0]);
-	uint16_t pointsInLastBlock = node->quantPointCount % OCTREE_POINTS_PER_POINT_DATA_BLOCK;
+
+bool Octree::isWithinOctreeBounds(const FIXPVECTOR3* const position)
+{
+	return ((-OCTREE_WORLD_HALF_EDGE_LENGTH < position->x) && 
+			(position->x < OCTREE_WORLD_HALF_EDGE_LENGTH) &&
+			(-OCTREE_WORLD_HALF_EDGE_LENGTH < position->y) &&
+			(position->y < OCTREE_WORLD_HALF_EDGE_LENGTH) &&
+			(-OCTREE_WORLD_HALF_EDGE_LENGTH < position->z) &&
+			(position->z < OCTREE_WORLD_HALF_EDGE_LENGTH));
+}
+
+
+// Calculates the transform that centers the bounding box in the octree and scales its longest
+// edge to the edge of the octree. Thus no upper levels are empty and no point is out of bounds.
+void Octree::calcWorldTransform(const VECTOR3* const min, const VECTOR3* const max, WorldTransform* const outTransform)
+{
+	const float_t extent = std::max(max->x - min->x, std::max(max->y - min->y, max->z - min->z));
 	
-	assert(pointsInLastBlock > 0);
-	assert(pointsInLastBlock < 31);
+	// Positions are rounded and the octree bounds are exclusive. Thus a small margin is kept.
+	static const int32_t margin = 16;
+	outTransform->scale = (extent > 0.0f) ? float_t(2 * (OCTREE_WORLD_HALF_EDGE_LENGTH - margin)) / extent : 1.0f;
 	
-	if (pointsInLastBlock < 3)
+	outTransform->translation.x = -0.5f * (min->x + max->x) * outTransform->scale;
+	outTransform->translation.y = -0.5f * (min->y + max->y) * outTransform->scale;
+	outTransform->translation.z = -0.5f * (min->z + max->z) * outTransform->scale;
+}
+
+
+/**
+	Transforms the positions of the points into the fixed point format, checks the octree bounds
+	and quantizes the colors to 15 bpp (see addPoint). Four points are processed at a time if
+	SIMD quantization is enabled.
+ */
+void Octree::quantizePoints(	const WVSPoint* const points,
+								const size_t count,
+								FIXPVECTOR3* const outPositions,
+								uint16_t* const outFiveBitColors,
+								bool* const outIsWithinBounds)
+{
+	size_t i = 0;
+
+#if SSE_POINT_QUANTIZATION
+	for (; i + 4 <= count; i += 4)
 	{
-		cmp = quantizedPosition - (*outQuantPoint = base)->getPosition();
-		if (cmp == 0) return true;
-		else if ((pointsInLastBlock == 2) && (cmp > 0))
+		const WVSPoint* const p = &(points[i]);
+		
+		const __m128i x = roundToNearestInt(_mm_setr_ps(p[0].position.x, p[1].position.x, p[2].position.x, p[3].position.x));
+		const __m128i y = roundToNearestInt(_mm_setr_ps(p[0].position.y, p[1].position.y, p[2].position.y, p[3].position.y));
+		const __m128i z = roundToNearestInt(_mm_setr_ps(p[0].position.z, p[1].position.z, p[2].position.z, p[3].position.z));
+		const __m128i inBounds = _mm_and_si128(_mm_and_si128(isWithinBounds(x), isWithinBounds(y)), isWithinBounds(z));
+		
+		// Take the upper 5 bits of every color channel
+		const __m128i normalColor = _mm_setr_epi32(	loadNormalColorWord(&(p[0])), loadNormalColorWord(&(p[1])),
+													loadNormalColorWord(&(p[2])), loadNormalColorWord(&(p[3])));
+		const __m128i fiveBitColor = _mm_or_si128(
+			_mm_and_si128(_mm_srli_epi32(normalColor, 11), _mm_set1_epi32(0x001F)),
+			_mm_or_si128(
+				_mm_and_si128(_mm_srli_epi32(normalColor, 14), _mm_set1_epi32(0x03E0)),
+				_mm_and_si128(_mm_srli_epi32(normalColor, 17), _mm_set1_epi32(0x7C00))));
+		
+		int32_t xs[4], ys[4], zs[4], inBoundsMasks[4], fiveBitColors[4];
+		_mm_storeu_si128((__m128i*)xs, x);
+		_mm_storeu_si128((__m128i*)ys, y);
+		_mm_storeu_si128((__m128i*)zs, z);
+		_mm_storeu_si128((__m128i*)inBoundsMasks, inBounds);
+		_mm_storeu_si128((__m128i*)fiveBitColors, fiveBitColor);
+		
+		for (uint8_t j = 0; j < 4; ++j)
 		{
-			cmp = quantizedPosition - (*outQuantPoint = base + 1)->getPosition();
-			if (cmp == 0) return true;
+			outPositions[i + j].x = xs[j];
+			outPositions[i + j].y = ys[j];
+			outPositions[i + j].z = zs[j];
+			outFiveBitColors[i + j] = fiveBitColors[j];
+			outIsWithinBounds[i + j] = (inBoundsMasks[j] != 0);
 		}
 	}
-	else
+#elif NEON_POINT_QUANTIZATION
+	for (; i + 4 <= count; i += 4)
 	{
-		// binary search algorithm (equal to c bsearch)
-		// from http://www.google.com/codesearch/p?hl=en#qoCVjtE_vOw/gcc4/trunk/gcc-4.4.3/libiberty/bsearch.c&q=bsearch&sa=N&cd=2&ct=rc
-		uint16_t lim;
-		for (lim = pointsInLastBlock; lim != 0; lim >>= 1)
+		const WVSPoint* const p = &(points[i]);
+		
+		const float32_t xf[4] = {p[0].position.x, p[1].position.x, p[2].position.x, p[3].position.x};
+		const float32_t yf[4] = {p[0].position.y, p[1].position.y, p[2].position.y, p[3].position.y};
+		const float32_t zf[4] = {p[0].position.z, p[1].position.z, p[2].position.z, p[3].position.z};
+		const uint32_t normalColorWords[4] = {	loadNormalColorWord(&(p[0])), loadNormalColorWord(&(p[1])),
+												loadNormalColorWord(&(p[2])), loadNormalColorWord(&(p[3]))};
+		
+		const int32x4_t x = roundToNearestInt(vld1q_f32(xf));
+		const int32x4_t y = roundToNearestInt(vld1q_f32(yf));
+		const int32x4_t z = roundToNearestInt(vld1q_f32(zf));
+		const uint32x4_t inBounds = vandq_u32(vandq_u32(isWithinBounds(x), isWithinBounds(y)), isWithinBounds(z));
+		
+		// Take the upper 5 bits of every color channel
+		const uint32x4_t normalColor = vld1q_u32(normalColorWords);
+		const uint32x4_t fiveBitColor = vorrq_u32(
+			vandq_u32(vshrq_n_u32(normalColor, 11), vdupq_n_u32(0x001F)),
+			vorrq_u32(
+				vandq_u32(vshrq_n_u32(normalColor, 14), vdupq_n_u32(0x03E0)),
+				vandq_u32(vshrq_n_u32(normalColor, 17), vdupq_n_u32(0x7C00))));
+		
+		int32_t xs[4], ys[4], zs[4];
+		uint32_t inBoundsMasks[4], fiveBitColors[4];
+		vst1q_s32(xs, x);
+		vst1q_s32(ys, y);
+		vst1q_s32(zs, z);
+		vst1q_u32(inBoundsMasks, inBounds);
+		vst1q_u32(fiveBitColors, fiveBitColor);
+		
+		for (uint8_t j = 0; j < 4; ++j)
 		{
-			*outQuantPoint = base + (lim >> 1);
-			cmp = quantizedPosition - (*outQuantPoint)->getPosition();
-			if (cmp > 0)
-			{
-				// quantizedPosition > (*outQuantPoint): move right
-				base = (*outQuantPoint) + 1;
-				--lim;
-			}
-			else if (cmp == 0) return true; // We found the QuantPoint
-			// else move left
+			outPositions[i + j].x = xs[j];
+			outPositions[i + j].y = ys[j];
+			outPositions[i + j].z = zs[j];
+			outFiveBitColors[i + j] = fiveBitColors[j];
+			outIsWithinBounds[i + j] = (inBoundsMasks[j] != 0);
 		}
 	}
-	
-	// Check if all points in the block are in the right order
-	for (int i = 0; i < pointsInLastBlock-1; ++i)
+#endif
+
+	// Remaining points (or all points without SIMD quantization)
+	for (; i < count; ++i)
 	{
-		assert(block->points[i].getPosition() < block->points[i+1].getPosition());
+		outPositions[i].x = static_cast<int32_t>(roundf(points[i].position.x));
+		outPositions[i].y = static_cast<int32_t>(roundf(points[i].position.y));
+		outPositions[i].z = static_cast<int32_t>(roundf(points[i].position.z));
+		outIsWithinBounds[i] = isWithinOctreeBounds(&(outPositions[i]));
+		
+		outFiveBitColors[i] =	((points[i].color.red >> 3) |	
+								((points[i].color.green >> 3) << 5) |
+								((points[i].color.blue >> 3) << 10));
 	}
+}
+
+
+// Returns the level of the node that stores the point natively. This is the first level with
+// voxels smaller than the point radius, but not deeper than the leaf level.
+const uint8_t Octree::calcInsertionLevel(const WVSPoint* const point, const uint8_t leafLevel)
+{
+	// Convert radius to int
+	const uint32_t radius = roundf(point->radius);
 	
-	// Make room for new element
-	// Position of the new point depends on the last compare
-	// If the last compare resulted in "greater" than the new element if behind the element that
-	// was look at last
-	*outQuantPoint += (cmp > 0 ? 1 : 0);
-	int bytesToMove = (pointsInLastBlock - ((*outQuantPoint) - &(block->points[0]))) * sizeof(QuantPoint);
-	memmove((*outQuantPoint) + 1, (*outQuantPoint), bytesToMove);
+	// Voxel incircle radius of a level (see _voxelIncircleRadius)
+	uint8_t level = 0;
+	while ((radius < uint32_t(OCTREE_WORLD_EDGE_LENGTH >> (level + 4))) && (level < leafLevel)) ++level;
 	
-	return false;
+	return level;
 }
 
 
-void Octree::calcCenterOfChildNode(	FIXPVECTOR3* const center, 
-									const uint8_t childNodeID,
-									const uint8_t level) const
+// Spreads the lower 21 bits of a value to every third bit of a 64 bit value
+// see http://graphics.stanford.edu/~seander/bithacks.html#InterleaveBMN
+static inline uint64_t spreadBitsByThree(uint64_t value)
 {
-	center->x = center->x + (childNodeID & 1 ? 1 : -1) * _nodeIncircleRadius[level];
-	center->y = center->y + (childNodeID & 2 ? 1 : -1) * _nodeIncircleRadius[level];
-	center->z = center->z + (childNodeID & 4 ? 1 : -1) * _nodeIncircleRadius[level];
+	value &= 0x1FFFFF;
+	value = (value | value << 32) & 0x1F00000000FFFFULL;
+	value = (value | value << 16) & 0x1F0000FF0000FFULL;
+	value = (value | value << 8) & 0x100F00F00F00F00FULL;
+	value = (value | value << 4) & 0x10C30C30C30C30C3ULL;
+	value = (value | value << 2) & 0x1249249249249249ULL;
+	return value;
+}
+
+
+// Calculates the Morton key (Z-order) of a position within the octree bounds. Three bits encode
+// the child node ID of one level (zyx, equal to the cell ID in addPoint). The root level child is
+// encoded in the most significant bits. Consequently sorting points by key groups all points of a
+// subtree together.
+const uint64_t Octree::calcMortonKey(const FIXPVECTOR3* const position)
+{
+	assert(isWithinOctreeBounds(position));
+	
+	// Move origin to the bottom-back-left corner of the octree. A voxel has an edge length of 2^4
+	// on leaf level. Thus the lower 4 bits do not change the path from root to leaf.
+	const uint64_t x = uint64_t(position->x + OCTREE_WORLD_HALF_EDGE_LENGTH) >> 4;
+	const uint64_t y = uint64_t(position->y + OCTREE_WORLD_HALF_EDGE_LENGTH) >> 4;
+	const uint64_t z = uint64_t(position->z + OCTREE_WORLD_HALF_EDGE_LENGTH) >> 4;
+	
+	return (spreadBitsByThree(x) | (spreadBitsByThree(y) << 1) | (spreadBitsByThree(z) << 2));
+}
+
+
+// Inserts a point into the node _insertionNodeCache[level] and all its parents (= LODs)
+void Octree::insertQuantPointIntoCachedNodes(
+	const FIXPVECTOR3* const position,
+	const uint16_t fiveBitColor,
+	const uint8_t normalIndex,
+	uint8_t level)
+{
+	// Iterate over all LODs and insert the point
+	// Start from finest LOD to coarest LOD
+	// Native bit is set for the finest level
+	uint16_t nativeBit = 1 << 15;
+	QuantPoint* quantPoint;
+
+	while (level > 0)
+	{
+		// Calculate the position within the node
+		QuantPoint::PositionNormal qPos = quantizeRelativePosition(
+			position,
+			&(_insertionNodeCache[level].center),
+			level);
+
+		// Get the memory location of that position
+		if (retrieveQuantPointInNode(_insertionNodeCache[level].node, qPos, &quantPoint))
+		{
+			// Check if a native point is on your path to the root node			
+			// If yes, we can exit early
+			if ((quantPoint->isNative() == true) && (nativeBit == 0)) return;
+			
+			// No native point on the path. Thus we set the new normal and mix the colors
+			// Attention: We also mix if the point in the octree is native and the point to be
+			// inserted is native --> looks better.
+		
+			// Set normal of the new point
+			quantPoint->positionNormal = qPos | normalIndex;
+			
+			// Merge colors
+			quantPoint->mergeColor(fiveBitColor, nativeBit);
+		}
+		else
+		{
+			// Position is not yet occupied in node
+			// Set position, normal
+			quantPoint->positionNormal = qPos | normalIndex;
+			// Set color and native bit
+			quantPoint->colorNative = fiveBitColor | nativeBit;
+			
+			// Increase octree pointcount
+			++_pointCount;
+		}
+		
+		// Coarser levels are synthesized by generateLODs
+		if (_isLODGenerationDeferred) return;
+
+		// Go to next level
+		--level;
+		
+		// All lower levels provide no native point
+		nativeBit = 0;
+	}
 }
 
 
@@ -951,12 +1560,7 @@ void Octree::addPoint(const WVSPoint* const point)
 									static_cast<int32_t>(roundf(point->position.z)) };
 	
 	// Check if the point is within the octree bounds
-	if (!(	(-OCTREE_WORLD_HALF_EDGE_LENGTH < position.x) && 
-			(position.x < OCTREE_WORLD_HALF_EDGE_LENGTH) &&
-			(-OCTREE_WORLD_HALF_EDGE_LENGTH < position.y) &&
-			(position.y < OCTREE_WORLD_HALF_EDGE_LENGTH) &&
-			(-OCTREE_WORLD_HALF_EDGE_LENGTH < position.z) &&
-			(position.z < OCTREE_WORLD_HALF_EDGE_LENGTH)))
+	if (!isWithinOctreeBounds(&position))
 	{
 		logError("Adding point failed. Reason: Position out of octree bounds.\n");
 		return;
@@ -967,126 +1571,456 @@ void Octree::addPoint(const WVSPoint* const point)
 									((point->color.green >> 3) << 5) |
 									((point->color.blue >> 3) << 10));
 
-	// Convert radius to int
-	const uint32_t radius = roundf(point->radius);
+	const uint8_t insertionLevel = calcInsertionLevel(point, _leafLevel);
 
 	// Start on root level
 	Node *node = _rootNode;
 	FIXPVECTOR3 center = {0, 0, 0};
 	
-	uint8_t level = 0;
-	while ((radius < _voxelIncircleRadius[level]) && (level < OCTREE_LEAF_LEVEL))
+	uint8_t level = 0;
+	while (level < insertionLevel)
+	{
+		// Go one level deeper
+		++level;
+		
+		// Determine appropriate child node for point
+		uint8_t cellID = 0;
+		if (center.x <= position.x) cellID |= 1;
+		if (center.y <= position.y) cellID |= 2;
+		if (center.z <= position.z) cellID |= 4;
+		
+		// Children do exist but are located on backing store
+		if ((!node->areChildrenInMemory()) && (!restoreChildNodesFromBackingStore(node)))
+		{
+			// Put the locked part of the path back into the clock
+			for (uint8_t i = level - 1; i > 0; --i) unlockNode(_insertionNodeCache[i].node);
+			
+			releaseLock(OCTREE_LOCK);
+			logError("Adding point failed. Reason: Backing store node restore failed.\n");
+			return;
+		}
+		
+		// Child node does not exist
+		if (!node->hasChild(cellID)) addChildNode(node, cellID);
+		
+		// Calculuate center of the next level
+		calcCenterOfChildNode(&center, cellID, level);
+		
+		// From that point the node has to be in memory
+		node = getChild(node, cellID);
+		assert(getNodeState(node)->parent);
+		assert(center.x != 0);
+		assert(center.y != 0);
+		assert(center.z != 0);
+		
+		// The path must stay in memory while nodes and points further down are allocated
+		lockNode(node);
+		
+		_insertionNodeCache[level].node = node;
+		_insertionNodeCache[level].center = center;
+	}
+	
+	insertQuantPointIntoCachedNodes(&position, fiveBitColor, point->normalIndex, level);
+	
+	// Put the path back into the clock (deepest node first)
+	for (; level > 0; --level) unlockNode(_insertionNodeCache[level].node);
+}
+
+
+// Adds a batch of points to the octree. The points are sorted along the Morton curve first.
+// Consecutive points share the path from the root node to their deepest common ancestor. This
+// path remains in _insertionNodeCache and only the diverging part is traversed per point.
+// Attention: OCTREE_LOCK has to be active (see addPoint)
+void Octree::addPoints(const WVSPoint* const points, const size_t count)
+{
+	if (count == 0) return;
+	
+	MortonPoint* sortedPoints = new MortonPoint[count];
+	size_t sortedPointCount = 0;
+	
+	// Transform floating point vectors in fix point format and quantize colors to 15 bpp
+	FIXPVECTOR3* positions = new FIXPVECTOR3[count];
+	uint16_t* fiveBitColors = new uint16_t[count];
+	bool* isWithinBounds = new bool[count];
+	quantizePoints(points, count, positions, fiveBitColors, isWithinBounds);
+	
+	for (size_t i = 0; i < count; ++i)
+	{
+		// Check if the point is within the octree bounds
+		if (!isWithinBounds[i])
+		{
+			logError("Adding point failed. Reason: Position out of octree bounds.\n");
+			continue;
+		}
+		
+		MortonPoint* sortedPoint = &(sortedPoints[sortedPointCount]);
+		sortedPoint->position = positions[i];
+		sortedPoint->mortonKey = calcMortonKey(&(sortedPoint->position));
+		sortedPoint->pointID = i;
+		++sortedPointCount;
+	}
+	
+	std::sort(sortedPoints, sortedPoints + sortedPointCount);
+	
+	// All nodes on the cached path are locked. Otherwise swapUnreferencedNodeToBackingStore
+	// could evict them while we allocate memory for nodes and points further down the path.
+	_insertionNodeCache[0].node = _rootNode;
+	_insertionNodeCache[0].center.x = 0;
+	_insertionNodeCache[0].center.y = 0;
+	_insertionNodeCache[0].center.z = 0;
+	uint8_t cachedLevel = 0;
+	uint64_t previousMortonKey = 0;
+	
+	for (size_t i = 0; i < sortedPointCount; ++i)
+	{
+		const MortonPoint* const sortedPoint = &(sortedPoints[i]);
+		const WVSPoint* const point = &(points[sortedPoint->pointID]);
+		const uint8_t insertionLevel = calcInsertionLevel(point, _leafLevel);
+		
+		// Find the deepest level that is shared with the path of the previous point. The most
+		// significant differing bit determines the first level with a different child node ID.
+		uint8_t sharedLevel = OCTREE_LEAF_LEVEL;
+		const uint64_t differingBits = sortedPoint->mortonKey ^ previousMortonKey;
+		if (differingBits != 0)
+		{
+			const uint8_t mostSignificantBit = 63 - __builtin_clzll(differingBits);
+			sharedLevel = OCTREE_LEAF_LEVEL - (mostSignificantBit / 3) - 1;
+		}
+		if (sharedLevel > insertionLevel) sharedLevel = insertionLevel;
+		if (sharedLevel > cachedLevel) sharedLevel = cachedLevel;
+		
+		// Release the part of the path that is not shared (deepest node first)
+		while (cachedLevel > sharedLevel)
+		{
+			unlockNode(_insertionNodeCache[cachedLevel].node);
+			--cachedLevel;
+		}
+		
+		// Descend from the deepest shared node to the insertion level
+		Node* node = _insertionNodeCache[cachedLevel].node;
+		FIXPVECTOR3 center = _insertionNodeCache[cachedLevel].center;
+		
+		while (cachedLevel < insertionLevel)
+		{
+			const uint8_t level = cachedLevel + 1;
+			const uint8_t cellID = (sortedPoint->mortonKey >> (3 * (OCTREE_LEAF_LEVEL - level))) & 7;
+			
+			// Children do exist but are located on backing store
+			if ((!node->areChildrenInMemory()) && (!restoreChildNodesFromBackingStore(node))) break;
+			
+			// Child node does not exist
+			if (!node->hasChild(cellID)) addChildNode(node, cellID);
+			
+			// Calculuate center of the next level
+			calcCenterOfChildNode(&center, cellID, level);
+			
+			node = getChild(node, cellID);
+			lockNode(node);
+			
+			cachedLevel = level;
+			_insertionNodeCache[cachedLevel].node = node;
+			_insertionNodeCache[cachedLevel].center = center;
+		}
+		
+		// The cached path belongs to this point now (even if it is incomplete)
+		previousMortonKey = sortedPoint->mortonKey;
+		
+		if (cachedLevel < insertionLevel)
+		{
+			logError("Adding point failed. Reason: Backing store node restore failed.\n");
+			continue;
+		}
+		
+		insertQuantPointIntoCachedNodes(	&(sortedPoint->position),
+											fiveBitColors[sortedPoint->pointID],
+											point->normalIndex,
+											insertionLevel);
+	}
+	
+	// Put the remaining path back into the clock
+	while (cachedLevel > 0)
+	{
+		unlockNode(_insertionNodeCache[cachedLevel].node);
+		--cachedLevel;
+	}
+	
+	delete[] isWithinBounds;
+	delete[] fiveBitColors;
+	delete[] positions;
+	delete[] sortedPoints;
+}
+
+
+// Checks if the box [boxMin, boxMin + edgeLength) overlaps the region [regionMin, regionMax]
+static inline bool isBoxOverlappingRegion(	const Octree::FIXPVECTOR3* const boxMin,
+											const int32_t edgeLength,
+											const Octree::FIXPVECTOR3* const regionMin,
+											const Octree::FIXPVECTOR3* const regionMax)
+{
+	return ((boxMin->x <= regionMax->x) && (regionMin->x < boxMin->x + edgeLength) &&
+			(boxMin->y <= regionMax->y) && (regionMin->y < boxMin->y + edgeLength) &&
+			(boxMin->z <= regionMax->z) && (regionMin->z < boxMin->z + edgeLength));
+}
+
+
+// Checks if the box [boxMin, boxMin + edgeLength) is entirely within the region [regionMin, regionMax]
+static inline bool isBoxWithinRegion(	const Octree::FIXPVECTOR3* const boxMin,
+										const int32_t edgeLength,
+										const Octree::FIXPVECTOR3* const regionMin,
+										const Octree::FIXPVECTOR3* const regionMax)
+{
+	return ((regionMin->x <= boxMin->x) && (boxMin->x + edgeLength - 1 <= regionMax->x) &&
+			(regionMin->y <= boxMin->y) && (boxMin->y + edgeLength - 1 <= regionMax->y) &&
+			(regionMin->z <= boxMin->z) && (boxMin->z + edgeLength - 1 <= regionMax->z));
+}
+
+
+// Removes all native points within the region [regionMin, regionMax] (octree coordinates, see
+// addPoint). The LOD points of the cells that overlap the region are synthesized again from the
+// remaining points. Modified nodes are written to the backing store when they are swapped.
+bool Octree::removeRegion(const VECTOR3* const regionMin, const VECTOR3* const regionMax)
+{
+	// Nodes of a static file are never written back (see StaticBackingStore)
+	if (_isStaticFile)
+	{
+		logError("Removing region failed. Reason: Static point cloud files are read-only.\n");
+		return false;
+	}
+	
+	acquireLock(OCTREE_LOCK);
+	removeRegionFromTree(regionMin, regionMax);
+	releaseLock(OCTREE_LOCK);
+	
+	return true;
+}
+
+
+// Removes all native points within the region and adds the given points (e.g. a new scan of a
+// building). The points are expected to be within the region.
+bool Octree::replaceRegion(	const VECTOR3* const regionMin,
+							const VECTOR3* const regionMax,
+							const WVSPoint* const points,
+							const size_t count)
+{
+	if (_isStaticFile)
+	{
+		logError("Replacing region failed. Reason: Static point cloud files are read-only.\n");
+		return false;
+	}
+	
+	acquireLock(OCTREE_LOCK);
+	removeRegionFromTree(regionMin, regionMax);
+	addPoints(points, count);
+	releaseLock(OCTREE_LOCK);
+	
+	return true;
+}
+
+
+// Attention: OCTREE_LOCK has to be active
+void Octree::removeRegionFromTree(const VECTOR3* const regionMin, const VECTOR3* const regionMax)
+{
+	// Points are compared in fix point format (see addPoint)
+	const FIXPVECTOR3 fixedRegionMin = {	static_cast<int32_t>(roundf(regionMin->x)),
+											static_cast<int32_t>(roundf(regionMin->y)),
+											static_cast<int32_t>(roundf(regionMin->z)) };
+	const FIXPVECTOR3 fixedRegionMax = {	static_cast<int32_t>(roundf(regionMax->x)),
+											static_cast<int32_t>(roundf(regionMax->y)),
+											static_cast<int32_t>(roundf(regionMax->z)) };
+	
+	// Queued restores may refer to nodes that are freed. The render pass queues them again.
+	for (uint32_t i = 0; i < OCTREE_ASYNC_NODE_RESTORE_RING_BUFFER_LENGTH; ++i)
+		_asyncRestoreRingBuffer[i] = NULL;
+	
+	const FIXPVECTOR3 rootCenter = {0, 0, 0};
+	LODGrid* grids = new LODGrid[OCTREE_LEAF_LEVEL + 1];
+	removeRegionOfNode(_rootNode, &rootCenter, 0, &fixedRegionMin, &fixedRegionMax, grids);
+	delete[] grids;
+}
+
+
+/**
+	Removes the region from the subtree of a node. Only child nodes that overlap the region are
+	visited. Child nodes entirely within the region are dropped without restoring them from the
+	backing store (their space in the backing store file is not reclaimed).
+	
+	@param grids Accumulation grids for the level of the node and all levels below
+	@returns Returns true if the node is empty afterwards (no points and no children).
+ */
+bool Octree::removeRegionOfNode(	Node* const node,
+									const FIXPVECTOR3* const nodeCenter,
+									const uint8_t level,
+									const FIXPVECTOR3* const regionMin,
+									const FIXPVECTOR3* const regionMax,
+									LODGrid* const grids)
+{
+	LODGrid* const grid = &(grids[level]);
+	for (uint8_t i = 0; i < 8; ++i) grid->occupancy[i] = 0;
+	
+	for (uint8_t mask = node->childMask; mask != 0; mask &= mask - 1)
 	{
-		// Go one level deeper
-		++level;
+		const uint8_t i = __builtin_ctz(mask);
 		
-		// Determine appropriate child node for point
-		uint8_t cellID = 0;
-		if (center.x <= position.x) cellID |= 1;
-		if (center.y <= position.y) cellID |= 2;
-		if (center.z <= position.z) cellID |= 4;
+		FIXPVECTOR3 childCenter = *nodeCenter;
+		calcCenterOfChildNode(&childCenter, i, level + 1);
+		
+		const int32_t childRadius = _nodeIncircleRadius[level + 1];
+		const FIXPVECTOR3 childMin = {	childCenter.x - childRadius,
+										childCenter.y - childRadius,
+										childCenter.z - childRadius };
+		
+		// Cells of this node that do not overlap the region are not repaired. Thus the child is
+		// not needed.
+		if (!isBoxOverlappingRegion(&childMin, 2 * childRadius, regionMin, regionMax)) continue;
 		
-		if ((node->isChildInMemory(cellID)) && (node->children[cellID] == NULL))
+		if (isBoxWithinRegion(&childMin, 2 * childRadius, regionMin, regionMax))
 		{
-			// Child node does not exist
-			OCTREE_MALLOC(node->children[cellID], Node);
-			node->children[cellID]->reset();
-			node->children[cellID]->parent = node;
-			
-			// New node created
-			_nodeCount++;
+			removeChildNode(node, i);
+			continue;
 		}
-		else if (!node->isChildInMemory(cellID))
+		
+		// Restore children from backing store if not present. Children that could not be read
+		// are removed.
+		if ((!node->areChildrenInMemory()) && (!restoreChildNodesFromBackingStore(node)))
+			logError("Removing region failed. Reason: Backing store node restore failed.\n");
+		
+		if (!node->hasChild(i)) continue;
+		
+		// Child must stay in memory until its points are accumulated
+		Node* const child = getChild(node, i);
+		lockNode(child);
+		
+		if (removeRegionOfNode(child, &childCenter, level + 1, regionMin, regionMax, grids))
 		{
-			// Child does exist but is located on backing store
-			if (!restoreNodeFromBackingStore(node, cellID))
-			{
-				APIFactory::GetInstance().unlock(OCTREE_LOCK);
-				logError("Adding point failed. Reason: Backing store node restore failed.\n");
-				return;
-			}
+			unlockNode(child);
+			removeChildNode(node, i);
+			continue;
 		}
 		
-		// Calculuate center of the next level
-		calcCenterOfChildNode(&center, cellID, level);
-		
-		// From that point the node has to be in memory
-		assert(node->isChildInMemory(cellID));
-		node = node->children[cellID];
-		assert(node->parent);
-		assert(center.x != 0);
-		assert(center.y != 0);
-		assert(center.z != 0);
-		touchNode(node);
+		// Root node holds no points
+		if (level > 0) accumulateLODCells(grid, getPointArray(child), child->quantPointCount, i);
 		
-		_insertionNodeCache[level].node = node;
-		_insertionNodeCache[level].center = center;
+		unlockNode(child);
 	}
 	
+	if (level > 0) removeRegionCells(node, nodeCenter, level, regionMin, regionMax, grid);
 	
-	// Iterate over all LODs and insert the point
-	// Start from finest LOD to coarest LOD
-	// Native bit is set for the finest level
-	uint16_t nativeBit = 1 << 15;
-	QuantPoint* quantPoint;
+	return ((node->childMask == 0) && (node->quantPointCount == 0));
+}
 
-	while (level > 0)
-	{
-		// Calculate the position within the node
-		QuantPoint::PositionNormal qPos = quantizeRelativePosition(
-			&(position),
-			&(_insertionNodeCache[level].center),
-			level);
 
-		// Get the memory location of that position
-		if (retrieveQuantPointInNode(_insertionNodeCache[level].node, qPos, &quantPoint))
+/**
+	Rewrites the points of a node. Cells outside the region are kept. Within the region native
+	points are removed if the cell center is within the region. All other cells that overlap the
+	region get the LOD point of the remaining child points (or are cleared if there are none).
+	
+	@param grid Points of the child nodes that overlap the region (see accumulateLODCells)
+ */
+void Octree::removeRegionCells(	Node* const node,
+								const FIXPVECTOR3* const nodeCenter,
+								const uint8_t level,
+								const FIXPVECTOR3* const regionMin,
+								const FIXPVECTOR3* const regionMax,
+								const LODGrid* const grid)
+{
+	const int32_t voxelRadius = _voxelIncircleRadius[level];
+	const FIXPVECTOR3 nodeMin = {	nodeCenter->x - _nodeIncircleRadius[level],
+									nodeCenter->y - _nodeIncircleRadius[level],
+									nodeCenter->z - _nodeIncircleRadius[level] };
+	
+	NodeState* const state = getNodeState(node);
+	QuantPoint* const pointArray = getPointArray(node);
+	QuantPoint points[8*8*8];
+	uint16_t pointCount = 0;
+	uint16_t index = 0;
+	
+	// Cells are visited in order of their cell IDs
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		uint64_t cells = state->occupancy[i] | grid->occupancy[i];
+		
+		while (cells != 0)
 		{
-			// Check if a native point is on your path to the root node			
-			// If yes, we can exit early
-			if ((quantPoint->isNative() == true) && (nativeBit == 0)) return;
+			const uint16_t cellID = (i << 6) | __builtin_ctzll(cells);
+			cells &= cells - 1;
 			
-			// No native point on the path. Thus we set the new normal and mix the colors
-			// Attention: We also mix if the point in the octree is native and the point to be
-			// inserted is native --> looks better.
-		
-			// Set normal of the new point
-			quantPoint->positionNormal = qPos | point->normalIndex;
+			const QuantPoint* const quantPoint = state->isCellOccupied(cellID) ? &(pointArray[index++]) : NULL;
 			
-			// Merge colors
-			static const uint16_t redMask = 31; 
-			static const uint16_t greenMask = 31 << 5;
-			static const uint16_t blueMask = 31 << 10;
+			const FIXPVECTOR3 cellMin = {	nodeMin.x + (cellID & 7) * 2 * voxelRadius,
+											nodeMin.y + ((cellID >> 3) & 7) * 2 * voxelRadius,
+											nodeMin.z + (cellID >> 6) * 2 * voxelRadius };
 			
-			const uint16_t red = (((quantPoint->colorNative & redMask) + 
-								  (fiveBitColor & redMask)) >> 1) & redMask;
-			const uint16_t green = (((quantPoint->colorNative & greenMask) + 
-									(fiveBitColor & greenMask)) >> 1) & greenMask;
-			const uint16_t blue = (((quantPoint->colorNative & blueMask) + 
-								   (fiveBitColor & blueMask)) >> 1) & blueMask;
+			if (!isBoxOverlappingRegion(&cellMin, 2 * voxelRadius, regionMin, regionMax))
+			{
+				if (quantPoint != NULL) points[pointCount++] = *quantPoint;
+				continue;
+			}
 			
-			quantPoint->colorNative = red | green | blue | nativeBit;
-		}
-		else
-		{
-			// Position is not yet occupied in node
-			// Set position, normal
-			quantPoint->positionNormal = qPos | point->normalIndex;
-			// Set color and native bit
-			quantPoint->colorNative = fiveBitColor | nativeBit;
-				
-			// Increase quant point count in node
-			++(_insertionNodeCache[level].node->quantPointCount);
+			const FIXPVECTOR3 cellCenter = {	cellMin.x + voxelRadius,
+												cellMin.y + voxelRadius,
+												cellMin.z + voxelRadius };
 			
-			// Increase octree pointcount
-			++_pointCount;
+			if ((quantPoint != NULL) && quantPoint->isNative() &&
+				!isBoxOverlappingRegion(&cellCenter, 1, regionMin, regionMax))
+			{
+				points[pointCount++] = *quantPoint;
+			}
+			else if (grid->occupancy[i] & (uint64_t(1) << (cellID & 63)))
+			{
+				calcLODPoint(&(grid->cells[cellID]), cellID, &(points[pointCount++]));
+			}
 		}
+	}
+	
+	assert(index == node->quantPointCount);
+	
+	// Move the points to an array of the matching size class
+	QuantPoint* newPointArray = (pointCount > 0) ? pointArray : NULL;
+	if ((pointCount == 0) || (pointArray == NULL) ||
+		(calcPointArrayCapacity(pointCount) != calcPointArrayCapacity(node->quantPointCount)))
+	{
+		if (pointArray != NULL) OCTREE_FREE_ARRAY(pointArray, node->quantPointCount);
+		if (pointCount > 0) OCTREE_MALLOC_ARRAY(newPointArray, QuantPoint, calcPointArrayCapacity(pointCount));
+	}
+	
+	if (pointCount > 0) memcpy(newPointArray, points, pointCount * sizeof(QuantPoint));
+	
+	_pointCount = _pointCount - node->quantPointCount + pointCount;
+	node->quantPointCount = pointCount;
+	node->pointArray = getPointArrayIndex(newPointArray, pointCount);
+	
+	for (uint8_t i = 0; i < 8; ++i) state->occupancy[i] = 0;
+	for (uint16_t i = 0; i < pointCount; ++i) state->setCellOccupied(points[i].getPosition() >> 7);
+}
 
-		// Go to next level
-		--level;
-		
-		// All lower levels provide no native point
-		nativeBit = 0;
+
+// Frees the points and all descendants of a node. Descendants on backing store are dropped. The
+// slot of the node itself is freed by the caller (see removeChildNode).
+void Octree::freeSubtreeFromMemory(Node* const node)
+{
+	const uint8_t count = node->getChildCount();
+	
+	if (node->getSwappedChildrenMask() != 0)
+	{
+#if USE_BACKING_STORE
+		_backingStore->releaseFilePositions(node->children, count);
+#endif
+	}
+	else if (count > 0)
+	{
+		Node* const block = getNode(node->children);
+		for (uint8_t i = 0; i < count; ++i) freeSubtreeFromMemory(&(block[i]));
+		OCTREE_FREE_BLOCK(block, count);
 	}
+	
+	--_nodeCount;
+	_pointCount -= node->quantPointCount;
+	
+	// Removes the node from the clock
+	node->clockFlags = 0;
+	
+	if (node->pointArray != 0) OCTREE_FREE_ARRAY(getPointArray(node), node->quantPointCount);
+	_isMemoryCompacted = false;
 }
 
 
@@ -1099,7 +2033,7 @@ void Octree::estimateInteractiveRenderQuality(float_t* const targetRenderQuality
 	_renderQuality = 0.0f;
 	FIXPVECTOR3 rootCenter = {0, 0, 0};
 
-	APIFactory::GetInstance().lock(OCTREE_LOCK);
+	acquireLock(OCTREE_LOCK);
 	do
 	{
 		_renderQuality += RENDER_QUALITY_COARSE_ADJUSTMENT;
@@ -1114,7 +2048,7 @@ void Octree::estimateInteractiveRenderQuality(float_t* const targetRenderQuality
 	}
 	while (	(*_voxelCount < maxPointCount) && 
 			(lastTryCount < *_voxelCount));
-	APIFactory::GetInstance().unlock(OCTREE_LOCK);
+	releaseLock(OCTREE_LOCK);
 	
 	*targetRenderQuality = _renderQuality;
 }
@@ -1144,7 +2078,7 @@ void Octree::countRenderBufferPoints(
 	// If the node is outside the view frustum, ignore it
 	if (nodeViewFrustumRelation == MiniGL::ViewFrustum::OUT) return;
 	
-	if ((level == OCTREE_LEAF_LEVEL) ||
+	if ((level == _leafLevel) ||
 		(_renderViewFrustum->squaredDistanceToCamera(&floatingNodeCenter) > 
 			_distanceLevelThreshold[level] * _renderQuality))
 	{
@@ -1157,24 +2091,24 @@ void Octree::countRenderBufferPoints(
 		Node* childNode;
 		FIXPVECTOR3 childCenter;
 		
-		for (uint8_t i = 0; i < 8; ++i)
+		for (uint8_t mask = node->getChildrenInMemoryMask(); mask != 0; mask &= mask - 1)
 		{
-			childNode = node->children[i];
-			if ((node->children[i] != NULL) && (node->isChildInMemory(i)))
-			{
-				// Calc child node center
-				childCenter.x = nodeCenter->x;
-				childCenter.y = nodeCenter->y;
-				childCenter.z = nodeCenter->z;
-				calcCenterOfChildNode(&childCenter, i, level+1);
-				
-				countRenderBufferPoints(
-						childNode,
-						&childCenter,
-						level+1,
-						maxPointCount,
-						nodeViewFrustumRelation);
-			}
+			const uint8_t i = __builtin_ctz(mask);
+			
+			childNode = getChild(node, i);
+			
+			// Calc child node center
+			childCenter.x = nodeCenter->x;
+			childCenter.y = nodeCenter->y;
+			childCenter.z = nodeCenter->z;
+			calcCenterOfChildNode(&childCenter, i, level+1);
+			
+			countRenderBufferPoints(
+					childNode,
+					&childCenter,
+					level+1,
+					maxPointCount,
+					nodeViewFrustumRelation);
 		}
 	}
 }
@@ -1226,7 +2160,7 @@ void Octree::copyPointsToBuffer(
 	if (*_voxelCount >= 1000000) return;
 	#endif
 	
-	if (level == OCTREE_LEAF_LEVEL)
+	if (level == _leafLevel)
 	{
 		// Try to draw everything if we are at leaf level
 		copyVoxelsToGPU = true;
@@ -1247,55 +2181,49 @@ void Octree::copyPointsToBuffer(
 		// We are not at leaf level and according to the distance we should not draw this level
 		// Check if we have really more detailed voxels in the next deeper level
 		uint16_t finerLODVoxelCount = 0;
-		for (uint8_t i = 0; i < 8; ++i)
+		if (!node->areChildrenInMemory())
 		{
-			if (node->children[i] != NULL)
+			if (_instantNodeRestore == true)
 			{
-				if (node->isChildInMemory(i))
+				// Check user interaction after all 32 node restores
+				if (_instantNodeRestoreCount > 32)
+				{
+					bool isRenderingCanceled;
+					(_renderCallbackObject->*_renderCallbackMethod)(0, &isRenderingCanceled);
+					if (isRenderingCanceled) _instantNodeRestore = false;
+					_instantNodeRestoreCount = 0;
+				}
+				else
 				{
-					// We found a child.
-					finerLODVoxelCount += node->children[i]->quantPointCount;
+					++_instantNodeRestoreCount;
 				}
-				else if (_instantNodeRestore == true)
+
+				// Since interactive rendering is not necessary we load the nodes right away
+				restoreChildNodesFromBackingStore(node);
+				
+				// Make sure the new loaded data is shown right away
+				// (thus we avoid deep long loads)
+				copyVoxelsToGPU = true;
+			}
+			else
+			{
+				// We found children. But they are on backing store.
+				if (_asyncRestoreRingBufferTail >= OCTREE_ASYNC_NODE_RESTORE_RING_BUFFER_LENGTH - 1)
 				{
-					// Check user interaction after all 32 node restores
-					if (_instantNodeRestoreCount > 32)
-					{
-						bool isRenderingCanceled;
-						(_renderCallbackObject->*_renderCallbackMethod)(0, &isRenderingCanceled);
-						if (isRenderingCanceled) _instantNodeRestore = false;
-						_instantNodeRestoreCount = 0;
-					}
-					else
-					{
-						++_instantNodeRestoreCount;
-					}
-
-					// Since interactive rendering is not necessary we load the node right away
-					restoreChildNodesFromBackingStore(node);
-					finerLODVoxelCount += node->children[i]->quantPointCount;
-					
-					// Make sure the new loaded data is shown right away
-					// (thus we avoid deep long loads)
-					copyVoxelsToGPU = true;
+					_asyncRestoreRingBufferTail = 0;
 				}
 				else
 				{
-					// We found a child. But child is on backing store.
-					if (_asyncRestoreRingBufferTail >= OCTREE_ASYNC_NODE_RESTORE_RING_BUFFER_LENGTH - 1)
-					{
-						_asyncRestoreRingBufferTail = 0;
-					}
-					else
-					{
-						++_asyncRestoreRingBufferTail;
-					}
-					
-					_asyncRestoreRingBuffer[_asyncRestoreRingBufferTail] = node;
-					*_bufferFlags |= OCTREE_NODES_IN_RESTORE_QUEUE;
+					++_asyncRestoreRingBufferTail;
 				}
+				
+				_asyncRestoreRingBuffer[_asyncRestoreRingBufferTail] = node;
+				*_bufferFlags |= OCTREE_NODES_IN_RESTORE_QUEUE;
 			}
 		}
+		
+		for (uint8_t mask = node->getChildrenInMemoryMask(); mask != 0; mask &= mask - 1)
+			finerLODVoxelCount += getChild(node, __builtin_ctz(mask))->quantPointCount;
 
 		// Check if we have greater detail in the next deeper level. If no, draw this level
 		// TODO: Disable this switch in non-movement mode to suppress artifacts
@@ -1357,6 +2285,8 @@ void Octree::copyPointsToBuffer(
 		#ifdef CHECK_VOXEL_COUNT
 		// Checks number of quant points stated in a node
 		uint32_t debugQuantPointCount = 0;
+		for (uint8_t i = 0; i < 8; ++i) debugQuantPointCount += __builtin_popcountll(getNodeState(node)->occupancy[i]);
+		assert(debugQuantPointCount == node->quantPointCount);
 		#endif
 
 		// Check if we have space left in buffer for new points
@@ -1433,33 +2363,7 @@ void Octree::copyPointsToBuffer(
 		#endif
 	
 		// copy points into buffer
-		QuantPointBlock* block = node->data;
-		
-		while (block != NULL)
-		{
-			if ((block->next != NULL) || ((node->quantPointCount % OCTREE_POINTS_PER_POINT_DATA_BLOCK) == 0))
-			{
-				memcpy(voxelBuffer, block, sizeof(QuantPoint) * OCTREE_POINTS_PER_POINT_DATA_BLOCK);
-	
-				voxelBuffer += OCTREE_POINTS_PER_POINT_DATA_BLOCK;
-				#ifdef CHECK_VOXEL_COUNT
-				debugQuantPointCount += OCTREE_POINTS_PER_POINT_DATA_BLOCK;
-				#endif
-			}
-			else
-			{
-				memcpy(voxelBuffer, block, sizeof(QuantPoint) * (node->quantPointCount % OCTREE_POINTS_PER_POINT_DATA_BLOCK));
-	
-				#ifdef CHECK_VOXEL_COUNT
-				debugQuantPointCount += (node->quantPointCount % OCTREE_POINTS_PER_POINT_DATA_BLOCK);
-				#endif
-			}
-			
-			block = block->next;
-		}
-		#ifdef CHECK_VOXEL_COUNT
-		assert(debugQuantPointCount == node->quantPointCount);
-		#endif
+		memcpy(voxelBuffer, getPointArray(node), sizeof(QuantPoint) * node->quantPointCount);
 	}
 	else
 	{
@@ -1471,14 +2375,13 @@ void Octree::copyPointsToBuffer(
 		
 		for (uint8_t i = 0; i < 8; ++i)
 		{
-			childNode = node->children[i];
 			active[i] = false;
 			
-			if ((node->children[i] != NULL) && (node->isChildInMemory(i)))
+			if ((node->getChildrenInMemoryMask() >> i) & 1)
 			{
 				active[i] = true;
 				
-				lockNode(node->children[i]);
+				lockNode(getChild(node, i));
 				
 				// Calc child node center
 				childCenter[i].x = nodeCenter->x;
@@ -1515,7 +2418,7 @@ void Octree::copyPointsToBuffer(
 			{
 				assert(minDistIndex < 8);
 				
-				childNode = node->children[minDistIndex];
+				childNode = getChild(node, minDistIndex);
 
 				copyPointsToBuffer(
 						childNode,
@@ -1535,25 +2438,28 @@ void Octree::copyPointsToBuffer(
 		Node* childNode;
 		FIXPVECTOR3 childCenter;
 		
-		for (uint8_t i = 0; i < 8; ++i)
+		// Children may be swapped by the recursion. Thus the mask is read per child.
+		uint8_t mask;
+		uint8_t remaining = 0xFF;
+		while ((mask = node->getChildrenInMemoryMask() & remaining) != 0)
 		{
+			const uint8_t i = __builtin_ctz(mask);
+			remaining = ~((2 << i) - 1);
 			// TODO: node locking required?!
 			
-			childNode = node->children[i];
-			if ((node->children[i] != NULL) && (node->isChildInMemory(i)))
-			{
-				// Calc child node center
-				childCenter.x = nodeCenter->x;
-				childCenter.y = nodeCenter->y;
-				childCenter.z = nodeCenter->z;
-				calcCenterOfChildNode(&childCenter, i, level+1);
-				
-				copyPointsToBuffer(
-						childNode,
-						&childCenter,
-						level+1,
-						nodeViewFrustumRelation);
-			}
+			childNode = getChild(node, i);
+			
+			// Calc child node center
+			childCenter.x = nodeCenter->x;
+			childCenter.y = nodeCenter->y;
+			childCenter.z = nodeCenter->z;
+			calcCenterOfChildNode(&childCenter, i, level+1);
+			
+			copyPointsToBuffer(
+					childNode,
+					&childCenter,
+					level+1,
+					nodeViewFrustumRelation);
 		}
 		#endif
 	}
@@ -1604,7 +2510,7 @@ void Octree::copyPointsToBuffer(
 
 	FIXPVECTOR3 rootCenter = {0, 0, 0};
 	
-	APIFactory::GetInstance().lock(OCTREE_LOCK);
+	acquireLock(OCTREE_LOCK);
 	
 #if 0 // render low res underneath
 	_renderQuality = 0.0005f;
@@ -1626,7 +2532,7 @@ void Octree::copyPointsToBuffer(
 		0,
 		MiniGL::ViewFrustum::INTERSECT);
 				
-	APIFactory::GetInstance().unlock(OCTREE_LOCK);
+	releaseLock(OCTREE_LOCK);
 
 	// Send last point batch to GPU
 	if ((*_bufferFlags & OCTREE_RENDERING_CANCELED) == false)
@@ -1723,7 +2629,7 @@ void Octree::printStatistics() const
 
 void Octree::restoreNodes(const uint32_t nodeCount)
 {
-	APIFactory::GetInstance().lock(OCTREE_LOCK);
+	acquireLock(OCTREE_LOCK);
 
 	uint32_t counter = 0;
 	while (	(_asyncRestoreRingBuffer[_asyncRestoreRingBufferTail] != NULL) &&
@@ -1733,7 +2639,8 @@ void Octree::restoreNodes(const uint32_t nodeCount)
 		Node* node = _asyncRestoreRingBuffer[_asyncRestoreRingBufferTail];
 		_asyncRestoreRingBuffer[_asyncRestoreRingBufferTail] = NULL;
 
-		restoreChildNodesFromBackingStore(node);
+		// Nodes might be evicted or moved since they were queued (see addChildNode)
+		if (_memoryPool->isElementUsed(0, node) && isNodeResident(node)) restoreChildNodesFromBackingStore(node);
 		
 		if (_asyncRestoreRingBufferTail == 0)
 		{
@@ -1747,7 +2654,239 @@ void Octree::restoreNodes(const uint32_t nodeCount)
 		++counter;
 	}
 
-	APIFactory::GetInstance().unlock(OCTREE_LOCK);
+	releaseLock(OCTREE_LOCK);
+}
+
+
+/**
+	Relocates the nodes in memory into depth-first order and moves their point arrays to the
+	lowest free elements of their bins. Thus nodes that are traversed together are close in memory
+	and chunks at the end of the bins are emptied (the memory pool releases them). It is called in
+	idle frames and continues where the last call stopped. The position is kept as the cell IDs
+	along the current path, because nodes can be evicted or restored in between.
+	@param maxNodeCount Number of nodes to visit per call
+ */
+void Octree::compactMemory(const uint32_t maxNodeCount)
+{
+	if (_isMemoryCompacted) return;
+	
+	acquireLock(OCTREE_LOCK);
+	
+	// Queued restores refer to their nodes by pointer
+	if (_asyncRestoreRingBuffer[_asyncRestoreRingBufferTail] != NULL)
+	{
+		releaseLock(OCTREE_LOCK);
+		return;
+	}
+	
+	// Descend along the path of the last call. A node that is gone is skipped with its subtree.
+	_compactionPath[0] = _rootNode;
+	uint8_t level = 0;
+	while (level < _compactionLevel)
+	{
+		const uint8_t cellID = _compactionChildID[level];
+		if ((!_compactionPath[level]->areChildrenInMemory()) || (!_compactionPath[level]->hasChild(cellID)))
+		{
+			++_compactionChildID[level];
+			break;
+		}
+		
+		_compactionPath[level + 1] = getChild(_compactionPath[level], cellID);
+		++level;
+	}
+	
+	if ((level == 0) && (_compactionChildID[0] == 0)) compactPointArray(_rootNode);
+	
+	uint32_t nodeCount = 0;
+	while (nodeCount < maxNodeCount)
+	{
+		// Next child in memory that is not visited, yet
+		const uint8_t mask =	_compactionPath[level]->getChildrenInMemoryMask() &
+								uint8_t(0xFF << _compactionChildID[level]);
+		if (mask == 0)
+		{
+			if (level == 0)
+			{
+				// Another pass follows if this one moved anything
+				_isMemoryCompacted = (_compactionRelocationCount == 0);
+				_compactionRelocationCount = 0;
+				_compactionChildID[0] = 0;
+				_compactionNodeID = 0;
+				break;
+			}
+			
+			--level;
+			++_compactionChildID[level];
+			continue;
+		}
+		
+		const uint8_t cellID = __builtin_ctz(mask);
+		_compactionChildID[level] = cellID;
+		
+		// Siblings are placed as one block when the first of them is visited
+		if (cellID == __builtin_ctz(_compactionPath[level]->childMask)) placeChildBlockInCompactionOrder(level);
+		
+		Node* const child = getChild(_compactionPath[level], cellID);
+		compactPointArray(child);
+		++nodeCount;
+		
+		++level;
+		_compactionPath[level] = child;
+		_compactionChildID[level] = 0;
+	}
+	
+	_compactionLevel = level;
+	
+	releaseLock(OCTREE_LOCK);
+}
+
+
+/**
+	Moves the children of the node _compactionPath[level] to the next slots of the depth-first order
+	(see compactMemory). Blocks in these slots are moved behind them before. Blocks with a locked
+	node (e.g. the insertion path) and the root node are never moved. The path is reread after
+	every relocation, because it might refer to a moved block.
+ */
+void Octree::placeChildBlockInCompactionOrder(const uint8_t level)
+{
+	const uint8_t count = _compactionPath[level]->getChildCount();
+	if (isChildBlockLocked(_compactionPath[level])) return;
+	
+	const uint32_t slotCount = _memoryPool->getMaximalNumberOfElementsInBin(0);
+	while (_compactionNodeID + count <= slotCount)
+	{
+		Node* const parentNode = _compactionPath[level];
+		Node* const block = getNode(parentNode->children);
+		Node* const target = &(_firstNode[_compactionNodeID]);
+		if (target == block)
+		{
+			_compactionNodeID += count;
+			return;
+		}
+		
+		if (_memoryPool->binAllocElementRunAt(0, target, count))
+		{
+			relocateChildBlock(parentNode, target);
+			_compactionNodeID += count;
+			return;
+		}
+		
+		Node* const occupant = (Node*)_memoryPool->findUsedElement(0, target);
+		assert((occupant != NULL) && (occupant < target + count));
+		
+		// The block itself is shifted down if the slots in front of it are free. Their chunk might
+		// not be committable.
+		if (occupant == block)
+		{
+			if (!_memoryPool->binAllocElementRunAt(0, target, block - target)) return;
+			relocateChildBlock(parentNode, target);
+			_compactionNodeID += count;
+			return;
+		}
+		
+		// Slots of the root, locked nodes and blocks that are not connected are skipped
+		Node* const occupantParent = ((occupant != _rootNode) && isNodeResident(occupant)) ?
+			getNode(getNodeState(occupant)->parent) : NULL;
+		if ((occupantParent == NULL) || isChildBlockLocked(occupantParent))
+		{
+			_compactionNodeID = (occupant - _firstNode) + 1;
+			continue;
+		}
+		
+		// Blocks in the way are moved behind the target slots
+		Node* const freeSlots = (Node*)_memoryPool->binAllocElementRunBehind(	0,
+																				target + count,
+																				occupantParent->getChildCount());
+		if (freeSlots == NULL) return;
+		
+		relocateChildBlock(occupantParent, freeSlots);
+	}
+}
+
+
+// Used slots of the node bin hold nodes or blocks that are not connected, yet (see
+// restoreChildNodesFromBackingStore). A node is resident if it is within the block of its parent
+// and all nodes on the path to the root are.
+bool Octree::isNodeResident(const Node* const node) const
+{
+	const Node* child = node;
+	for (uint8_t level = 0; level <= OCTREE_LEAF_LEVEL; ++level)
+	{
+		if (child == _rootNode) return true;
+		
+		const NodeIndex parentIndex = getNodeState(child)->parent;
+		if ((parentIndex == 0) ||
+			(parentIndex > _memoryPool->getMaximalNumberOfElementsInBin(0)) ||
+			(!_memoryPool->isElementUsed(0, getNode(parentIndex))))
+		{
+			return false;
+		}
+		
+		const Node* const parent = getNode(parentIndex);
+		if (parent->getChildrenInMemoryMask() == 0) return false;
+		
+		const Node* const block = getNode(parent->children);
+		if ((child < block) || (child >= block + parent->getChildCount())) return false;
+		
+		child = parent;
+	}
+	
+	return false;
+}
+
+
+/**
+	Moves the children of a node to allocated slots and frees the slots that are not covered by
+	the new block. The blocks may overlap. Nodes on the compaction path are redirected.
+ */
+void Octree::relocateChildBlock(Node* const parentNode, Node* const target)
+{
+	const uint8_t count = parentNode->getChildCount();
+	Node* const block = getNode(parentNode->children);
+	assert(block != target);
+	assert(!isChildBlockLocked(parentNode));
+	
+	// Overlapping nodes are moved before they are overwritten
+	if (target < block)
+	{
+		for (uint8_t i = 0; i < count; ++i) moveNodeToSlot(&(block[i]), &(target[i]));
+	}
+	else
+	{
+		for (uint8_t i = count; i > 0; --i) moveNodeToSlot(&(block[i - 1]), &(target[i - 1]));
+	}
+	
+	// Bypass the allocator caches. Thus the slots can be taken by the next relocation.
+	Node* const firstFreedNode = (target < block) ? std::max(block, target + count) : block;
+	Node* const lastFreedNode = (target < block) ? block + count : std::min(target, block + count);
+	if (firstFreedNode < lastFreedNode) _memoryPool->binFreeElementRun(0, firstFreedNode, lastFreedNode - firstFreedNode);
+	
+	parentNode->children = getNodeIndex(target);
+	
+	for (uint8_t i = 0; i <= OCTREE_LEAF_LEVEL; ++i)
+	{
+		if ((_compactionPath[i] >= block) && (_compactionPath[i] < block + count))
+			_compactionPath[i] = target + (_compactionPath[i] - block);
+	}
+	
+	++_compactionRelocationCount;
+}
+
+
+// Moves the point array of a node to the lowest free element of its bin
+void Octree::compactPointArray(Node* const node)
+{
+	if ((node->pointArray == 0) || isNodeLocked(node)) return;
+	
+	const size_t binID = calcPointArrayBinID(node->quantPointCount);
+	QuantPoint* const pointArray = getPointArray(node);
+	QuantPoint* const data = (QuantPoint*)_memoryPool->binRelocateElement(binID, pointArray);
+	if (data == NULL) return;
+	
+	memcpy(data, pointArray, sizeof(QuantPoint) * calcPointArrayCapacity(node->quantPointCount));
+	_memoryPool->binFreeElement(binID, pointArray);
+	node->pointArray = getPointArrayIndex(data, node->quantPointCount);
+	++_compactionRelocationCount;
 }
 
 
@@ -50,20 +50,27 @@ StaticBackingStore::~StaticBackingStore()
 }
 
 
-bool StaticBackingStore::open(const char* const filename, Octree::Node* const node)
+bool StaticBackingStore::open(	const char* const filename,
+								Octree::Node* const node,
+								Octree::WorldTransform* const outTransform,
+								uint8_t* const outLeafLevel)
 {
 	_file = fopen(filename, "rb");
 	
+	readFooter(_file, outTransform, outLeafLevel);
+	
 	// Read root node
+	long childrenFilePosition[8];
 	node->reset();
-	fread(node->children, sizeof(Octree::Node*), 8, _file);
-	for (uint8_t i=0; i<8; ++i) if (node->children[i] != NULL) node->unsetChildInMemory(i);
+	fseek(_file, 0, SEEK_SET);
+	fread(childrenFilePosition, sizeof(Octree::Node*), 8, _file);
+	storeChildFilePositions(childrenFilePosition, node);
 
 	return true; // TODO: File exception handling
 }
 
 
-bool StaticBackingStore::readNode(const long position, Octree::Node* const outNode) const
+bool StaticBackingStore::readNode(const long position, Octree::Node* const outNode)
 {
 	// Save file position of the node
 	size_t index = (outNode - _firstNodePointer);
@@ -80,11 +87,12 @@ bool StaticBackingStore::readNode(const long position, Octree::Node* const outNo
 }
 
 	
-bool StaticBackingStore::writeNode(const Octree::Node* const node, long* const outPosition) const
+bool StaticBackingStore::writeNode(	const Octree::Node* const node,
+									const QuantPoint* const /* quantPoints */,
+									long* const outPosition) const
 {
 	// Make sure the node has no children that are in memory
-	for (uint8_t i = 0; i < 8; ++i) 
-		assert(!((node->children[i] != NULL) && (node->isChildInMemory(i))));
+	assert(node->getChildrenInMemoryMask() == 0);
 		
 	// Restore file position of the node
 	size_t index = (node - _firstNodePointer);
@@ -103,4 +111,31 @@ bool StaticBackingStore::writeNode(const Octree::Node* const node, long* const o
 }
 
 
+// The file position of a node is kept in the slot of the node
+void StaticBackingStore::moveNode(const Octree::Node* const node, const Octree::Node* const target)
+{
+	const size_t index = (node - _firstNodePointer);
+	const size_t targetIndex = (target - _firstNodePointer);
+	assert(index < _maxNodesInMemory);
+	assert(targetIndex < _maxNodesInMemory);
+	assert(_nodeFilePosition[index] != 0);
+	assert(_nodeFilePosition[targetIndex] == 0);
+	
+	_nodeFilePosition[targetIndex] = _nodeFilePosition[index];
+#if DEBUG
+	_nodeFilePosition[index] = 0;
+#endif
+}
+
+
+// The slot can be read into again (see readNode)
+void StaticBackingStore::releaseNode(const Octree::Node* const node)
+{
+	const size_t index = (node - _firstNodePointer);
+	assert(index < _maxNodesInMemory);
+	
+	_nodeFilePosition[index] = 0;
+}
+
+
 }
\ No newline at end of file
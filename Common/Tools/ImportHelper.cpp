@@ -9,6 +9,28 @@
 
 #include "ImportHelper.h"
 #include "Octree.h"
+#include "ParallelOctreeBuilder.h"
+#include "StaticOctreeBuilder.h"
+#include "PLYReader.h"
+#include "XYZReader.h"
+#include "RicoReader.h"
+#include "APIFactory.h"
+#include <unistd.h>
+#include <limits.h>
+#include <float.h>
+#include <ctype.h>
+#include <algorithm>
+#include "DebugConfig.h"
+
+#if USE_SIMD_VOLUME_SCAN
+	#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define SSE_VOLUME_SCAN 1
+	#elif defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define NEON_VOLUME_SCAN 1
+	#endif
+#endif
 
 
 namespace WVSClientCommon
@@ -19,280 +41,649 @@ namespace ImportHelper
 {
 
 
-void ImportCTFormat(Octree* octree, const char* const filename)
+// Occupancy slices are padded by one empty voxel on every side plus slack for the last vector of a slice
+static const uint32_t VOLUME_SLICE_SLACK = 16;
+static const uint32_t VOLUME_BATCH_POINT_COUNT = 4096*2;
+
+
+// Sets every occupancy byte to 0xFF if the voxel value is at least threshold, otherwise to 0x00
+static void CalcVoxelOccupancy(const uint8_t* const voxels, const uint32_t count, const uint8_t threshold, uint8_t* const outOccupancy)
 {
-	printf("Reading  %s...\n", filename);
+	uint32_t i = 0;
+	
+#if SSE_VOLUME_SCAN
+	// value >= threshold <=> max(value, threshold) == value
+	const __m128i thresholdVector = _mm_set1_epi8(char(threshold));
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i values = _mm_loadu_si128((const __m128i*)&(voxels[i]));
+		_mm_storeu_si128((__m128i*)&(outOccupancy[i]), _mm_cmpeq_epi8(_mm_max_epu8(values, thresholdVector), values));
+	}
+#elif NEON_VOLUME_SCAN
+	const uint8x16_t thresholdVector = vdupq_n_u8(threshold);
+	for (; i + 16 <= count; i += 16)
+	{
+		vst1q_u8(&(outOccupancy[i]), vcgeq_u8(vld1q_u8(&(voxels[i])), thresholdVector));
+	}
+#endif
+	
+	for (; i < count; ++i)
+	{
+		outOccupancy[i] = (voxels[i] >= threshold) ? 0xFF : 0x00;
+	}
+}
+
 
-FILE *out = fopen("/abc.txt", "w");
-	FILE *file = fopen(filename, "rb");
-	WVSPoint p;
+#if NEON_VOLUME_SCAN
+// NEON has no movemask. The lanes are weighted by their bit and summed up pairwise.
+static inline uint32_t MoveMask(const uint8x16_t mask)
+{
+	static const uint8_t laneBits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	const uint8x16_t bits = vandq_u8(mask, vld1q_u8(laneBits));
 	
-	p.radius = 1;
+	uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+	sum = vpadd_u8(sum, sum);
+	sum = vpadd_u8(sum, sum);
+	return uint32_t(vget_lane_u8(sum, 0)) | (uint32_t(vget_lane_u8(sum, 1)) << 8);
+}
+#endif
+
+
+/**
+	Returns a bit mask of the 16 voxels that start at voxel of a padded occupancy slice.
+	A bit is set if the voxel is occupied and (with isSurfaceOnly) at least one of its 6
+	neighbors is empty. Interior voxels can never be seen and are skipped.
+ */
+static inline uint32_t CalcEmittedVoxelMask(const uint8_t* const voxel,
+											const uint8_t* const previousSliceVoxel,
+											const uint8_t* const nextSliceVoxel,
+											const uint32_t rowLength,
+											const bool isSurfaceOnly)
+{
+#if SSE_VOLUME_SCAN
+	const __m128i occupied = _mm_loadu_si128((const __m128i*)voxel);
+	if (!isSurfaceOnly) return uint32_t(_mm_movemask_epi8(occupied));
 	
-	uint8_t byte[65536];
-	fread(&byte, sizeof(uint8_t), 65536, file);
-	int i = 0;
+	__m128i interior = _mm_and_si128(_mm_loadu_si128((const __m128i*)(voxel - 1)), _mm_loadu_si128((const __m128i*)(voxel + 1)));
+	interior = _mm_and_si128(interior, _mm_loadu_si128((const __m128i*)(voxel - rowLength)));
+	interior = _mm_and_si128(interior, _mm_loadu_si128((const __m128i*)(voxel + rowLength)));
+	interior = _mm_and_si128(interior, _mm_loadu_si128((const __m128i*)previousSliceVoxel));
+	interior = _mm_and_si128(interior, _mm_loadu_si128((const __m128i*)nextSliceVoxel));
 	
-	for (int x = 0; x < 172; ++x)
+	return uint32_t(_mm_movemask_epi8(_mm_andnot_si128(interior, occupied)));
+#elif NEON_VOLUME_SCAN
+	const uint8x16_t occupied = vld1q_u8(voxel);
+	if (!isSurfaceOnly) return MoveMask(occupied);
+	
+	uint8x16_t interior = vandq_u8(vld1q_u8(voxel - 1), vld1q_u8(voxel + 1));
+	interior = vandq_u8(interior, vld1q_u8(voxel - rowLength));
+	interior = vandq_u8(interior, vld1q_u8(voxel + rowLength));
+	interior = vandq_u8(interior, vld1q_u8(previousSliceVoxel));
+	interior = vandq_u8(interior, vld1q_u8(nextSliceVoxel));
+	
+	return MoveMask(vbicq_u8(occupied, interior));
+#else
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < 16; ++i)
 	{
-		for (int y = 0; y < 512; ++y)
+		if (!voxel[i]) continue;
+		
+		const bool isInterior = voxel[i - 1] && voxel[i + 1] && voxel[i - rowLength] && voxel[i + rowLength] &&
+			previousSliceVoxel[i] && nextSliceVoxel[i];
+		if (!isSurfaceOnly || !isInterior) mask |= (1 << i);
+	}
+	return mask;
+#endif
+}
+
+
+/**
+	Streams an 8 bit volume slice by slice. Only three slices are held in memory (the neighbors
+	of the current slice are needed to find the boundary voxels).
+	
+	Every voxel with a value of at least threshold is added as point (voxel index * spacing).
+	Brighter voxels get brighter colors.
+ */
+template <class PointConsumer>
+static void ImportVolumePoints(	PointConsumer* const octree,
+								const char* const filename,
+								const uint32_t width,
+								const uint32_t height,
+								const uint32_t depth,
+								const VECTOR3& spacing,
+								const uint8_t threshold,
+								const bool isSurfaceOnly)
+{
+	printf("Reading  %s...\n", filename);
+	
+	FILE* const file = fopen(filename, "rb");
+	if (file == NULL)
+	{
+		logError("Reading volume failed. Reason: Cannot open %s.\n", filename);
+		return;
+	}
+	
+	const uint32_t sliceVoxelCount = width * height;
+	const uint32_t rowLength = width + 2;
+	const uint32_t paddedSliceSize = rowLength * (height + 2) + VOLUME_SLICE_SLACK;
+	
+	// Raw voxels and occupancy of the previous, current and next slice (plus an empty slice)
+	uint8_t* const voxelBuffer = new uint8_t[3 * sliceVoxelCount];
+	uint8_t* const occupancyBuffer = new uint8_t[4 * paddedSliceSize];
+	memset(occupancyBuffer, 0, 4 * paddedSliceSize);
+	
+	uint8_t* voxels[3] = {voxelBuffer, voxelBuffer + sliceVoxelCount, voxelBuffer + 2 * sliceVoxelCount};
+	uint8_t* occupancy[3] = {occupancyBuffer, occupancyBuffer + paddedSliceSize, occupancyBuffer + 2 * paddedSliceSize};
+	const uint8_t* const emptySlice = occupancyBuffer + 3 * paddedSliceSize;
+	
+	WVSPoint* const batch = new WVSPoint[VOLUME_BATCH_POINT_COUNT];
+	uint32_t batchCount = 0;
+	uint64_t pointCount = 0;
+	uint64_t occupiedVoxelCount = 0;
+	long lastprogess = 0;
+	
+	const float_t colorScale = (threshold < 255) ? 191.0f / float_t(255 - threshold) : 0.0f;
+	uint32_t readSliceCount = 0;
+	
+	for (uint32_t z = 0; z < depth; ++z)
+	{
+		// Read ahead until the next slice is available
+		while ((readSliceCount < depth) && (readSliceCount <= z + 1))
+		{
+			uint8_t* const sliceVoxels = voxels[readSliceCount % 3];
+			uint8_t* const sliceOccupancy = occupancy[readSliceCount % 3];
+			
+			const size_t voxelCount = fread(sliceVoxels, sizeof(uint8_t), sliceVoxelCount, file);
+			if (voxelCount < sliceVoxelCount)
+			{
+				logError("Volume %s is truncated in slice %u.\n", filename, readSliceCount);
+				memset(sliceVoxels + voxelCount, 0, sliceVoxelCount - voxelCount);
+			}
+			
+			for (uint32_t y = 0; y < height; ++y)
+			{
+				CalcVoxelOccupancy(&(sliceVoxels[y * width]), width, threshold, &(sliceOccupancy[(y + 1) * rowLength + 1]));
+			}
+			++readSliceCount;
+		}
+		
+		const uint8_t* const sliceVoxels = voxels[z % 3];
+		const uint8_t* const slice = occupancy[z % 3];
+		const uint8_t* const previousSlice = (z > 0) ? occupancy[(z - 1) % 3] : emptySlice;
+		const uint8_t* const nextSlice = (z + 1 < depth) ? occupancy[(z + 1) % 3] : emptySlice;
+		
+		for (uint32_t y = 0; y < height; ++y)
 		{
-			for (int z = 0; z < 256; ++z)
+			const uint32_t rowOffset = (y + 1) * rowLength + 1;
+			
+			for (uint32_t x = 0; x < width; x += 16)
 			{
-				if (byte[i] == 1)
+				uint32_t mask = CalcEmittedVoxelMask(	&(slice[rowOffset + x]),
+														&(previousSlice[rowOffset + x]),
+														&(nextSlice[rowOffset + x]),
+														rowLength,
+														isSurfaceOnly);
+				
+				// The last vector of a row reaches into the padding and the next row
+				if (width - x < 16) mask &= (1 << (width - x)) - 1;
+				
+				while (mask != 0)
 				{
-					p.position.x = z * 5;
-					p.position.y = y * 5;
-					p.position.z = x * 5;
+					const uint32_t i = x + __builtin_ctz(mask);
+					mask &= mask - 1;
 					
-					uint8_t gray;
-					switch (y % 4) {
-						case 0: gray = 0; break;
-						case 1: gray = 30; break;
-						case 2: gray = 60; break;
-						case 3: gray = 30; break;
-						//case 4: gray = 0 break;
-
-					}
-					//uint8_t gray = (y % 2 == 0 ? 255 : 200);//((sin(float(y)*512.0*0.05))*(1/10.0)+0.45) * 255.0f;
-					p.color.red = gray;
-					p.color.green = gray;
-					p.color.blue = gray;
+					WVSPoint* const point = &(batch[batchCount++]);
+					point->position.x = float_t(i) * spacing.x;
+					point->position.y = float_t(y) * spacing.y;
+					point->position.z = float_t(z) * spacing.z;
+					point->radius = 1.0f;
+					point->normalIndex = 0;
 					
-					 
-					 
-					octree->addPoint(&p);
+					const uint8_t gray = uint8_t(64.0f + float_t(sliceVoxels[y * width + i] - threshold) * colorScale);
+					point->color.red = gray;
+					point->color.green = gray;
+					point->color.blue = gray;
 					
-					fprintf(out,"%i %i %i\n", z, y, x);
-					//printf("%i %i %i\n", z, y, x);
-				}
-				
-				i++;
-				
-				if (i == 65536)
-				{
-					fread(&byte, sizeof(uint8_t), 65536, file);
-					i = 0;
+					if (batchCount == VOLUME_BATCH_POINT_COUNT)
+					{
+						octree->addPoints(batch, batchCount);
+						pointCount += batchCount;
+						batchCount = 0;
+					}
 				}
 			}
+			
+			if (isSurfaceOnly)
+			{
+				for (uint32_t x = 0; x < width; ++x) occupiedVoxelCount += (slice[rowOffset + x] != 0);
+			}
 		}
 		
-		//printf("%i/255\n", x);
+		long progress = long(100.0f * float(z + 1) / float(depth));
+		if ((progress > lastprogess) && (progress % 2 == 0))
+		{
+			lastprogess = progress;
+			printf("%li %%\n", progress);
+		}
 	}
-fclose (out);
+	
+	octree->addPoints(batch, batchCount);
+	pointCount += batchCount;
+	
+	delete[] batch;
+	delete[] occupancyBuffer;
+	delete[] voxelBuffer;
 	fclose(file);
 	
-	printf("fertig!");
+	if (isSurfaceOnly)
+	{
+		printf("%llu of %llu occupied voxels are on the surface.\n", (unsigned long long)pointCount, (unsigned long long)occupiedVoxelCount);
+	}
+	printf("%llu points loaded.\n", (unsigned long long)pointCount);
 }
 
 
-void ImportRicoFormat(Octree* octree, const char* const filename)
+void ImportVolume(Octree* octree, const char* const filename, const uint32_t width, const uint32_t height, const uint32_t depth, const VECTOR3& spacing, const uint8_t threshold, const bool isSurfaceOnly)
 {
-	printf("Reading  %s...\n", filename);
+	ImportVolumePoints(octree, filename, width, height, depth, spacing, threshold, isSurfaceOnly);
+	octree->printStatistics();
+}
+
+
+void ImportVolume(ParallelOctreeBuilder* builder, const char* const filename, const uint32_t width, const uint32_t height, const uint32_t depth, const VECTOR3& spacing, const uint8_t threshold, const bool isSurfaceOnly)
+{
+	ImportVolumePoints(builder, filename, width, height, depth, spacing, threshold, isSurfaceOnly);
+}
+
+
+void ImportVolume(StaticOctreeBuilder* builder, const char* const filename, const uint32_t width, const uint32_t height, const uint32_t depth, const VECTOR3& spacing, const uint8_t threshold, const bool isSurfaceOnly)
+{
+	ImportVolumePoints(builder, filename, width, height, depth, spacing, threshold, isSurfaceOnly);
+}
+
+
+void ImportCTFormat(Octree* octree, const char* const filename)
+{
+	// Binary segmentation of the CT model (CTModell-Binary-8bit-256x512x171.raw)
+	const VECTOR3 spacing = {5.0f, 5.0f, 5.0f};
+	ImportVolume(octree, filename, 256, 512, 171, spacing, 1, false);
+}
+
+
+// The Berlin tiles are stored in their own coordinate system
+static const float_t RICO_SCALE = 4.0f;
+static const VECTOR3 RICO_TRANSLATION = {-88510.73f, -279.36f, -80576.14f};
+
+
+static uint32_t GetReaderWorkerCount()
+{
+	const long coreCount = sysconf(_SC_NPROCESSORS_ONLN);
+	return (coreCount > 0) ? uint32_t(coreCount) : 1;
+}
 
-	FILE *file = fopen(filename, "rb");
+
+// Accumulated over all files of an import
+struct ImportStatistics
+{
+	uint64_t	pointCount;
+	uint64_t	byteCount;
+	VECTOR3		min;
+	VECTOR3		max;
+};
+
+
+static void InitImportStatistics(ImportStatistics* const statistics)
+{
+	statistics->pointCount = 0;
+	statistics->byteCount = 0;
+	statistics->min.x = statistics->min.y = statistics->min.z = FLT_MAX;
+	statistics->max.x = statistics->max.y = statistics->max.z = -FLT_MAX;
+}
+
+
+static void PrintImportStatistics(const ImportStatistics* const statistics, const double elapsedMS)
+{
+	const double seconds = std::max(elapsedMS / 1000.0, 0.001);
+	const double megaBytes = double(statistics->byteCount) / (1024.0 * 1024.0);
 	
-	// obtain file size:
-	fseek(file , 0 , SEEK_END);
-	long filesize = ftell(file);
-	rewind(file);
-  
-	long pos = 0;
-	long lastprogess = 0;
-	long pointCount = 0;
-	
-	VECTOR3 min;
-	VECTOR3 max;
-	bool init = true;
-
-	static const int pointchunk = 4096*2;
-	uint8_t byte[16 * pointchunk];
-	int byteIndex = 0;
-	// Read 1024 points
-	fread(&byte, sizeof(uint8_t), 16 * pointchunk, file);
-		 
-	int i = 0;
-	while (pos < filesize)
-	{
-		++i;
-		
-		WVSPoint p;
+	printf("%llu points loaded (%.1f MB in %.1f s, %.0f points/s, %.1f MB/s).\n\nBounding Box:\n",
+		(unsigned long long)statistics->pointCount, megaBytes, seconds,
+		double(statistics->pointCount) / seconds, megaBytes / seconds);
+	PRINT_VECTOR3(statistics->min);
+	PRINT_VECTOR3(statistics->max);
+}
 
-		memcpy(&p.position, &(byte[byteIndex]), sizeof(VECTOR3));
-		byteIndex += sizeof(VECTOR3);
-		//fread(&p.position, sizeof(VECTOR3), 1, file);
 
-		memcpy(&p.color, &(byte[byteIndex]), sizeof(RGBColor));
-		byteIndex += sizeof(RGBColor) + 1;
-		//fread(&p.color, sizeof(RGBColor), 1, file);
-		//fseek(file, 1, SEEK_CUR);
-		
-		if (byteIndex >= 16 * pointchunk)
-		{
-			fread(&byte, sizeof(uint8_t), 16 * pointchunk, file);
-			pos = ftell(file);
-			byteIndex = 0;
-		}
-		
-		p.radius = 0.001f;
-		p.position.x *= 4;
-		p.position.y *= 4;
-		p.position.z *= 4;
-		
-		p.position.x -= 88510.73;
-		p.position.y -= 279.36;
-		p.position.z -= 80576.14;
-		
-		if (init)
+// PointConsumer is an Octree, a ParallelOctreeBuilder or a StaticOctreeBuilder (all provide addPoints)
+template <class PointConsumer>
+static void ReadMappedPoints(PointConsumer* const octree, MappedPointReader* const reader, ImportStatistics* const statistics)
+{
+	long lastprogess = 0;
+	
+	// The points are decoded on all cores and inserted on this thread (see MappedPointReader)
+	const WVSPoint* points;
+	uint32_t count;
+	while (reader->readPoints(&points, &count))
+	{
+		for (uint32_t i = 0; i < count; ++i)
 		{
-			init = false;
-			min = p.position;
-			max = p.position;
+			const VECTOR3& position = points[i].position;
+			
+			if (statistics->min.x > position.x) statistics->min.x = position.x; 
+			if (statistics->min.y > position.y) statistics->min.y = position.y; 
+			if (statistics->min.z > position.z) statistics->min.z = position.z; 
+			
+			if (statistics->max.x < position.x) statistics->max.x = position.x; 
+			if (statistics->max.y < position.y) statistics->max.y = position.y; 
+			if (statistics->max.z < position.z) statistics->max.z = position.z; 
 		}
 		
-		if (min.x > p.position.x) min.x = p.position.x; 
-		if (min.y > p.position.y) min.y = p.position.y; 
-		if (min.z > p.position.z) min.z = p.position.z; 
-		
-		if (max.x < p.position.x) max.x = p.position.x; 
-		if (max.y < p.position.y) max.y = p.position.y; 
-		if (max.z < p.position.z) max.z = p.position.z; 
-		
-		//PRINT_VECTOR3(p.position);
-		
-		octree->addPoint(&p);
-		pointCount++;
+		octree->addPoints(points, count);
+		statistics->pointCount += count;
 		
-		long progress = long(100.0f * float(pos) / float(filesize));
+		long progress = long(100.0f * reader->getProgress());
 		if ((progress > lastprogess) && (progress % 2 == 0))
 		{
 			lastprogess = progress;
-			printf("%.0f %%\n", 100.0f * float(pos) / float(filesize));
+			printf("%li %%\n", progress);
 		}
 	}
+	
+	statistics->byteCount += reader->getFileSize();
+}
 
-	fclose(file);
+
+template <class PointConsumer>
+static void ImportMappedPoints(PointConsumer* const octree, MappedPointReader* const reader, const char* const filename, const float_t scale, const VECTOR3& translation)
+{
+	printf("Reading  %s...\n", filename);
 	
-	printf("%li points loaded.\n\nBounding Box:\n", pointCount);
-	PRINT_VECTOR3(min);
-	PRINT_VECTOR3(max);
+	const double startTime = APIFactory::GetInstance().getTimeInMS();
+	if (!reader->open(filename)) return;
 	
-	octree->printStatistics();
+	reader->setTransformation(scale, &translation);
+	
+	ImportStatistics statistics;
+	InitImportStatistics(&statistics);
+	ReadMappedPoints(octree, reader, &statistics);
+	
+	PrintImportStatistics(&statistics, APIFactory::GetInstance().getTimeInMS() - startTime);
 }
 
 
-void ImportPLYFormat(Octree* octree, const char* const filename, const int startbyte, const int vertices)
+// Consumes the points of a bounds prepass (see FitMappedPoints)
+struct NullPointConsumer
+{
+	void addPoints(const WVSPoint* const points, const size_t count) {}
+};
+
+
+static bool FitImportStatistics(const ImportStatistics* const statistics, Octree::WorldTransform* const outTransform)
 {
-printf(filename);
-	FILE *file = fopen(filename, "rb");
+	if (statistics->pointCount == 0)
+	{
+		logError("Fitting world transform failed. Reason: No points.\n");
+		return false;
+	}
 	
-	// obtain file size:
-	fseek(file , 0 , SEEK_END);
-	long filesize = ftell(file);
-	rewind(file);
-  
-	long pos = 0;
-	long lastprogess = 0;
-	long pointCount = 0;
+	Octree::calcWorldTransform(&(statistics->min), &(statistics->max), outTransform);
+	printf("World transform: scale %f, translation (%f, %f, %f)\n", outTransform->scale,
+		outTransform->translation.x, outTransform->translation.y, outTransform->translation.z);
+	
+	return true;
+}
+
+
+// Reads the file once to calculate the transform that fits its bounding box into the octree
+static bool FitMappedPoints(MappedPointReader* const reader, const char* const filename, Octree::WorldTransform* const outTransform)
+{
+	const VECTOR3 noTranslation = {0.0f, 0.0f, 0.0f};
+	NullPointConsumer consumer;
+	ImportStatistics statistics;
+	InitImportStatistics(&statistics);
 	
-	VECTOR3 min;
-	VECTOR3 max;
-	bool init = true;
+	printf("Calculating bounding box of %s...\n", filename);
+	if (!reader->open(filename)) return false;
+	
+	reader->setTransformation(1.0f, &noTranslation);
+	ReadMappedPoints(&consumer, reader, &statistics);
+	reader->close();
+	
+	return FitImportStatistics(&statistics, outTransform);
+}
+
 
-	uint8_t byte;
-	for (int i = 0; i < startbyte; ++i)
+/**
+	Imports all tiles of a manifest file. The manifest lists one tile per line. Relative paths
+	are relative to the directory of the manifest. Empty lines and lines starting with # are ignored.
+	
+	Every tile is decoded on all cores. Meanwhile the next tile is already mapped and read
+	asynchronously (see MappedPointReader::prefetch). Thus the import is bound by the disk
+	as long as the consumer keeps up.
+ */
+template <class PointConsumer>
+static void ImportRicoTileManifest(	PointConsumer* const octree,
+									const char* const manifestFilename,
+									const float_t scale,
+									const VECTOR3& translation,
+									ImportStatistics* const statistics)
+{
+	FILE* const manifest = fopen(manifestFilename, "r");
+	if (manifest == NULL)
 	{
-		fread(&byte, sizeof(uint8_t), 1, file);
-		printf("%c", byte);
+		logError("Reading tile manifest failed. Reason: Cannot open %s.\n", manifestFilename);
+		return;
 	}
 	
-	VECTOR3 normal;
-	MATRIX m;
-	MatrixRotationX(m, M_PI_2);
+	// Directory of the manifest including the trailing slash
+	const char* const lastSlash = strrchr(manifestFilename, '/');
+	const size_t directoryLength = (lastSlash == NULL) ? 0 : size_t(lastSlash - manifestFilename + 1);
+	
+	char line[PATH_MAX];
+	uint32_t tileCount = 0;
+	while (fgets(line, PATH_MAX, manifest) != NULL) ++tileCount;
+	rewind(manifest);
+	
+	char (*tilenames)[PATH_MAX] = new char[std::max(tileCount, uint32_t(1))][PATH_MAX];
+	tileCount = 0;
+	while (fgets(line, PATH_MAX, manifest) != NULL)
+	{
+		char* begin = line;
+		while (isspace(*begin)) ++begin;
 		
-	int i = 0;
-	while (i < vertices)//((pos < filesize) && (lastprogess < 1))
+		size_t length = strlen(begin);
+		while ((length > 0) && isspace(begin[length - 1])) begin[--length] = '\0';
+		if ((length == 0) || (begin[0] == '#')) continue;
+		
+		if ((begin[0] == '/') || (directoryLength + length >= PATH_MAX)) strncpy(tilenames[tileCount], begin, PATH_MAX - 1);
+		else snprintf(tilenames[tileCount], PATH_MAX, "%.*s%s", int(directoryLength), manifestFilename, begin);
+		tilenames[tileCount][PATH_MAX - 1] = '\0';
+		++tileCount;
+	}
+	fclose(manifest);
+	
+	printf("Importing %u tiles of %s...\n", tileCount, manifestFilename);
+	
+	const double startTime = APIFactory::GetInstance().getTimeInMS();
+	InitImportStatistics(statistics);
+	
+	// Two readers take turns: one is decoded while the next tile is read ahead
+	const uint32_t workerCount = GetReaderWorkerCount();
+	RicoReader firstReader(workerCount);
+	RicoReader secondReader(workerCount);
+	RicoReader* const readers[2] = {&firstReader, &secondReader};
+	
+	bool isOpen = (tileCount > 0) && readers[0]->open(tilenames[0]);
+	if (isOpen) readers[0]->prefetch();
+	
+	for (uint32_t i = 0; i < tileCount; ++i)
 	{
-		++i;
+		RicoReader* const reader = readers[i % 2];
+		RicoReader* const nextReader = readers[(i + 1) % 2];
 		
-		WVSPoint p;
-		p.radius = 0.001f;
-
-		fread(&p.position, sizeof(VECTOR3), 1, file);
-		fread(&normal, sizeof(VECTOR3), 1, file);
+		printf("Reading tile %u/%u %s...\n", i + 1, tileCount, tilenames[i]);
 		
-//		uint8_t sevenBitNormal = 0;
-//		float_t dot = 0;
-//		float_t bestDot = 0;
-//		for (uint8_t j=0; j < 128; ++j)
-//		{
-//			dot =	normal.x * sevenBitNormalMap[3*j+0] + 
-//					normal.y * sevenBitNormalMap[3*j+1] +
-//					normal.z * sevenBitNormalMap[3*j+2];
-//			
-//			if (dot > bestDot)
-//			{
-//				bestDot = dot;
-//				sevenBitNormal = j;
-//			}
-//		}
-//		assert(sevenBitNormal < 128);
-//		p.normalIndex = sevenBitNormal;
-	
-		fread(&p.color, sizeof(RGBColor), 1, file);
-		fseek(file, 1, SEEK_CUR);
+		const bool isNextOpen = (i + 1 < tileCount) && nextReader->open(tilenames[i + 1]);
+		if (isNextOpen) nextReader->prefetch();
 		
-		if (startbyte == 341)
+		if (isOpen)
 		{
-			p.position.x *= 25;
-			p.position.y *= 25;
-			p.position.z *= 25;
+			const double tileStartTime = APIFactory::GetInstance().getTimeInMS();
+			const uint64_t previousPointCount = statistics->pointCount;
 			
-			p.position.z += 2500;
-		}
-		else {
-			p.position.x *= 5;
-			p.position.y *= 5;
-			p.position.z *= 5;
-		}
-
-		
-		if (init) {
-			init = false;
-			min = p.position;
-			max = p.position;
+			reader->setTransformation(scale, &translation);
+			ReadMappedPoints(octree, reader, statistics);
+			
+			const double tileSeconds = std::max((APIFactory::GetInstance().getTimeInMS() - tileStartTime) / 1000.0, 0.001);
+			printf("%llu points (%.1f MB/s)\n", (unsigned long long)(statistics->pointCount - previousPointCount),
+				double(reader->getFileSize()) / (1024.0 * 1024.0) / tileSeconds);
+			
+			reader->close();
 		}
 		
-		if (min.x > p.position.x) min.x = p.position.x; 
-		if (min.y > p.position.y) min.y = p.position.y; 
-		if (min.z > p.position.z) min.z = p.position.z; 
-		
-		if (max.x < p.position.x) max.x = p.position.x; 
-		if (max.y < p.position.y) max.y = p.position.y; 
-		if (max.z < p.position.z) max.z = p.position.z; 
-		
-		octree->addPoint(&p);
-		pointCount++;
-		
-		pos = ftell(file);
-		
-		long progress = long(100.0f * float(pos) / float(filesize));
-		if ((progress > lastprogess) && (progress % 2 == 0))
-		{
-			lastprogess = progress;
-			printf("%.0f %%\n", 100.0f * float(pos) / float(filesize));
-		}
+		isOpen = isNextOpen;
 	}
-
-	fclose(file);
 	
-	printf("%li points loaded.\n\nBounding Box:\n", pointCount);
-	PRINT_VECTOR3(min);
-	PRINT_VECTOR3(max);
+	delete[] tilenames;
+	
+	PrintImportStatistics(statistics, APIFactory::GetInstance().getTimeInMS() - startTime);
+}
+
+
+void ImportRicoFormat(Octree* octree, const char* const filename)
+{
+	RicoReader reader(GetReaderWorkerCount());
+	ImportMappedPoints(octree, &reader, filename, RICO_SCALE, RICO_TRANSLATION);
+	octree->printStatistics();
+}
+
+
+void ImportRicoFormat(ParallelOctreeBuilder* builder, const char* const filename)
+{
+	RicoReader reader(GetReaderWorkerCount());
+	ImportMappedPoints(builder, &reader, filename, RICO_SCALE, RICO_TRANSLATION);
+}
+
+
+void ImportRicoFormat(StaticOctreeBuilder* builder, const char* const filename)
+{
+	RicoReader reader(GetReaderWorkerCount());
+	ImportMappedPoints(builder, &reader, filename, RICO_SCALE, RICO_TRANSLATION);
+}
+
+
+void ImportRicoTiles(Octree* octree, const char* const manifestFilename)
+{
+	ImportStatistics statistics;
+	ImportRicoTileManifest(octree, manifestFilename, RICO_SCALE, RICO_TRANSLATION, &statistics);
+	octree->printStatistics();
+}
+
+
+void ImportRicoTiles(ParallelOctreeBuilder* builder, const char* const manifestFilename)
+{
+	ImportStatistics statistics;
+	ImportRicoTileManifest(builder, manifestFilename, RICO_SCALE, RICO_TRANSLATION, &statistics);
+}
+
+
+void ImportRicoTiles(StaticOctreeBuilder* builder, const char* const manifestFilename)
+{
+	ImportStatistics statistics;
+	ImportRicoTileManifest(builder, manifestFilename, RICO_SCALE, RICO_TRANSLATION, &statistics);
+}
+
+
+void ImportRicoTiles(Octree* octree, const char* const manifestFilename, const Octree::WorldTransform& transform)
+{
+	ImportStatistics statistics;
+	ImportRicoTileManifest(octree, manifestFilename, transform.scale, transform.translation, &statistics);
+	octree->printStatistics();
+}
+
+
+void ImportRicoTiles(ParallelOctreeBuilder* builder, const char* const manifestFilename, const Octree::WorldTransform& transform)
+{
+	ImportStatistics statistics;
+	ImportRicoTileManifest(builder, manifestFilename, transform.scale, transform.translation, &statistics);
+}
+
+
+void ImportRicoTiles(StaticOctreeBuilder* builder, const char* const manifestFilename, const Octree::WorldTransform& transform)
+{
+	ImportStatistics statistics;
+	ImportRicoTileManifest(builder, manifestFilename, transform.scale, transform.translation, &statistics);
+}
+
+
+bool FitRicoTiles(const char* const manifestFilename, Octree::WorldTransform* const outTransform)
+{
+	const VECTOR3 noTranslation = {0.0f, 0.0f, 0.0f};
+	NullPointConsumer consumer;
+	ImportStatistics statistics;
+	ImportRicoTileManifest(&consumer, manifestFilename, 1.0f, noTranslation, &statistics);
 	
+	return FitImportStatistics(&statistics, outTransform);
+}
+
+
+void ImportPLYFormat(Octree* octree, const char* const filename, const float_t scale, const VECTOR3& translation)
+{
+	PLYReader reader(GetReaderWorkerCount());
+	ImportMappedPoints(octree, &reader, filename, scale, translation);
+	octree->printStatistics();
+}
+
+
+void ImportPLYFormat(ParallelOctreeBuilder* builder, const char* const filename, const float_t scale, const VECTOR3& translation)
+{
+	PLYReader reader(GetReaderWorkerCount());
+	ImportMappedPoints(builder, &reader, filename, scale, translation);
+}
+
+
+void ImportPLYFormat(StaticOctreeBuilder* builder, const char* const filename, const float_t scale, const VECTOR3& translation)
+{
+	PLYReader reader(GetReaderWorkerCount());
+	ImportMappedPoints(builder, &reader, filename, scale, translation);
+}
+
+
+bool FitPLYFormat(const char* const filename, Octree::WorldTransform* const outTransform)
+{
+	PLYReader reader(GetReaderWorkerCount());
+	return FitMappedPoints(&reader, filename, outTransform);
 }
 
 
+void ImportXYZFormat(Octree* octree, const char* const filename, const float_t scale, const VECTOR3& translation)
+{
+	XYZReader reader(GetReaderWorkerCount());
+	ImportMappedPoints(octree, &reader, filename, scale, translation);
+	octree->printStatistics();
+}
+
+
+void ImportXYZFormat(ParallelOctreeBuilder* builder, const char* const filename, const float_t scale, const VECTOR3& translation)
+{
+	XYZReader reader(GetReaderWorkerCount());
+	ImportMappedPoints(builder, &reader, filename, scale, translation);
+}
+
+
+void ImportXYZFormat(StaticOctreeBuilder* builder, const char* const filename, const float_t scale, const VECTOR3& translation)
+{
+	XYZReader reader(GetReaderWorkerCount());
+	ImportMappedPoints(builder, &reader, filename, scale, translation);
+}
+
+
+bool FitXYZFormat(const char* const filename, Octree::WorldTransform* const outTransform)
+{
+	XYZReader reader(GetReaderWorkerCount());
+	return FitMappedPoints(&reader, filename, outTransform);
+}
+
 }
 
 }
\ No newline at end of file
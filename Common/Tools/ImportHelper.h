@@ -11,19 +11,57 @@
 #define IMPORT_HELPER_H
 
 
+#include "MiniGL.h"
+#include "Octree.h"
+
+
 namespace WVSClientCommon
 {
 
 
-class Octree;
+class ParallelOctreeBuilder;
+class StaticOctreeBuilder;
 
 
 namespace ImportHelper
 {
 
 void ImportCTFormat(Octree* octree, const char* const filename);
+
+// 8 bit volume with width * height voxels per slice. Voxels >= threshold are occupied. (see ImportVolumePoints)
+void ImportVolume(Octree* octree, const char* const filename, const uint32_t width, const uint32_t height, const uint32_t depth, const VECTOR3& spacing, const uint8_t threshold, const bool isSurfaceOnly);
+void ImportVolume(ParallelOctreeBuilder* builder, const char* const filename, const uint32_t width, const uint32_t height, const uint32_t depth, const VECTOR3& spacing, const uint8_t threshold, const bool isSurfaceOnly);
+void ImportVolume(StaticOctreeBuilder* builder, const char* const filename, const uint32_t width, const uint32_t height, const uint32_t depth, const VECTOR3& spacing, const uint8_t threshold, const bool isSurfaceOnly);
+
 void ImportRicoFormat(Octree* octree, const char* const filename);
-void ImportPLYFormat(Octree* octree, const char* const filename, const int startbyte, const int vertices);
+void ImportRicoFormat(ParallelOctreeBuilder* builder, const char* const filename);
+void ImportRicoFormat(StaticOctreeBuilder* builder, const char* const filename);
+
+// Imports the Rico tiles listed in a manifest file (one path per line) in parallel
+void ImportRicoTiles(Octree* octree, const char* const manifestFilename);
+void ImportRicoTiles(ParallelOctreeBuilder* builder, const char* const manifestFilename);
+void ImportRicoTiles(StaticOctreeBuilder* builder, const char* const manifestFilename);
+
+// Imports the Rico tiles with the given transform instead of the Berlin coordinate system
+void ImportRicoTiles(Octree* octree, const char* const manifestFilename, const Octree::WorldTransform& transform);
+void ImportRicoTiles(ParallelOctreeBuilder* builder, const char* const manifestFilename, const Octree::WorldTransform& transform);
+void ImportRicoTiles(StaticOctreeBuilder* builder, const char* const manifestFilename, const Octree::WorldTransform& transform);
+
+// Positions are transformed to position * scale + translation (see MappedPointReader)
+void ImportPLYFormat(Octree* octree, const char* const filename, const float_t scale, const VECTOR3& translation);
+void ImportPLYFormat(ParallelOctreeBuilder* builder, const char* const filename, const float_t scale, const VECTOR3& translation);
+void ImportPLYFormat(StaticOctreeBuilder* builder, const char* const filename, const float_t scale, const VECTOR3& translation);
+
+// Bounding box prepass. Reads all points once and calculates the transform that fits them into the
+// octree (see Octree::calcWorldTransform). Returns false if the file has no points.
+bool FitRicoTiles(const char* const manifestFilename, Octree::WorldTransform* const outTransform);
+bool FitPLYFormat(const char* const filename, Octree::WorldTransform* const outTransform);
+bool FitXYZFormat(const char* const filename, Octree::WorldTransform* const outTransform);
+
+// Text files with x y z [red green blue [nx ny nz]] per line (see XYZReader)
+void ImportXYZFormat(Octree* octree, const char* const filename, const float_t scale, const VECTOR3& translation);
+void ImportXYZFormat(ParallelOctreeBuilder* builder, const char* const filename, const float_t scale, const VECTOR3& translation);
+void ImportXYZFormat(StaticOctreeBuilder* builder, const char* const filename, const float_t scale, const VECTOR3& translation);
 
 }
 
@@ -0,0 +1,618 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "MappedPointReader.h"
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <algorithm>
+#include "NormalQuantizer.h"
+
+
+namespace WVSClientCommon
+{
+
+
+// Powers of ten that are exactly representable as double
+static const double exactPowersOfTen[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+static inline bool isDigit(const char c)
+{
+	return ((c >= '0') && (c <= '9'));
+}
+
+
+// Commas and semicolons separate the values of CSV files
+static inline bool isSeparator(const char c)
+{
+	return ((c == ' ') || (c == '\t') || (c == '\r') || (c == ',') || (c == ';'));
+}
+
+
+bool MappedPointReader::parseNumber(const char** const cursor, const char* const lineEnd, double* const outValue)
+{
+	const char* c = *cursor;
+	while ((c < lineEnd) && isSeparator(*c)) ++c;
+	if (c == lineEnd) return false;
+
+	const bool isNegative = (*c == '-');
+	if ((*c == '-') || (*c == '+')) ++c;
+
+	// Up to 19 significant digits fit into the mantissa
+	uint64_t mantissa = 0;
+	uint32_t digitCount = 0;
+	int32_t exponent = 0;
+	const char* const digits = c;
+
+	for (; (c < lineEnd) && isDigit(*c); ++c)
+	{
+		if (digitCount < 19)
+		{
+			mantissa = mantissa * 10 + (*c - '0');
+			if (mantissa > 0) ++digitCount;
+		}
+		else ++exponent;
+	}
+
+	if ((c < lineEnd) && (*c == '.'))
+	{
+		for (++c; (c < lineEnd) && isDigit(*c); ++c)
+		{
+			if (digitCount < 19)
+			{
+				mantissa = mantissa * 10 + (*c - '0');
+				if (mantissa > 0) ++digitCount;
+				--exponent;
+			}
+		}
+	}
+
+	// Tokens like "x" or "nan" are no numbers
+	const bool isNumber = ((c > digits + 1) || ((c > digits) && isDigit(*digits)));
+
+	if ((c < lineEnd) && ((*c == 'e') || (*c == 'E')))
+	{
+		++c;
+		const bool isExponentNegative = ((c < lineEnd) && (*c == '-'));
+		if ((c < lineEnd) && ((*c == '-') || (*c == '+'))) ++c;
+
+		int32_t explicitExponent = 0;
+		for (; (c < lineEnd) && isDigit(*c); ++c)
+		{
+			if (explicitExponent < 10000) explicitExponent = explicitExponent * 10 + (*c - '0');
+		}
+		exponent += isExponentNegative ? -explicitExponent : explicitExponent;
+	}
+
+	// Skip the rest of malformed tokens
+	while ((c < lineEnd) && !isSeparator(*c)) ++c;
+	*cursor = c;
+	if (!isNumber) return false;
+
+	double value = double(mantissa);
+	if (exponent > 22) value *= pow(10.0, exponent);
+	else if (exponent > 0) value *= exactPowersOfTen[exponent];
+	else if (exponent < -22) value /= pow(10.0, -exponent);
+	else if (exponent < 0) value /= exactPowersOfTen[-exponent];
+
+	*outValue = isNegative ? -value : value;
+	return true;
+}
+
+
+static inline uint8_t clampColor(const double value)
+{
+	if (value <= 0.0) return 0;
+	if (value >= 255.0) return 255;
+	return uint8_t(value + 0.5);
+}
+
+
+// Returns the beginning of the first line that starts at or after position
+static inline const char* alignToLineStart(const char* const position, const char* const begin, const char* const end)
+{
+	if ((position <= begin) || (position >= end) || (position[-1] == '\n')) return position;
+
+	const char* const lineBreak = (const char*)memchr(position, '\n', end - position);
+	return (lineBreak == NULL) ? end : lineBreak + 1;
+}
+
+
+MappedPointReader::MappedPointReader(const uint32_t workerCount) :
+	_workerCount(std::max(workerCount, uint32_t(1))),
+	_workers(NULL),
+	_isStarted(false),
+	_chunkSlotCount(0),
+	_isFinished(false),
+	_fileData(NULL),
+	_fileSize(0),
+	_vertexCount(0),
+	_propertyCount(0),
+	_hasNormals(false),
+	_chunks(NULL),
+	_chunkCount(0)
+{
+	_scale = 1.0f;
+	_translation.x = 0.0f;
+	_translation.y = 0.0f;
+	_translation.z = 0.0f;
+
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_chunkDecodedCondition, NULL);
+	pthread_cond_init(&_chunkReleasedCondition, NULL);
+}
+
+
+MappedPointReader::~MappedPointReader()
+{
+	close();
+
+	pthread_cond_destroy(&_chunkReleasedCondition);
+	pthread_cond_destroy(&_chunkDecodedCondition);
+	pthread_mutex_destroy(&_mutex);
+}
+
+
+bool MappedPointReader::open(const char* const filename)
+{
+	close();
+
+	const int file = ::open(filename, O_RDONLY);
+	if (file < 0)
+	{
+		logError("Reading point file failed. Reason: Cannot open %s.\n", filename);
+		return false;
+	}
+
+	struct stat fileStatus;
+	if ((fstat(file, &fileStatus) != 0) || (fileStatus.st_size == 0))
+	{
+		logError("Reading point file failed. Reason: %s is empty.\n", filename);
+		::close(file);
+		return false;
+	}
+
+	_fileSize = size_t(fileStatus.st_size);
+	void* const data = mmap(NULL, _fileSize, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+
+	if (data == MAP_FAILED)
+	{
+		logError("Reading point file failed. Reason: Cannot map %s.\n", filename);
+		_fileSize = 0;
+		return false;
+	}
+
+	// The file is read front to back
+	madvise(data, _fileSize, MADV_SEQUENTIAL);
+	_fileData = (const char*)data;
+
+	_vertexData = _fileData;
+	_vertexDataEnd = _fileData + _fileSize;
+	_vertexCount = UNKNOWN_VERTEX_COUNT;
+	_propertyCount = 0;
+	_hasNormals = false;
+
+	if (!parseHeader())
+	{
+		logError("Reading point file failed. Reason: %s has an invalid or unsupported header.\n", filename);
+		close();
+		return false;
+	}
+
+	if (_hasNormals) NormalQuantizer::init();
+
+	_chunkCount = calcChunkCount();
+	_nextChunkID = 0;
+	_releasedChunkCount = 0;
+	_readPointCount = 0;
+	_isReadingChunk = false;
+	_isFinished = false;
+
+	return true;
+}
+
+
+void MappedPointReader::close()
+{
+	stopWorkers();
+
+	if (_chunks != NULL)
+	{
+		for (uint32_t i = 0; i < _chunkSlotCount; ++i)
+		{
+			delete[] _chunks[i].points;
+			delete[] _chunks[i].normals;
+			delete[] _chunks[i].normalIndices;
+		}
+		delete[] _chunks;
+		_chunks = NULL;
+		_chunkSlotCount = 0;
+	}
+
+	if (_fileData != NULL)
+	{
+		munmap((void*)_fileData, _fileSize);
+		_fileData = NULL;
+		_fileSize = 0;
+	}
+}
+
+
+float_t MappedPointReader::getProgress() const
+{
+	return (_chunkCount == 0) ? 1.0f : float_t(_releasedChunkCount) / float_t(_chunkCount);
+}
+
+
+void MappedPointReader::prefetch() const
+{
+	if (_fileData != NULL) madvise((void*)_fileData, _fileSize, MADV_WILLNEED);
+}
+
+
+void MappedPointReader::setTransformation(const float_t scale, const VECTOR3* const translation)
+{
+	_scale = scale;
+	_translation = *translation;
+}
+
+
+uint32_t MappedPointReader::getPropertyTypeSize(const PropertyType type)
+{
+	switch (type)
+	{
+		case PROPERTY_TYPE_INT8:
+		case PROPERTY_TYPE_UINT8:	return 1;
+		case PROPERTY_TYPE_INT16:
+		case PROPERTY_TYPE_UINT16:	return 2;
+		case PROPERTY_TYPE_INT32:
+		case PROPERTY_TYPE_UINT32:
+		case PROPERTY_TYPE_FLOAT32:	return 4;
+		case PROPERTY_TYPE_FLOAT64:	return 8;
+		default:					return 0;
+	}
+}
+
+
+/**
+	Appends a property to the vertex layout. Binary properties are packed in the order they are added.
+	List properties are skipped.
+ */
+void MappedPointReader::addProperty(const PropertyType type, const PropertyType listCountType, const PropertyUsage usage)
+{
+	assert(_propertyCount < MAX_PROPERTY_COUNT);
+
+	Property* const property = &(_properties[_propertyCount]);
+	property->type = type;
+	property->listCountType = listCountType;
+	property->usage = (listCountType == PROPERTY_TYPE_INVALID) ? usage : PROPERTY_USAGE_NONE;
+	property->offset = 0;
+	property->colorScale = 1.0;
+
+	if (_propertyCount > 0)
+	{
+		const Property* const previous = &(_properties[_propertyCount - 1]);
+		property->offset = previous->offset + getPropertyTypeSize(previous->type);
+	}
+
+	if ((property->usage >= PROPERTY_USAGE_NX) && (property->usage <= PROPERTY_USAGE_NZ)) _hasNormals = true;
+
+	if ((property->usage >= PROPERTY_USAGE_RED) && (property->usage <= PROPERTY_USAGE_BLUE))
+	{
+		if ((type == PROPERTY_TYPE_FLOAT32) || (type == PROPERTY_TYPE_FLOAT64)) property->colorScale = 255.0;
+		else if (type == PROPERTY_TYPE_UINT16) property->colorScale = 255.0 / 65535.0;
+	}
+
+	++_propertyCount;
+}
+
+
+void* MappedPointReader::runWorker(void* worker)
+{
+	((Worker*)worker)->reader->decodeChunks();
+	return NULL;
+}
+
+
+bool MappedPointReader::startWorkers()
+{
+	_chunkSlotCount = _workerCount * CHUNKS_PER_WORKER;
+	_chunks = new Chunk[_chunkSlotCount];
+	for (uint32_t i = 0; i < _chunkSlotCount; ++i)
+	{
+		_chunks[i].points = NULL;
+		_chunks[i].normals = NULL;
+		_chunks[i].normalIndices = NULL;
+		_chunks[i].capacity = 0;
+		_chunks[i].pointCount = 0;
+		_chunks[i].isDecoded = false;
+	}
+
+	_isStarted = true;
+	_workers = new Worker[_workerCount];
+
+	uint32_t startedWorkerCount = 0;
+	for (uint32_t i = 0; i < _workerCount; ++i)
+	{
+		_workers[i].reader = this;
+		if (pthread_create(&(_workers[i].thread), NULL, runWorker, &(_workers[i])) != 0)
+		{
+			logError("Starting point decoder thread failed.\n");
+			_workers[i].reader = NULL;
+		}
+		else ++startedWorkerCount;
+	}
+
+	// The started workers decode all chunks
+	return (startedWorkerCount > 0);
+}
+
+
+void MappedPointReader::stopWorkers()
+{
+	if (!_isStarted) return;
+
+	pthread_mutex_lock(&_mutex);
+	_isFinished = true;
+	pthread_cond_broadcast(&_chunkReleasedCondition);
+	pthread_mutex_unlock(&_mutex);
+
+	for (uint32_t i = 0; i < _workerCount; ++i)
+	{
+		if (_workers[i].reader != NULL) pthread_join(_workers[i].thread, NULL);
+	}
+
+	delete[] _workers;
+	_workers = NULL;
+	_isStarted = false;
+}
+
+
+void MappedPointReader::decodeChunks()
+{
+	pthread_mutex_lock(&_mutex);
+
+	while (true)
+	{
+		// Chunk i is decoded into the slot of chunk i - _chunkSlotCount. Wait until the reader released it.
+		while (!_isFinished && (_nextChunkID < _chunkCount) && (_nextChunkID >= _releasedChunkCount + _chunkSlotCount))
+		{
+			pthread_cond_wait(&_chunkReleasedCondition, &_mutex);
+		}
+
+		if (_isFinished || (_nextChunkID >= _chunkCount)) break;
+
+		const uint64_t chunkID = _nextChunkID++;
+		Chunk* const chunk = &(_chunks[chunkID % _chunkSlotCount]);
+		pthread_mutex_unlock(&_mutex);
+
+		decodeChunk(chunkID, chunk);
+		finishChunk(chunk);
+
+		pthread_mutex_lock(&_mutex);
+		chunk->isDecoded = true;
+		pthread_cond_broadcast(&_chunkDecodedCondition);
+	}
+
+	pthread_mutex_unlock(&_mutex);
+}
+
+
+bool MappedPointReader::readPoints(const WVSPoint** const outPoints, uint32_t* const outCount)
+{
+	if ((_fileData == NULL) || _isFinished) return false;
+
+	if (!_isStarted && !startWorkers())
+	{
+		stopWorkers();
+		return false;
+	}
+
+	pthread_mutex_lock(&_mutex);
+
+	while (true)
+	{
+		// Release the chunk of the previous call
+		if (_isReadingChunk)
+		{
+			_chunks[_releasedChunkCount % _chunkSlotCount].isDecoded = false;
+			++_releasedChunkCount;
+			_isReadingChunk = false;
+			pthread_cond_broadcast(&_chunkReleasedCondition);
+		}
+
+		if ((_releasedChunkCount == _chunkCount) || (_readPointCount == _vertexCount)) break;
+
+		Chunk* const chunk = &(_chunks[_releasedChunkCount % _chunkSlotCount]);
+		while (!chunk->isDecoded)
+		{
+			pthread_cond_wait(&_chunkDecodedCondition, &_mutex);
+		}
+		_isReadingChunk = true;
+
+		// Text chunks might contain lines that follow the vertices (e.g. faces)
+		const uint32_t count = uint32_t(std::min(uint64_t(chunk->pointCount), _vertexCount - _readPointCount));
+		if (count == 0) continue;
+
+		_readPointCount += count;
+		pthread_mutex_unlock(&_mutex);
+
+		*outPoints = chunk->points;
+		*outCount = count;
+		return true;
+	}
+
+	pthread_mutex_unlock(&_mutex);
+	stopWorkers();
+
+	if ((_vertexCount != UNKNOWN_VERTEX_COUNT) && (_readPointCount < _vertexCount))
+	{
+		logError("Point file is truncated. Only %llu of %llu vertices are available.\n",
+			(unsigned long long)_readPointCount, (unsigned long long)_vertexCount);
+	}
+
+	return false;
+}
+
+
+void MappedPointReader::reserveChunkCapacity(Chunk* const chunk, const uint32_t capacity)
+{
+	if (capacity <= chunk->capacity) return;
+
+	const uint32_t newCapacity = std::max(capacity, 2 * chunk->capacity);
+	WVSPoint* const points = new WVSPoint[newCapacity];
+	VECTOR3* const normals = new VECTOR3[newCapacity];
+
+	if (chunk->pointCount > 0)
+	{
+		memcpy(points, chunk->points, chunk->pointCount * sizeof(WVSPoint));
+		memcpy(normals, chunk->normals, chunk->pointCount * sizeof(VECTOR3));
+	}
+
+	delete[] chunk->points;
+	delete[] chunk->normals;
+	delete[] chunk->normalIndices;
+
+	chunk->points = points;
+	chunk->normals = normals;
+	chunk->normalIndices = new uint8_t[newCapacity];
+	chunk->capacity = newCapacity;
+}
+
+
+void MappedPointReader::resetPoint(Chunk* const chunk, const uint32_t index) const
+{
+	WVSPoint* const point = &(chunk->points[index]);
+	memset(point, 0, sizeof(WVSPoint));
+	point->radius = 0.001f;
+
+	VECTOR3* const normal = &(chunk->normals[index]);
+	normal->x = 0.0f;
+	normal->y = 0.0f;
+	normal->z = 0.0f;
+}
+
+
+void MappedPointReader::setProperty(const Property* const property, const double value, WVSPoint* const point, VECTOR3* const normal) const
+{
+	switch (property->usage)
+	{
+		case PROPERTY_USAGE_X:		point->position.x = float_t(value) * _scale + _translation.x; break;
+		case PROPERTY_USAGE_Y:		point->position.y = float_t(value) * _scale + _translation.y; break;
+		case PROPERTY_USAGE_Z:		point->position.z = float_t(value) * _scale + _translation.z; break;
+		case PROPERTY_USAGE_NX:		normal->x = float_t(value); break;
+		case PROPERTY_USAGE_NY:		normal->y = float_t(value); break;
+		case PROPERTY_USAGE_NZ:		normal->z = float_t(value); break;
+		case PROPERTY_USAGE_RED:	point->color.red = clampColor(value * property->colorScale); break;
+		case PROPERTY_USAGE_GREEN:	point->color.green = clampColor(value * property->colorScale); break;
+		case PROPERTY_USAGE_BLUE:	point->color.blue = clampColor(value * property->colorScale); break;
+		default: break;
+	}
+}
+
+
+uint64_t MappedPointReader::calcChunkCount() const
+{
+	return (uint64_t(_vertexDataEnd - _vertexData) + TEXT_CHUNK_BYTE_COUNT - 1) / TEXT_CHUNK_BYTE_COUNT;
+}
+
+
+/**
+	A text chunk covers the lines that start within its byte range. Every line holds one vertex.
+	Lines that do not start with a number (empty lines, comments, column titles) are skipped.
+ */
+void MappedPointReader::decodeChunk(const uint64_t chunkID, Chunk* const chunk)
+{
+	const uint64_t offset = chunkID * TEXT_CHUNK_BYTE_COUNT;
+	const uint64_t size = uint64_t(_vertexDataEnd - _vertexData);
+
+	const char* const begin = alignToLineStart(_vertexData + offset, _vertexData, _vertexDataEnd);
+	const char* const end = alignToLineStart(_vertexData + std::min(offset + TEXT_CHUNK_BYTE_COUNT, size),
+		_vertexData, _vertexDataEnd);
+
+	chunk->pointCount = 0;
+
+	const char* line = begin;
+	while (line < end)
+	{
+		const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+		if (lineEnd == NULL) lineEnd = end;
+
+		reserveChunkCapacity(chunk, chunk->pointCount + 1);
+		resetPoint(chunk, chunk->pointCount);
+		WVSPoint* const point = &(chunk->points[chunk->pointCount]);
+		VECTOR3* const normal = &(chunk->normals[chunk->pointCount]);
+
+		const char* cursor = line;
+		bool isEmpty = true;
+		double value;
+
+		for (uint32_t i = 0; i < _propertyCount; ++i)
+		{
+			const Property* const property = &(_properties[i]);
+			if (!parseNumber(&cursor, lineEnd, &value)) break;
+			isEmpty = false;
+
+			if (property->listCountType != PROPERTY_TYPE_INVALID)
+			{
+				// Skip the list items
+				for (uint32_t j = uint32_t(value); (j > 0) && parseNumber(&cursor, lineEnd, &value); --j);
+				continue;
+			}
+
+			setProperty(property, value, point, normal);
+		}
+
+		if (!isEmpty) ++(chunk->pointCount);
+		line = lineEnd + 1;
+	}
+}
+
+
+void MappedPointReader::finishChunk(Chunk* const chunk) const
+{
+	if (!_hasNormals) return;
+
+	NormalQuantizer::quantizeNormals(chunk->normals, chunk->pointCount, chunk->normalIndices);
+	for (uint32_t i = 0; i < chunk->pointCount; ++i)
+	{
+		chunk->points[i].normalIndex = chunk->normalIndices[i];
+	}
+}
+
+
+}
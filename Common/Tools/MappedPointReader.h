@@ -0,0 +1,217 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef MAPPED_POINT_READER_H
+#define MAPPED_POINT_READER_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "Octree.h"
+
+
+namespace WVSClientCommon
+{
+
+
+/**
+	Base class of the point file readers (see PLYReader and XYZReader).
+
+	The file is memory mapped and split into chunks. Worker threads decode the chunks into point
+	batches (including the normal quantization, see NormalQuantizer). The batches are handed out by
+	readPoints in file order. Only a bounded number of chunks is decoded ahead of the reader.
+
+	Text chunks cover the lines that start within a fixed byte range. Thus the lines can be split
+	among the workers without parsing the file up front.
+ */
+class MappedPointReader
+{
+	static const uint32_t	TEXT_CHUNK_BYTE_COUNT = 1024*1024;
+	static const uint32_t	CHUNKS_PER_WORKER = 2;
+
+	struct Worker
+	{
+		MappedPointReader*	reader;
+		pthread_t			thread;
+	};
+
+	const uint32_t		_workerCount;
+	Worker*				_workers;
+	bool				_isStarted;
+
+	float_t				_scale;
+	VECTOR3				_translation;
+
+	// Chunk queue (chunk i is decoded into slot i % _chunkSlotCount)
+	uint32_t			_chunkSlotCount;
+	uint64_t			_nextChunkID;
+	uint64_t			_releasedChunkCount;
+	uint64_t			_readPointCount;
+	bool				_isReadingChunk;
+	bool				_isFinished;
+	pthread_mutex_t		_mutex;
+	pthread_cond_t		_chunkDecodedCondition;
+	pthread_cond_t		_chunkReleasedCondition;
+
+	static void* runWorker(void* worker);
+	void decodeChunks();
+
+	bool startWorkers();
+	void stopWorkers();
+
+
+protected:
+	static const uint32_t	MAX_PROPERTY_COUNT = 32;
+	static const uint64_t	UNKNOWN_VERTEX_COUNT = ~uint64_t(0);
+
+	enum PropertyType
+	{
+		PROPERTY_TYPE_INT8,
+		PROPERTY_TYPE_UINT8,
+		PROPERTY_TYPE_INT16,
+		PROPERTY_TYPE_UINT16,
+		PROPERTY_TYPE_INT32,
+		PROPERTY_TYPE_UINT32,
+		PROPERTY_TYPE_FLOAT32,
+		PROPERTY_TYPE_FLOAT64,
+		PROPERTY_TYPE_INVALID
+	};
+
+	enum PropertyUsage
+	{
+		PROPERTY_USAGE_X,
+		PROPERTY_USAGE_Y,
+		PROPERTY_USAGE_Z,
+		PROPERTY_USAGE_NX,
+		PROPERTY_USAGE_NY,
+		PROPERTY_USAGE_NZ,
+		PROPERTY_USAGE_RED,
+		PROPERTY_USAGE_GREEN,
+		PROPERTY_USAGE_BLUE,
+		PROPERTY_USAGE_NONE
+	};
+
+	struct Property
+	{
+		PropertyType		type;
+		PropertyType		listCountType;		// PROPERTY_TYPE_INVALID if the property is no list
+		PropertyUsage		usage;
+		uint32_t			offset;				// Byte offset within a binary vertex
+		double				colorScale;			// Maps the value range of a color property to [0, 255]
+	};
+
+	struct Chunk
+	{
+		WVSPoint*			points;
+		VECTOR3*			normals;
+		uint8_t*			normalIndices;
+		uint32_t			capacity;
+		uint32_t			pointCount;
+		bool				isDecoded;
+	};
+
+	// Mapped file
+	const char*			_fileData;
+	size_t				_fileSize;
+
+	// Set by parseHeader
+	const char*			_vertexData;
+	const char*			_vertexDataEnd;
+	uint64_t			_vertexCount;
+	Property			_properties[MAX_PROPERTY_COUNT];
+	uint32_t			_propertyCount;
+	bool				_hasNormals;
+
+	Chunk*				_chunks;
+	uint64_t			_chunkCount;
+
+	// Called by open after the file has been mapped
+	virtual bool parseHeader() = 0;
+
+	// Text files are split by byte ranges. Binary files override both functions.
+	virtual uint64_t calcChunkCount() const;
+	virtual void decodeChunk(const uint64_t chunkID, Chunk* const chunk);
+
+	void addProperty(const PropertyType type, const PropertyType listCountType, const PropertyUsage usage);
+	static uint32_t getPropertyTypeSize(const PropertyType type);
+
+	void reserveChunkCapacity(Chunk* const chunk, const uint32_t capacity);
+	void resetPoint(Chunk* const chunk, const uint32_t index) const;
+	void setProperty(const Property* const property, const double value, WVSPoint* const point, VECTOR3* const normal) const;
+	inline void transformPosition(VECTOR3* const position) const;
+	void finishChunk(Chunk* const chunk) const;
+
+	/**
+		Parses the next number of a line and moves the cursor behind it. Returns false if the line
+		has no more values or the next value is no number. Unlike strtod the parser respects the end
+		of the line (the mapped file is not null terminated) and does not depend on the locale.
+	 */
+	static bool parseNumber(const char** const cursor, const char* const lineEnd, double* const outValue);
+
+
+public:
+	MappedPointReader(const uint32_t workerCount);
+	virtual ~MappedPointReader();
+
+	// Maps the file and parses the header
+	bool open(const char* const filename);
+	void close();
+
+	bool hasNormals() const { return _hasNormals; }
+
+	size_t getFileSize() const { return _fileSize; }
+
+	// Fraction of the file that has been read
+	float_t getProgress() const;
+
+	// Asks the system to read the whole file asynchronously (e.g. while the previous file is decoded)
+	void prefetch() const;
+
+	// Positions are transformed to position * scale + translation
+	void setTransformation(const float_t scale, const VECTOR3* const translation);
+
+	/**
+		Returns the next batch of points in file order. The batch is valid until the next call.
+		Returns false if all vertices have been read.
+	 */
+	bool readPoints(const WVSPoint** const outPoints, uint32_t* const outCount);
+};
+
+
+// Applies the transformation (see setTransformation)
+inline void MappedPointReader::transformPosition(VECTOR3* const position) const
+{
+	position->x = position->x * _scale + _translation.x;
+	position->y = position->y * _scale + _translation.y;
+	position->z = position->z * _scale + _translation.z;
+}
+
+
+}
+
+#endif // MAPPED_POINT_READER_H
@@ -0,0 +1,306 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "PLYReader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+
+namespace WVSClientCommon
+{
+
+
+static const uint32_t MAX_HEADER_LINE_LENGTH = 1024;
+
+
+template <typename T>
+static inline double readBinaryValue(const char* const data, const bool isByteSwapNecessary)
+{
+	T value;
+	if (isByteSwapNecessary)
+	{
+		char bytes[sizeof(T)];
+		for (uint32_t i = 0; i < sizeof(T); ++i) bytes[i] = data[sizeof(T) - 1 - i];
+		memcpy(&value, bytes, sizeof(T));
+	}
+	else memcpy(&value, data, sizeof(T));
+
+	return double(value);
+}
+
+
+PLYReader::PLYReader(const uint32_t workerCount) :
+	MappedPointReader(workerCount),
+	_format(FORMAT_ASCII),
+	_vertexSize(0),
+	_isByteSwapNecessary(false)
+{
+}
+
+
+PLYReader::PropertyType PLYReader::parsePropertyType(const char* const name)
+{
+	if (!strcmp(name, "char") || !strcmp(name, "int8")) return PROPERTY_TYPE_INT8;
+	if (!strcmp(name, "uchar") || !strcmp(name, "uint8")) return PROPERTY_TYPE_UINT8;
+	if (!strcmp(name, "short") || !strcmp(name, "int16")) return PROPERTY_TYPE_INT16;
+	if (!strcmp(name, "ushort") || !strcmp(name, "uint16")) return PROPERTY_TYPE_UINT16;
+	if (!strcmp(name, "int") || !strcmp(name, "int32")) return PROPERTY_TYPE_INT32;
+	if (!strcmp(name, "uint") || !strcmp(name, "uint32")) return PROPERTY_TYPE_UINT32;
+	if (!strcmp(name, "float") || !strcmp(name, "float32")) return PROPERTY_TYPE_FLOAT32;
+	if (!strcmp(name, "double") || !strcmp(name, "float64")) return PROPERTY_TYPE_FLOAT64;
+	return PROPERTY_TYPE_INVALID;
+}
+
+
+bool PLYReader::parseProperty(const char* const type, const char* const listCountType, const char* const name)
+{
+	if (_propertyCount == MAX_PROPERTY_COUNT) return false;
+
+	const PropertyType propertyType = parsePropertyType(type);
+	const PropertyType propertyListCountType = (listCountType == NULL) ? PROPERTY_TYPE_INVALID : parsePropertyType(listCountType);
+
+	if ((propertyType == PROPERTY_TYPE_INVALID) ||
+		((listCountType != NULL) && (propertyListCountType == PROPERTY_TYPE_INVALID)))
+	{
+		return false;
+	}
+
+	PropertyUsage usage = PROPERTY_USAGE_NONE;
+	if (!strcmp(name, "x")) usage = PROPERTY_USAGE_X;
+	else if (!strcmp(name, "y")) usage = PROPERTY_USAGE_Y;
+	else if (!strcmp(name, "z")) usage = PROPERTY_USAGE_Z;
+	else if (!strcmp(name, "nx")) usage = PROPERTY_USAGE_NX;
+	else if (!strcmp(name, "ny")) usage = PROPERTY_USAGE_NY;
+	else if (!strcmp(name, "nz")) usage = PROPERTY_USAGE_NZ;
+	else if (!strcmp(name, "red") || !strcmp(name, "diffuse_red")) usage = PROPERTY_USAGE_RED;
+	else if (!strcmp(name, "green") || !strcmp(name, "diffuse_green")) usage = PROPERTY_USAGE_GREEN;
+	else if (!strcmp(name, "blue") || !strcmp(name, "diffuse_blue")) usage = PROPERTY_USAGE_BLUE;
+
+	addProperty(propertyType, propertyListCountType, usage);
+
+	_vertexSize += getPropertyTypeSize(propertyType);
+	return true;
+}
+
+
+/**
+	Parses the header and determines the vertex layout. Elements in front of the vertex element
+	are skipped (in binary files only if they have no list properties).
+ */
+bool PLYReader::parseHeader()
+{
+	const char* const fileEnd = _fileData + _fileSize;
+	const char* line = _fileData;
+
+	_format = FORMAT_ASCII;
+	_vertexCount = 0;
+	_vertexSize = 0;
+
+	bool isPLY = false;
+	bool isFormatDefined = false;
+	bool isVertexElementDefined = false;
+	bool isVertexElement = false;
+	bool isElementSizeValid = true;
+	uint64_t elementCount = 0;
+	uint64_t elementSize = 0;
+	uint64_t skippedLineCount = 0;
+	uint64_t skippedByteCount = 0;
+
+	while (line < fileEnd)
+	{
+		const char* lineEnd = (const char*)memchr(line, '\n', fileEnd - line);
+		if (lineEnd == NULL) return false;
+
+		char buffer[MAX_HEADER_LINE_LENGTH];
+		const size_t length = std::min(size_t(lineEnd - line), size_t(MAX_HEADER_LINE_LENGTH - 1));
+		memcpy(buffer, line, length);
+		buffer[length] = '\0';
+		line = lineEnd + 1;
+
+		char keyword[64], first[64], second[64], third[64], fourth[64];
+		const int tokenCount = sscanf(buffer, "%63s %63s %63s %63s %63s", keyword, first, second, third, fourth);
+		if (tokenCount <= 0) continue;
+
+		if (!isPLY)
+		{
+			if (strcmp(keyword, "ply")) return false;
+			isPLY = true;
+		}
+		else if (!strcmp(keyword, "format") && (tokenCount >= 2))
+		{
+			if (!strcmp(first, "ascii")) _format = FORMAT_ASCII;
+			else if (!strcmp(first, "binary_little_endian")) _format = FORMAT_BINARY_LITTLE_ENDIAN;
+			else if (!strcmp(first, "binary_big_endian")) _format = FORMAT_BINARY_BIG_ENDIAN;
+			else return false;
+			isFormatDefined = true;
+		}
+		else if (!strcmp(keyword, "element") && (tokenCount >= 3))
+		{
+			// Close the previous element
+			if (!isVertexElementDefined && !isVertexElement)
+			{
+				skippedLineCount += elementCount;
+				skippedByteCount += elementCount * elementSize;
+			}
+			if (isVertexElement) isVertexElementDefined = true;
+
+			elementCount = strtoull(second, NULL, 10);
+			elementSize = 0;
+			isVertexElement = !isVertexElementDefined && !strcmp(first, "vertex");
+			if (isVertexElement) _vertexCount = elementCount;
+		}
+		else if (!strcmp(keyword, "property") && (tokenCount >= 3))
+		{
+			// property <type> <name> or property list <count type> <item type> <name>
+			const bool isList = !strcmp(first, "list");
+			if (isList && (tokenCount < 5)) return false;
+
+			if (isVertexElement)
+			{
+				if (isList && (_format != FORMAT_ASCII)) return false;
+
+				const bool isValid = isList ? parseProperty(third, second, fourth) : parseProperty(first, NULL, second);
+				if (!isValid) return false;
+			}
+			else if (!isVertexElementDefined)
+			{
+				if (isList) isElementSizeValid = false;
+				else elementSize += getPropertyTypeSize(parsePropertyType(first));
+			}
+		}
+		else if (!strcmp(keyword, "end_header"))
+		{
+			if (isVertexElement) isVertexElementDefined = true;
+			else if (!isVertexElementDefined)
+			{
+				skippedLineCount += elementCount;
+				skippedByteCount += elementCount * elementSize;
+			}
+			break;
+		}
+	}
+
+	if (!isPLY || !isFormatDefined || !isVertexElementDefined || (line >= fileEnd)) return false;
+
+	// Skip the elements in front of the vertices
+	_vertexData = line;
+	if (_format == FORMAT_ASCII)
+	{
+		for (uint64_t i = 0; (i < skippedLineCount) && (_vertexData < fileEnd); ++i)
+		{
+			const char* const lineBreak = (const char*)memchr(_vertexData, '\n', fileEnd - _vertexData);
+			_vertexData = (lineBreak == NULL) ? fileEnd : lineBreak + 1;
+		}
+
+		// The vertex lines are followed by the lines of other elements which are dropped by readPoints
+		_vertexDataEnd = fileEnd;
+	}
+	else
+	{
+		if (skippedByteCount > 0)
+		{
+			if (!isElementSizeValid) return false;
+			_vertexData = (skippedByteCount < uint64_t(fileEnd - _vertexData)) ? _vertexData + skippedByteCount : fileEnd;
+		}
+
+		const uint64_t availableVertexCount = (_vertexSize == 0) ? 0 : uint64_t(fileEnd - _vertexData) / _vertexSize;
+		if (availableVertexCount < _vertexCount)
+		{
+			logError("PLY file is truncated. Only %llu of %llu vertices are available.\n",
+				(unsigned long long)availableVertexCount, (unsigned long long)_vertexCount);
+			_vertexCount = availableVertexCount;
+		}
+		_vertexDataEnd = _vertexData + _vertexCount * _vertexSize;
+
+		const uint16_t endianessProbe = 1;
+		const bool isHostLittleEndian = (*((const uint8_t*)&endianessProbe) == 1);
+		_isByteSwapNecessary = ((_format == FORMAT_BINARY_LITTLE_ENDIAN) != isHostLittleEndian);
+	}
+
+	return true;
+}
+
+
+uint64_t PLYReader::calcChunkCount() const
+{
+	if (_format == FORMAT_ASCII) return MappedPointReader::calcChunkCount();
+	return (_vertexCount + BINARY_CHUNK_POINT_COUNT - 1) / BINARY_CHUNK_POINT_COUNT;
+}
+
+
+void PLYReader::decodeChunk(const uint64_t chunkID, Chunk* const chunk)
+{
+	if (_format == FORMAT_ASCII) MappedPointReader::decodeChunk(chunkID, chunk);
+	else decodeBinaryChunk(chunkID, chunk);
+}
+
+
+void PLYReader::decodeBinaryChunk(const uint64_t chunkID, Chunk* const chunk)
+{
+	const uint64_t firstVertex = chunkID * BINARY_CHUNK_POINT_COUNT;
+	const uint32_t count = uint32_t(std::min(uint64_t(BINARY_CHUNK_POINT_COUNT), _vertexCount - firstVertex));
+
+	chunk->pointCount = 0;
+	reserveChunkCapacity(chunk, count);
+
+	const char* vertex = _vertexData + firstVertex * _vertexSize;
+	for (uint32_t i = 0; i < count; ++i, vertex += _vertexSize)
+	{
+		resetPoint(chunk, i);
+		WVSPoint* const point = &(chunk->points[i]);
+		VECTOR3* const normal = &(chunk->normals[i]);
+
+		for (uint32_t j = 0; j < _propertyCount; ++j)
+		{
+			const Property* const property = &(_properties[j]);
+			if (property->usage == PROPERTY_USAGE_NONE) continue;
+
+			const char* const data = vertex + property->offset;
+			double value;
+			switch (property->type)
+			{
+				case PROPERTY_TYPE_INT8:	value = readBinaryValue<int8_t>(data, _isByteSwapNecessary); break;
+				case PROPERTY_TYPE_UINT8:	value = readBinaryValue<uint8_t>(data, _isByteSwapNecessary); break;
+				case PROPERTY_TYPE_INT16:	value = readBinaryValue<int16_t>(data, _isByteSwapNecessary); break;
+				case PROPERTY_TYPE_UINT16:	value = readBinaryValue<uint16_t>(data, _isByteSwapNecessary); break;
+				case PROPERTY_TYPE_INT32:	value = readBinaryValue<int32_t>(data, _isByteSwapNecessary); break;
+				case PROPERTY_TYPE_UINT32:	value = readBinaryValue<uint32_t>(data, _isByteSwapNecessary); break;
+				case PROPERTY_TYPE_FLOAT32:	value = readBinaryValue<float>(data, _isByteSwapNecessary); break;
+				default:					value = readBinaryValue<double>(data, _isByteSwapNecessary); break;
+			}
+
+			setProperty(property, value, point, normal);
+		}
+	}
+
+	chunk->pointCount = count;
+}
+
+
+}
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PLY_READER_H
+#define PLY_READER_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MappedPointReader.h"
+
+
+namespace WVSClientCommon
+{
+
+
+/**
+	Reads the vertices of a PLY file (ascii, binary_little_endian or binary_big_endian) as WVSPoints
+	(see MappedPointReader).
+
+	Supported vertex properties are x, y, z, nx, ny, nz and red, green, blue (diffuse_red etc.).
+	All other properties are skipped. List properties are only supported in ascii files.
+ */
+class PLYReader : public MappedPointReader
+{
+	static const uint32_t	BINARY_CHUNK_POINT_COUNT = 4096*4;
+
+	enum Format
+	{
+		FORMAT_ASCII,
+		FORMAT_BINARY_LITTLE_ENDIAN,
+		FORMAT_BINARY_BIG_ENDIAN
+	};
+
+	Format				_format;
+	uint32_t			_vertexSize;
+	bool				_isByteSwapNecessary;
+
+	bool parseProperty(const char* const type, const char* const listCountType, const char* const name);
+	static PropertyType parsePropertyType(const char* const name);
+
+	void decodeBinaryChunk(const uint64_t chunkID, Chunk* const chunk);
+
+
+protected:
+	virtual bool parseHeader();
+	virtual uint64_t calcChunkCount() const;
+	virtual void decodeChunk(const uint64_t chunkID, Chunk* const chunk);
+
+
+public:
+	PLYReader(const uint32_t workerCount);
+
+	uint64_t getVertexCount() const { return _vertexCount; }
+};
+
+
+}
+
+#endif // PLY_READER_H
@@ -0,0 +1,562 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "ParallelOctreeBuilder.h"
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include "APIFactory.h"
+#include "BackingStore.h"
+
+
+namespace WVSClientCommon
+{
+
+
+static bool isQuantPointPositionSmaller(const QuantPoint& a, const QuantPoint& b)
+{
+	return (a.getPosition() < b.getPosition());
+}
+
+
+static bool isSubtreeBigger(const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b)
+{
+	return (a > b);
+}
+
+
+ParallelOctreeBuilder::ParallelOctreeBuilder(	const uint32_t workerCount,
+												const uint8_t splitLevel,
+												const char* const tempFilePrefix) :
+												_workerCount(workerCount),
+												_splitLevel(splitLevel),
+												_subtreeCount(1 << (3 * splitLevel))
+{
+	assert(_workerCount > 0);
+	assert(_splitLevel > 0);
+	assert(_splitLevel <= MAX_SPLIT_LEVEL);
+	
+	// File positions are stored in the children pointers of a node
+	assert(sizeof(long) == sizeof(Octree::Node*));
+	
+	strncpy(_tempFilePrefix, tempFilePrefix, sizeof(_tempFilePrefix) - 1);
+	_tempFilePrefix[sizeof(_tempFilePrefix) - 1] = 0;
+	
+	char binFilename[2048];
+	_bins = new SubtreeBin[_subtreeCount];
+	for (uint32_t i = 0; i < _subtreeCount; ++i)
+	{
+		_bins[i].points = NULL;
+		_bins[i].bufferedPointCount = 0;
+		_bins[i].pointCount = 0;
+		_bins[i].workerID = 0;
+		
+		// Bins are appended. Make sure there are no leftovers of a previous (canceled) build
+		getTempFilename(binFilename, 2048, "bin", i);
+		remove(binFilename);
+	}
+	
+	_workers = new Worker[_workerCount];
+	for (uint32_t i = 0; i < _workerCount; ++i)
+	{
+		_workers[i].builder = this;
+		_workers[i].workerID = i;
+		_workers[i].pointCount = 0;
+		_workers[i].success = false;
+	}
+	
+	_pointCount = 0;
+	
+	_worldTransform.scale = 1.0f;
+	_worldTransform.translation.x = 0.0f;
+	_worldTransform.translation.y = 0.0f;
+	_worldTransform.translation.z = 0.0f;
+	_leafLevel = OCTREE_LEAF_LEVEL;
+}
+
+
+ParallelOctreeBuilder::~ParallelOctreeBuilder()
+{
+	char binFilename[2048];
+	for (uint32_t i = 0; i < _subtreeCount; ++i)
+	{
+		if (_bins[i].pointCount > 0)
+		{
+			getTempFilename(binFilename, 2048, "bin", i);
+			remove(binFilename);
+		}
+		delete[] _bins[i].points;
+	}
+	
+	delete[] _bins;
+	delete[] _workers;
+}
+
+
+void ParallelOctreeBuilder::getTempFilename(char* const cBuffer, const int iLength, const char* const type, const uint32_t id) const
+{
+	snprintf(cBuffer, iLength, "%s.%s%u", _tempFilePrefix, type, id);
+}
+
+
+void ParallelOctreeBuilder::setWorldTransform(const Octree::WorldTransform* const transform)
+{
+	_worldTransform = *transform;
+}
+
+
+// Nodes below the split level belong to a single subtree. Thus the leaf level must not be above
+// the split level.
+void ParallelOctreeBuilder::setLeafLevel(const uint8_t leafLevel)
+{
+	assert(_pointCount == 0);
+	
+	if ((leafLevel < _splitLevel) || (leafLevel == 0) || (leafLevel > OCTREE_LEAF_LEVEL))
+	{
+		logError("Setting leaf level failed. Reason: Level %u is not supported.\n", leafLevel);
+		return;
+	}
+	
+	_leafLevel = leafLevel;
+}
+
+
+// Sorts points in the bin of the subtree they belong to. Full bins are appended to a temp file.
+void ParallelOctreeBuilder::addPoints(const WVSPoint* const points, const size_t count)
+{
+	Octree::FIXPVECTOR3 positions[QUANTIZATION_BATCH_POINT_COUNT];
+	uint16_t fiveBitColors[QUANTIZATION_BATCH_POINT_COUNT];
+	bool isWithinBounds[QUANTIZATION_BATCH_POINT_COUNT];
+	
+	for (size_t first = 0; first < count; first += QUANTIZATION_BATCH_POINT_COUNT)
+	{
+		const size_t batchCount = std::min(count - first, size_t(QUANTIZATION_BATCH_POINT_COUNT));
+		
+		// Transform floating point vectors in fix point format (see Octree::addPoints)
+		Octree::quantizePoints(&(points[first]), batchCount, positions, fiveBitColors, isWithinBounds);
+		
+		for (size_t i = 0; i < batchCount; ++i)
+		{
+			if (!isWithinBounds[i])
+			{
+				logError("Adding point failed. Reason: Position out of octree bounds.\n");
+				continue;
+			}
+			
+			// The upper bits of the Morton key are the child node IDs of the levels above the split level
+			const uint32_t subtreeID = Octree::calcMortonKey(&(positions[i])) >> (3 * (OCTREE_LEAF_LEVEL - _splitLevel));
+			assert(subtreeID < _subtreeCount);
+			
+			SubtreeBin* const bin = &(_bins[subtreeID]);
+			if (bin->points == NULL) bin->points = new WVSPoint[BIN_BUFFER_POINT_COUNT];
+			
+			bin->points[bin->bufferedPointCount++] = points[first + i];
+			++(bin->pointCount);
+			++_pointCount;
+			
+			if (bin->bufferedPointCount == BIN_BUFFER_POINT_COUNT) flushBin(subtreeID);
+		}
+	}
+}
+
+
+bool ParallelOctreeBuilder::flushBin(const uint32_t subtreeID)
+{
+	SubtreeBin* const bin = &(_bins[subtreeID]);
+	
+	char binFilename[2048];
+	getTempFilename(binFilename, 2048, "bin", subtreeID);
+	
+	// Open and close the file on every flush. Otherwise we could exceed the open file limit
+	// with 512 subtrees.
+	FILE* file = fopen(binFilename, "ab");
+	if (file == NULL)
+	{
+		logError("Binning points failed. Reason: Cannot open %s.\n", binFilename);
+		return false;
+	}
+	
+	const size_t written = fwrite(bin->points, sizeof(WVSPoint), bin->bufferedPointCount, file);
+	fclose(file);
+	
+	const bool success = (written == bin->bufferedPointCount);
+	if (!success) logError("Binning points failed. Reason: Write failure.\n");
+	
+	bin->bufferedPointCount = 0;
+	return success;
+}
+
+
+// Longest processing time first: the biggest subtree is assigned to the worker with the least points
+void ParallelOctreeBuilder::assignSubtreesToWorkers()
+{
+	std::pair<uint64_t, uint32_t>* subtrees = new std::pair<uint64_t, uint32_t>[_subtreeCount];
+	for (uint32_t i = 0; i < _subtreeCount; ++i) subtrees[i] = std::make_pair(_bins[i].pointCount, i);
+	std::sort(subtrees, subtrees + _subtreeCount, isSubtreeBigger);
+	
+	for (uint32_t i = 0; i < _workerCount; ++i) _workers[i].pointCount = 0;
+	
+	for (uint32_t i = 0; (i < _subtreeCount) && (subtrees[i].first > 0); ++i)
+	{
+		uint32_t workerID = 0;
+		for (uint32_t j = 1; j < _workerCount; ++j)
+		{
+			if (_workers[j].pointCount < _workers[workerID].pointCount) workerID = j;
+		}
+		
+		_bins[subtrees[i].second].workerID = workerID;
+		_workers[workerID].pointCount += subtrees[i].first;
+	}
+	
+	delete[] subtrees;
+}
+
+
+void* ParallelOctreeBuilder::runWorker(void* worker)
+{
+	Worker* const w = (Worker*)worker;
+	w->success = w->builder->buildWorkerOctree(w);
+	return NULL;
+}
+
+
+bool ParallelOctreeBuilder::buildWorkerOctree(Worker* const worker)
+{
+	char backingStoreFilename[2048];
+	char octreeFilename[2048];
+	char binFilename[2048];
+	getTempFilename(backingStoreFilename, 2048, "backingstore", worker->workerID);
+	getTempFilename(octreeFilename, 2048, "octree", worker->workerID);
+	
+	// The worker octree is never rendered
+	Octree* octree = new Octree(1, backingStoreFilename, false, NULL, NULL, NULL);
+	octree->disableLocking();
+	octree->setLeafLevel(_leafLevel);
+	
+	// LODs are generated while the octree is saved
+	octree->deferLODGeneration();
+	
+	bool success = true;
+	WVSPoint* batch = new WVSPoint[INSERTION_BATCH_POINT_COUNT];
+	
+	// Subtrees are processed in Morton order. Consequently nodes above the split level that are
+	// shared by neighbouring subtrees are likely still in memory.
+	for (uint32_t i = 0; i < _subtreeCount; ++i)
+	{
+		if ((_bins[i].workerID != worker->workerID) || (_bins[i].pointCount == 0)) continue;
+		
+		getTempFilename(binFilename, 2048, "bin", i);
+		FILE* binFile = fopen(binFilename, "rb");
+		if (binFile == NULL)
+		{
+			logError("Building subtree failed. Reason: Cannot open %s.\n", binFilename);
+			success = false;
+			continue;
+		}
+		
+		size_t count;
+		while ((count = fread(batch, sizeof(WVSPoint), INSERTION_BATCH_POINT_COUNT, binFile)) > 0)
+		{
+			octree->addPoints(batch, count);
+		}
+		
+		fclose(binFile);
+		remove(binFilename);
+	}
+	
+	delete[] batch;
+	
+	octree->saveToDisk(octreeFilename);
+	delete octree;
+	remove(backingStoreFilename);
+	
+	return success;
+}
+
+
+bool ParallelOctreeBuilder::readNodeRecord(FILE* const file, NodeRecord* const outRecord)
+{
+	if (fread(outRecord->childrenFilePosition, sizeof(Octree::Node*), 8, file) != 8) return false;
+	if (fread(&(outRecord->quantPointCount), sizeof(uint16_t), 1, file) != 1) return false;
+	assert(outRecord->quantPointCount <= MAX_POINTS_PER_NODE);
+	
+	// Points are stored in full blocks
+	const size_t blockCount =	(outRecord->quantPointCount + OCTREE_POINTS_PER_POINT_DATA_BLOCK - 1) /
+								OCTREE_POINTS_PER_POINT_DATA_BLOCK;
+	const size_t count = blockCount * OCTREE_POINTS_PER_POINT_DATA_BLOCK;
+	
+	return (fread(outRecord->points, sizeof(QuantPoint), count, file) == count);
+}
+
+
+bool ParallelOctreeBuilder::writeNodeRecord(FILE* const file, NodeRecord* const record)
+{
+	assert(record->quantPointCount <= MAX_POINTS_PER_NODE);
+	
+	const size_t blockCount =	(record->quantPointCount + OCTREE_POINTS_PER_POINT_DATA_BLOCK - 1) /
+								OCTREE_POINTS_PER_POINT_DATA_BLOCK;
+	const size_t count = blockCount * OCTREE_POINTS_PER_POINT_DATA_BLOCK;
+	
+	// Clear the unused part of the last block
+	memset(&(record->points[record->quantPointCount]), 0, (count - record->quantPointCount) * sizeof(QuantPoint));
+	
+	if (fwrite(record->childrenFilePosition, sizeof(Octree::Node*), 8, file) != 8) return false;
+	if (fwrite(&(record->quantPointCount), sizeof(uint16_t), 1, file) != 1) return false;
+	
+	return (fwrite(record->points, sizeof(QuantPoint), count, file) == count);
+}
+
+
+// Appends all nodes of a worker file. The nodes are written in post order without gaps
+// (see Octree::saveToDisk). Thus the file can be copied sequentially. Only the file positions
+// of the children need to be moved.
+bool ParallelOctreeBuilder::appendWorkerFile(FILE* const file, const uint32_t workerID, long* const outRootChildrenFilePosition)
+{
+	char octreeFilename[2048];
+	getTempFilename(octreeFilename, 2048, "octree", workerID);
+	
+	FILE* workerFile = fopen(octreeFilename, "rb");
+	if (workerFile == NULL)
+	{
+		logError("Merging octrees failed. Reason: Cannot open %s.\n", octreeFilename);
+		return false;
+	}
+	
+	// The footer of the worker octree is skipped
+	Octree::WorldTransform workerTransform;
+	uint8_t workerLeafLevel;
+	const long workerNodesEnd = BackingStore::readFooter(workerFile, &workerTransform, &workerLeafLevel);
+	fseek(workerFile, 0, SEEK_SET);
+	
+	if (fread(outRootChildrenFilePosition, sizeof(Octree::Node*), 8, workerFile) != 8)
+	{
+		logError("Merging octrees failed. Reason: Read failure.\n");
+		fclose(workerFile);
+		return false;
+	}
+	
+	fseek(file, 0, SEEK_END);
+	const long offset = ftell(file) - long(8 * sizeof(Octree::Node*));
+	
+	for (uint8_t i = 0; i < 8; ++i)
+		if (outRootChildrenFilePosition[i] != 0) outRootChildrenFilePosition[i] += offset;
+	
+	bool success = true;
+	NodeRecord* record = new NodeRecord;
+	
+	while ((ftell(workerFile) < workerNodesEnd) && readNodeRecord(workerFile, record))
+	{
+		for (uint8_t i = 0; i < 8; ++i)
+			if (record->childrenFilePosition[i] != 0) record->childrenFilePosition[i] += offset;
+		
+		if (!writeNodeRecord(file, record))
+		{
+			logError("Merging octrees failed. Reason: Write failure.\n");
+			success = false;
+			break;
+		}
+	}
+	
+	delete record;
+	fclose(workerFile);
+	remove(octreeFilename);
+	
+	return success;
+}
+
+
+// Merges the nodes at the given file positions. All nodes have the same position in the octree
+// but were built by different workers. Returns the file position of the merged node.
+long ParallelOctreeBuilder::mergeNodes(FILE* const file, const long* const filePositions, const uint32_t count, const uint8_t level)
+{
+	assert(count > 0);
+	
+	// Node (and consequently its subtree) was built by one worker only
+	if (count == 1) return filePositions[0];
+	
+	// Only the nodes above the split level are shared
+	assert(level < _splitLevel);
+	
+	NodeRecord* records = new NodeRecord[count];
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		fseek(file, filePositions[i], SEEK_SET);
+		if (!readNodeRecord(file, &(records[i])))
+			logError("Merging octrees failed. Reason: Read failure.\n");
+	}
+	
+	NodeRecord* merged = new NodeRecord;
+	
+	// Merge children first (file is written in post order)
+	long* childFilePositions = new long[count];
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		uint32_t childCount = 0;
+		for (uint32_t j = 0; j < count; ++j)
+		{
+			if (records[j].childrenFilePosition[i] != 0)
+				childFilePositions[childCount++] = records[j].childrenFilePosition[i];
+		}
+		
+		merged->childrenFilePosition[i] = 0;
+		if (childCount > 0) merged->childrenFilePosition[i] = mergeNodes(file, childFilePositions, childCount, level + 1);
+	}
+	
+	// Every cell belongs to exactly one subtree. Therefore the point sets are disjoint.
+	merged->quantPointCount = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		assert(merged->quantPointCount + records[i].quantPointCount <= MAX_POINTS_PER_NODE);
+		memcpy(	&(merged->points[merged->quantPointCount]),
+				records[i].points,
+				records[i].quantPointCount * sizeof(QuantPoint));
+		merged->quantPointCount += records[i].quantPointCount;
+	}
+	
+	// Points within a block are sorted by position (see Octree::retrieveQuantPointInNode)
+	std::sort(merged->points, merged->points + merged->quantPointCount, isQuantPointPositionSmaller);
+	
+	fseek(file, 0, SEEK_END);
+	const long filePosition = ftell(file);
+	if (!writeNodeRecord(file, merged)) logError("Merging octrees failed. Reason: Write failure.\n");
+	
+	delete[] childFilePositions;
+	delete merged;
+	delete[] records;
+	
+	return filePosition;
+}
+
+
+bool ParallelOctreeBuilder::build(const char* const filename)
+{
+#ifdef DEBUG
+	const double startTime = APIFactory::GetInstance().getTimeInMS();
+#endif
+	bool success = true;
+	
+	// Write the remaining points to the bins
+	for (uint32_t i = 0; i < _subtreeCount; ++i)
+	{
+		if (_bins[i].bufferedPointCount > 0) success &= flushBin(i);
+		delete[] _bins[i].points;
+		_bins[i].points = NULL;
+	}
+	
+	assignSubtreesToWorkers();
+	
+	// Build the subtrees
+	for (uint32_t i = 0; i < _workerCount; ++i)
+	{
+		if (_workers[i].pointCount == 0) continue;
+		
+		if (pthread_create(&(_workers[i].thread), NULL, runWorker, &(_workers[i])) != 0)
+		{
+			logError("Starting worker thread failed.\n");
+			_workers[i].pointCount = 0;
+			success = false;
+		}
+	}
+	
+	for (uint32_t i = 0; i < _workerCount; ++i)
+	{
+		if (_workers[i].pointCount == 0) continue;
+		
+		pthread_join(_workers[i].thread, NULL);
+		success &= _workers[i].success;
+	}
+	
+#ifdef DEBUG
+	const double mergeTime = APIFactory::GetInstance().getTimeInMS();
+#endif
+	
+	// Merge the worker files
+	FILE* file = fopen(filename, "wb+");
+	if (file == NULL)
+	{
+		logError("Merging octrees failed. Reason: Cannot open %s.\n", filename);
+		return false;
+	}
+	
+	static const size_t FILE_BUFFER_SIZE = 1024 * 1024;
+	setvbuf(file, NULL, _IOFBF, FILE_BUFFER_SIZE);
+	
+	// Reserve space for the root node at the beginning of the file
+	long rootChildrenFilePosition[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	fwrite(rootChildrenFilePosition, sizeof(Octree::Node*), 8, file);
+	
+	long* workerRootChildrenFilePosition = new long[8 * _workerCount];
+	uint32_t mergedWorkerCount = 0;
+	
+	for (uint32_t i = 0; i < _workerCount; ++i)
+	{
+		if (_workers[i].pointCount == 0) continue;
+		
+		if (appendWorkerFile(file, i, &(workerRootChildrenFilePosition[8 * mergedWorkerCount])))
+			++mergedWorkerCount;
+		else
+			success = false;
+	}
+	
+	// Merge the nodes above the split level
+	long* childFilePositions = new long[mergedWorkerCount];
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		uint32_t childCount = 0;
+		for (uint32_t j = 0; j < mergedWorkerCount; ++j)
+		{
+			if (workerRootChildrenFilePosition[8 * j + i] != 0)
+				childFilePositions[childCount++] = workerRootChildrenFilePosition[8 * j + i];
+		}
+		
+		if (childCount > 0) rootChildrenFilePosition[i] = mergeNodes(file, childFilePositions, childCount, 1);
+	}
+	
+	success &= BackingStore::writeFooter(file, &_worldTransform, _leafLevel);
+	
+	fseek(file, 0, SEEK_SET);
+	fwrite(rootChildrenFilePosition, sizeof(Octree::Node*), 8, file);
+	fclose(file);
+	
+	delete[] childFilePositions;
+	delete[] workerRootChildrenFilePosition;
+	
+#ifdef DEBUG
+	const double endTime = APIFactory::GetInstance().getTimeInMS();
+	logInfo("Built octree with %llu points: %.0f ms (%u workers), merge: %.0f ms",
+			(unsigned long long)_pointCount, endTime - startTime, _workerCount, endTime - mergeTime);
+#endif
+	
+	// Bins are consumed
+	for (uint32_t i = 0; i < _subtreeCount; ++i) _bins[i].pointCount = 0;
+	_pointCount = 0;
+	
+	return success;
+}
+
+
+}
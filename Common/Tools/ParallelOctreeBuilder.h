@@ -0,0 +1,133 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PARALLEL_OCTREE_BUILDER_H
+#define PARALLEL_OCTREE_BUILDER_H
+
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "Octree.h"
+
+
+namespace WVSClientCommon
+{
+
+
+/**
+	Builds a static point cloud file (see Octree::saveToDisk) with multiple threads.
+	
+	Points are binned by their subtree on the split level. Every worker thread owns an octree
+	(with its own memory pool and backing store) and inserts the points of the subtrees that are
+	assigned to it. Afterwards the worker files are concatenated and the nodes above the split level
+	are merged. A cell of a node on level L covers the same volume as a node on level L+3. Thus all
+	cells of the nodes above the split level belong to exactly one subtree if the split level is
+	smaller than 4 and the merge is a plain union of points.
+ */
+class ParallelOctreeBuilder
+{
+	static const uint8_t	MAX_SPLIT_LEVEL = 3;
+	static const uint32_t	BIN_BUFFER_POINT_COUNT = 4096;
+	static const uint32_t	INSERTION_BATCH_POINT_COUNT = 4096*2;
+	static const uint32_t	QUANTIZATION_BATCH_POINT_COUNT = 256;
+	
+	struct SubtreeBin
+	{
+		WVSPoint*			points;
+		uint32_t			bufferedPointCount;
+		uint64_t			pointCount;
+		uint32_t			workerID;
+	};
+	
+	struct Worker
+	{
+		ParallelOctreeBuilder*	builder;
+		pthread_t				thread;
+		uint32_t				workerID;
+		uint64_t				pointCount;
+		bool					success;
+	};
+	
+	const uint32_t		_workerCount;
+	const uint8_t		_splitLevel;
+	const uint32_t		_subtreeCount;
+	char				_tempFilePrefix[2048];
+	SubtreeBin*			_bins;
+	Worker*				_workers;
+	uint64_t			_pointCount;
+	Octree::WorldTransform	_worldTransform;
+	uint8_t				_leafLevel;
+	
+	void getTempFilename(char* const cBuffer, const int iLength, const char* const type, const uint32_t id) const;
+	
+	bool flushBin(const uint32_t subtreeID);
+	void assignSubtreesToWorkers();
+	
+	static void* runWorker(void* worker);
+	bool buildWorkerOctree(Worker* const worker);
+	
+	bool appendWorkerFile(FILE* const file, const uint32_t workerID, long* const outRootChildrenFilePosition);
+	long mergeNodes(FILE* const file, const long* const filePositions, const uint32_t count, const uint8_t level);
+
+
+public:
+	static const uint16_t	MAX_POINTS_PER_NODE = 8*8*8;
+	
+	// Node of a static point cloud file (see Octree::saveToDisk), also used by StaticOctreeMerger
+	struct NodeRecord
+	{
+		long				childrenFilePosition[8];
+		uint16_t			quantPointCount;
+		QuantPoint			points[MAX_POINTS_PER_NODE + OCTREE_POINTS_PER_POINT_DATA_BLOCK];
+	};
+	
+	// Read and write at the current file position
+	static bool readNodeRecord(FILE* const file, NodeRecord* const outRecord);
+	static bool writeNodeRecord(FILE* const file, NodeRecord* const record);
+	
+	ParallelOctreeBuilder(	const uint32_t workerCount,
+							const uint8_t splitLevel,
+							const char* const tempFilePrefix);
+	~ParallelOctreeBuilder();
+	
+	void addPoints(const WVSPoint* const points, const size_t count);
+	
+	// Stored in the point cloud file (see Octree::setWorldTransform)
+	void setWorldTransform(const Octree::WorldTransform* const transform);
+	
+	// Must be called before the first point is added (see Octree::setLeafLevel)
+	void setLeafLevel(const uint8_t leafLevel);
+	
+	bool build(const char* const filename);
+};
+
+
+}
+
+#endif // PARALLEL_OCTREE_BUILDER_H
@@ -32,6 +32,7 @@
 #include "Octree.h"
 #include "AppCore.h"
 #include <iostream>
+#include <algorithm>
 #include "Timer.h"
 #include "MemoryPool.h"
 
@@ -153,7 +154,7 @@ void MemoryPoolTest()
 	//resetTimer();
 	//memoryPool->setupElementBin(0, sizeof(Octree::Node), 4096 * 1024 * 16);
 	
-	Octree::Node* test, *parent;
+	Octree::Node* test;
 	int count = 1287456;
 	
 	resetTimer();
@@ -165,13 +166,64 @@ void MemoryPoolTest()
 		test = (Octree::Node*)malloc(sizeof(Octree::Node));
 #endif
 		if (test == NULL) printf("error");
-		test->parent = parent;
-		parent = test;
+		test->reset();
 	}
 	
 	printf("time: %.0fms\n", getElapsedTime());
 }
 
+/**
+	Follows child links through nodes in random order like the traversal of a large cut of the
+	octree. Compares small pages, transparent and explicit huge pages with and without binding
+	the memory to the NUMA node of this thread.
+ */
+void MemoryPoolTraversal()
+{
+	const size_t nodeCount = 10 * 1000 * 1000;
+	const size_t visitCount = 20 * 1000 * 1000;
+	const char* const hugePageModeNames[] = {"small pages", "transparent huge pages", "explicit huge pages"};
+	
+	for (uint8_t mode = MemoryPool::HUGE_PAGES_NONE; mode <= MemoryPool::HUGE_PAGES_EXPLICIT; ++mode)
+	{
+		for (uint8_t isBound = 0; isBound < 2; ++isBound)
+		{
+			MemoryPool* memoryPool = new MemoryPool(1, MemoryPool::HugePageMode(mode));
+			if (isBound && !memoryPool->bindToCurrentNUMANode())
+			{
+				delete memoryPool;
+				continue;
+			}
+			
+			memoryPool->setupElementBin(0, sizeof(Octree::Node), nodeCount * sizeof(Octree::Node));
+			Octree::Node** nodes = new Octree::Node*[nodeCount];
+			const size_t allocatedCount = memoryPool->binAllocElements(0, (void**)nodes, nodeCount);
+			
+			// Link the nodes to a random cycle by their indices (see Octree::NodeIndex)
+			const Octree::Node* const firstNode = (const Octree::Node*)memoryPool->getPayloadPointer(0);
+			srand(42);
+			for (size_t i = allocatedCount - 1; i > 0; --i) std::swap(nodes[i], nodes[size_t(rand()) % (i + 1)]);
+			for (size_t i = 0; i < allocatedCount; ++i)
+			{
+				nodes[i]->reset();
+				nodes[i]->children = nodes[(i + 1) % allocatedCount] - firstNode + 1;
+			}
+			
+			resetTimer();
+			const Octree::Node* node = nodes[0];
+			for (size_t i = 0; i < visitCount; ++i) node = &(firstNode[node->children - 1]);
+			const double elapsedTime = getElapsedTime();
+			
+			printf("%s%s: %.0fms (%.1fns per node, %li nodes) %p\n",
+				hugePageModeNames[mode], isBound ? ", NUMA bound" : "", elapsedTime,
+				elapsedTime * 1000000.0 / visitCount, allocatedCount, node);
+			
+			delete[] nodes;
+			delete memoryPool;
+		}
+	}
+}
+
+
 void MemoryAllocation()
 {
 	//http://developer.apple.com/iphone/library/documentation/Performance/Conceptual/ManagingMemory/Articles/MemoryAlloc.html
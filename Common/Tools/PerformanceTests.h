@@ -42,6 +42,7 @@ namespace Tests
 
 void NEONMemCpyTest();
 void MemoryPoolTest();
+void MemoryPoolTraversal();
 void OctreeInsertion();
 void MemoryAllocation();
 void JPEGDecodingSpeed(unsigned char *data, const size_t size);
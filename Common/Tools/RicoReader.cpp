@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "RicoReader.h"
+#include <string.h>
+#include <algorithm>
+
+
+namespace WVSClientCommon
+{
+
+
+RicoReader::RicoReader(const uint32_t workerCount) :
+	MappedPointReader(workerCount)
+{
+}
+
+
+bool RicoReader::parseHeader()
+{
+	// The tiles have no header
+	_vertexCount = _fileSize / RECORD_SIZE;
+	_vertexData = _fileData;
+	_vertexDataEnd = _fileData + _vertexCount * RECORD_SIZE;
+
+	return (_vertexCount > 0);
+}
+
+
+uint64_t RicoReader::calcChunkCount() const
+{
+	return (_vertexCount + CHUNK_POINT_COUNT - 1) / CHUNK_POINT_COUNT;
+}
+
+
+void RicoReader::decodeChunk(const uint64_t chunkID, Chunk* const chunk)
+{
+	const uint64_t firstVertex = chunkID * CHUNK_POINT_COUNT;
+	const uint32_t count = uint32_t(std::min(uint64_t(CHUNK_POINT_COUNT), _vertexCount - firstVertex));
+
+	chunk->pointCount = 0;
+	reserveChunkCapacity(chunk, count);
+
+	const char* record = _vertexData + firstVertex * RECORD_SIZE;
+	for (uint32_t i = 0; i < count; ++i, record += RECORD_SIZE)
+	{
+		resetPoint(chunk, i);
+		WVSPoint* const point = &(chunk->points[i]);
+
+		memcpy(&(point->position), record, sizeof(VECTOR3));
+		memcpy(&(point->color), record + sizeof(VECTOR3), sizeof(RGBColor));
+		transformPosition(&(point->position));
+	}
+
+	chunk->pointCount = count;
+}
+
+
+}
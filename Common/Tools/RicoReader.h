@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef RICO_READER_H
+#define RICO_READER_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MappedPointReader.h"
+
+
+namespace WVSClientCommon
+{
+
+
+/**
+	Reads the binary tiles of the Berlin data set (*.xyzrgba, see MappedPointReader). Every point
+	is stored as 16 byte record: x, y, z (float), red, green, blue, alpha (uint8). Alpha is ignored.
+ */
+class RicoReader : public MappedPointReader
+{
+	static const uint32_t	RECORD_SIZE = 16;
+	static const uint32_t	CHUNK_POINT_COUNT = 4096*4;
+
+
+protected:
+	virtual bool parseHeader();
+	virtual uint64_t calcChunkCount() const;
+	virtual void decodeChunk(const uint64_t chunkID, Chunk* const chunk);
+
+
+public:
+	RicoReader(const uint32_t workerCount);
+
+	uint64_t getVertexCount() const { return _vertexCount; }
+};
+
+
+}
+
+#endif // RICO_READER_H
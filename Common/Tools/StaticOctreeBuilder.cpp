@@ -0,0 +1,506 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "StaticOctreeBuilder.h"
+#include <string.h>
+#include <algorithm>
+#include "APIFactory.h"
+#include "BackingStore.h"
+
+
+namespace WVSClientCommon
+{
+
+
+// see Octree.cpp
+static inline uint64_t spreadBitsByThree(uint64_t value)
+{
+	value &= 0x1FFFFF;
+	value = (value | value << 32) & 0x1F00000000FFFFULL;
+	value = (value | value << 16) & 0x1F0000FF0000FFULL;
+	value = (value | value << 8) & 0x100F00F00F00F00FULL;
+	value = (value | value << 4) & 0x10C30C30C30C30C3ULL;
+	value = (value | value << 2) & 0x1249249249249249ULL;
+	return value;
+}
+
+
+// Inverse of spreadBitsByThree
+static inline uint32_t compactBitsByThree(uint64_t value)
+{
+	value &= 0x1249249249249249ULL;
+	value = (value | value >> 2) & 0x10C30C30C30C30C3ULL;
+	value = (value | value >> 4) & 0x100F00F00F00F00FULL;
+	value = (value | value >> 8) & 0x1F0000FF0000FFULL;
+	value = (value | value >> 16) & 0x1F00000000FFFFULL;
+	value = (value | value >> 32) & 0x1FFFFF;
+	return uint32_t(value);
+}
+
+
+StaticOctreeBuilder::StaticOctreeBuilder(const size_t maxPointsInMemory, const char* const tempFilePrefix) :
+	_maxPointsInMemory(maxPointsInMemory)
+{
+	assert(_maxPointsInMemory > 0);
+	assert(POSITION_BITS * 3 <= 64);
+	
+	// File positions are stored in the children pointers of a node
+	assert(sizeof(long) == sizeof(Octree::Node*));
+	
+	strncpy(_tempFilePrefix, tempFilePrefix, sizeof(_tempFilePrefix) - 1);
+	_tempFilePrefix[sizeof(_tempFilePrefix) - 1] = 0;
+	
+	_points = new SortPoint[_maxPointsInMemory];
+	_pointCount = 0;
+	_runCount = 0;
+	_totalPointCount = 0;
+	
+	_file = NULL;
+	_openNodes = NULL;
+	_recordPoints = NULL;
+	
+	_worldTransform.scale = 1.0f;
+	_worldTransform.translation.x = 0.0f;
+	_worldTransform.translation.y = 0.0f;
+	_worldTransform.translation.z = 0.0f;
+	_leafLevel = OCTREE_LEAF_LEVEL;
+}
+
+
+StaticOctreeBuilder::~StaticOctreeBuilder()
+{
+	// Remove runs of a build that never happened
+	char runFilename[2048];
+	for (uint32_t i = 0; i < _runCount; ++i)
+	{
+		getRunFilename(runFilename, 2048, i);
+		remove(runFilename);
+	}
+	
+	delete[] _points;
+}
+
+
+void StaticOctreeBuilder::getRunFilename(char* const cBuffer, const int iLength, const uint32_t runID) const
+{
+	snprintf(cBuffer, iLength, "%s.run%u", _tempFilePrefix, runID);
+}
+
+
+// In contrast to Octree::calcMortonKey the key contains all bits of the position. The lower bits
+// are necessary to quantize the points on the deepest levels.
+const uint64_t StaticOctreeBuilder::calcMortonKey(const Octree::FIXPVECTOR3* const position)
+{
+	assert(Octree::isWithinOctreeBounds(position));
+	
+	// Move origin to the bottom-back-left corner of the octree
+	static const int32_t halfEdgeLength = 1 << (POSITION_BITS - 1);
+	const uint64_t x = uint64_t(position->x + halfEdgeLength);
+	const uint64_t y = uint64_t(position->y + halfEdgeLength);
+	const uint64_t z = uint64_t(position->z + halfEdgeLength);
+	
+	return (spreadBitsByThree(x) | (spreadBitsByThree(y) << 1) | (spreadBitsByThree(z) << 2));
+}
+
+
+void StaticOctreeBuilder::decodeMortonKey(	const uint64_t mortonKey,
+											uint32_t* const outX,
+											uint32_t* const outY,
+											uint32_t* const outZ)
+{
+	*outX = compactBitsByThree(mortonKey);
+	*outY = compactBitsByThree(mortonKey >> 1);
+	*outZ = compactBitsByThree(mortonKey >> 2);
+}
+
+
+void StaticOctreeBuilder::setWorldTransform(const Octree::WorldTransform* const transform)
+{
+	_worldTransform = *transform;
+}
+
+
+void StaticOctreeBuilder::setLeafLevel(const uint8_t leafLevel)
+{
+	assert(_totalPointCount == 0);
+	
+	if ((leafLevel == 0) || (leafLevel > OCTREE_LEAF_LEVEL))
+	{
+		logError("Setting leaf level failed. Reason: Level %u is not supported.\n", leafLevel);
+		return;
+	}
+	
+	_leafLevel = leafLevel;
+}
+
+
+void StaticOctreeBuilder::addPoints(const WVSPoint* const points, const size_t count)
+{
+	Octree::FIXPVECTOR3 positions[QUANTIZATION_BATCH_POINT_COUNT];
+	uint16_t fiveBitColors[QUANTIZATION_BATCH_POINT_COUNT];
+	bool isWithinBounds[QUANTIZATION_BATCH_POINT_COUNT];
+	
+	for (size_t first = 0; first < count; first += QUANTIZATION_BATCH_POINT_COUNT)
+	{
+		const size_t batchCount = std::min(count - first, size_t(QUANTIZATION_BATCH_POINT_COUNT));
+		const WVSPoint* const batch = &(points[first]);
+		
+		// Transform floating point vectors in fix point format and quantize colors to 15 bpp
+		Octree::quantizePoints(batch, batchCount, positions, fiveBitColors, isWithinBounds);
+		
+		for (size_t i = 0; i < batchCount; ++i)
+		{
+			if (!isWithinBounds[i])
+			{
+				logError("Adding point failed. Reason: Position out of octree bounds.\n");
+				continue;
+			}
+			
+			// Run is full, sort it and move it to disk
+			if (_pointCount == _maxPointsInMemory) writeRun();
+			
+			SortPoint* const point = &(_points[_pointCount++]);
+			point->mortonKey = calcMortonKey(&(positions[i]));
+			point->insertionLevel = Octree::calcInsertionLevel(&(batch[i]), _leafLevel);
+			point->normalIndex = batch[i].normalIndex;
+			point->fiveBitColor = fiveBitColors[i];
+			
+			++_totalPointCount;
+		}
+	}
+}
+
+
+bool StaticOctreeBuilder::writeRun()
+{
+	std::sort(_points, _points + _pointCount);
+	
+	char runFilename[2048];
+	getRunFilename(runFilename, 2048, _runCount);
+	
+	FILE* file = fopen(runFilename, "wb");
+	if (file == NULL)
+	{
+		logError("Writing run failed. Reason: Cannot open %s.\n", runFilename);
+		_pointCount = 0;
+		return false;
+	}
+	
+	const size_t written = fwrite(_points, sizeof(SortPoint), _pointCount, file);
+	fclose(file);
+	
+	const bool success = (written == _pointCount);
+	if (!success) logError("Writing run failed. Reason: Write failure.\n");
+	
+	++_runCount;
+	_pointCount = 0;
+	
+	return success;
+}
+
+
+bool StaticOctreeBuilder::fillRun(Run* const run, const size_t bufferPointCount)
+{
+	run->pointCount = fread(run->points, sizeof(SortPoint), bufferPointCount, run->file);
+	run->readIndex = 0;
+	return (run->pointCount > 0);
+}
+
+
+// K-way merge of all runs. The memory of the in-memory run is shared between the run buffers.
+bool StaticOctreeBuilder::mergeRuns()
+{
+	size_t bufferPointCount = _maxPointsInMemory / _runCount;
+	if (bufferPointCount < MIN_RUN_BUFFER_POINT_COUNT) bufferPointCount = MIN_RUN_BUFFER_POINT_COUNT;
+	
+	delete[] _points;
+	_points = NULL;
+	
+	bool success = true;
+	char runFilename[2048];
+	Run* runs = new Run[_runCount];
+	uint32_t* heap = new uint32_t[_runCount];
+	uint32_t heapSize = 0;
+	
+	for (uint32_t i = 0; i < _runCount; ++i)
+	{
+		getRunFilename(runFilename, 2048, i);
+		runs[i].file = fopen(runFilename, "rb");
+		runs[i].points = new SortPoint[bufferPointCount];
+		runs[i].pointCount = 0;
+		runs[i].readIndex = 0;
+		
+		if (runs[i].file == NULL)
+		{
+			logError("Merging runs failed. Reason: Cannot open %s.\n", runFilename);
+			success = false;
+			continue;
+		}
+		
+		if (fillRun(&(runs[i]), bufferPointCount)) heap[heapSize++] = i;
+	}
+	
+	RunComparator comparator;
+	comparator.runs = runs;
+	std::make_heap(heap, heap + heapSize, comparator);
+	
+	while (heapSize > 0)
+	{
+		// Run with the smallest key is moved to the end of the heap
+		std::pop_heap(heap, heap + heapSize, comparator);
+		Run* const run = &(runs[heap[heapSize - 1]]);
+		
+		insertSortedPoint(&(run->points[run->readIndex]));
+		++(run->readIndex);
+		
+		if ((run->readIndex < run->pointCount) || fillRun(run, bufferPointCount))
+			std::push_heap(heap, heap + heapSize, comparator);
+		else
+			--heapSize;
+	}
+	
+	for (uint32_t i = 0; i < _runCount; ++i)
+	{
+		if (runs[i].file != NULL) fclose(runs[i].file);
+		delete[] runs[i].points;
+		
+		getRunFilename(runFilename, 2048, i);
+		remove(runFilename);
+	}
+	
+	delete[] heap;
+	delete[] runs;
+	
+	_runCount = 0;
+	_points = new SortPoint[_maxPointsInMemory];
+	
+	return success;
+}
+
+
+void StaticOctreeBuilder::openNode(const uint8_t level, const uint64_t pathKey)
+{
+	assert(level == _openLevel + 1);
+	assert(level <= OCTREE_LEAF_LEVEL);
+	
+	OpenNode* const node = &(_openNodes[level]);
+	node->pathKey = pathKey;
+	node->quantPointCount = 0;
+	for (uint8_t i = 0; i < 8; ++i) node->childrenFilePosition[i] = 0;
+	for (uint8_t i = 0; i < MAX_POINTS_PER_NODE / 64; ++i) node->occupancy[i] = 0;
+	
+	_openLevel = level;
+}
+
+
+// Writes the deepest open node to the file (see BackingStore::writeNodeToFile) and registers the
+// file position in its parent
+void StaticOctreeBuilder::closeNode()
+{
+	assert(_openLevel > 0);
+	
+	OpenNode* const node = &(_openNodes[_openLevel]);
+	assert(node->quantPointCount > 0);
+	
+	// Collect points ordered by position (see Octree::retrieveQuantPointInNode)
+	uint16_t count = 0;
+	for (uint16_t i = 0; i < MAX_POINTS_PER_NODE / 64; ++i)
+	{
+		uint64_t bits = node->occupancy[i];
+		while (bits != 0)
+		{
+			_recordPoints[count++] = node->cells[(i << 6) | __builtin_ctzll(bits)];
+			bits &= bits - 1;
+		}
+	}
+	assert(count == node->quantPointCount);
+	
+	// Points are stored in full blocks
+	const size_t blockCount =	(count + OCTREE_POINTS_PER_POINT_DATA_BLOCK - 1) /
+								OCTREE_POINTS_PER_POINT_DATA_BLOCK;
+	const size_t blockPointCount = blockCount * OCTREE_POINTS_PER_POINT_DATA_BLOCK;
+	memset(&(_recordPoints[count]), 0, (blockPointCount - count) * sizeof(QuantPoint));
+	
+	const long filePosition = _filePosition;
+	bool success = true;
+	success &= (fwrite(node->childrenFilePosition, sizeof(Octree::Node*), 8, _file) == 8);
+	success &= (fwrite(&count, sizeof(uint16_t), 1, _file) == 1);
+	success &= (fwrite(_recordPoints, sizeof(QuantPoint), blockPointCount, _file) == blockPointCount);
+	_filePosition += 8 * sizeof(Octree::Node*) + sizeof(uint16_t) + blockPointCount * sizeof(QuantPoint);
+	
+	if (!success && !_writeFailed)
+	{
+		logError("Building octree failed. Reason: Write failure.\n");
+		_writeFailed = true;
+	}
+	
+	++_nodeCount;
+	_quantPointCount += count;
+	
+	// Register node in parent
+	--_openLevel;
+	long* const parentChildrenFilePosition = (_openLevel == 0) ?	_rootChildrenFilePosition :
+																	_openNodes[_openLevel].childrenFilePosition;
+	parentChildrenFilePosition[node->pathKey & 7] = filePosition;
+}
+
+
+// Same as Octree::insertQuantPointIntoCachedNodes. The nodes on the path of the point are opened
+// and all nodes that are not on the path are closed (they will never be touched again).
+void StaticOctreeBuilder::insertSortedPoint(const SortPoint* const point)
+{
+	// The root node holds no points
+	if (point->insertionLevel == 0) return;
+	
+	// Close all nodes that are not on the path of the point (deepest node first)
+	while (	(_openLevel > 0) &&
+			(_openNodes[_openLevel].pathKey != (point->mortonKey >> (3 * (POSITION_BITS - _openLevel)))))
+	{
+		closeNode();
+	}
+	
+	// Open the missing nodes on the path
+	while (_openLevel < point->insertionLevel)
+	{
+		openNode(_openLevel + 1, point->mortonKey >> (3 * (POSITION_BITS - _openLevel - 1)));
+	}
+	
+	uint32_t x, y, z;
+	decodeMortonKey(point->mortonKey, &x, &y, &z);
+	
+	// Iterate over all LODs and insert the point
+	// Native bit is set for the finest level
+	uint16_t nativeBit = 1 << 15;
+	
+	for (uint8_t level = point->insertionLevel; level > 0; --level)
+	{
+		OpenNode* const node = &(_openNodes[level]);
+		
+		// A node is segmented in 8^3 cells. Thus a cell has the size of a node three levels deeper.
+		const uint8_t shift = POSITION_BITS - 3 - level;
+		const uint16_t cellID =	(((z >> shift) & 7) << 6) |
+								(((y >> shift) & 7) << 3) |
+								((x >> shift) & 7);
+		
+		QuantPoint* const quantPoint = &(node->cells[cellID]);
+		const uint64_t cellBit = uint64_t(1) << (cellID & 63);
+		
+		if (node->occupancy[cellID >> 6] & cellBit)
+		{
+			// Check if a native point is on your path to the root node
+			if ((quantPoint->isNative() == true) && (nativeBit == 0)) return;
+			
+			quantPoint->positionNormal = (cellID << 7) | point->normalIndex;
+			quantPoint->mergeColor(point->fiveBitColor, nativeBit);
+		}
+		else
+		{
+			node->occupancy[cellID >> 6] |= cellBit;
+			quantPoint->positionNormal = (cellID << 7) | point->normalIndex;
+			quantPoint->colorNative = point->fiveBitColor | nativeBit;
+			++(node->quantPointCount);
+		}
+		
+		// All lower levels provide no native point
+		nativeBit = 0;
+	}
+}
+
+
+bool StaticOctreeBuilder::build(const char* const filename)
+{
+#ifdef DEBUG
+	const double startTime = APIFactory::GetInstance().getTimeInMS();
+	const uint32_t runCount = (_pointCount > 0) ? _runCount + 1 : _runCount;
+#endif
+	
+	_file = fopen(filename, "wb");
+	if (_file == NULL)
+	{
+		logError("Building octree failed. Reason: Cannot open %s.\n", filename);
+		return false;
+	}
+	
+	static const size_t FILE_BUFFER_SIZE = 1024 * 1024;
+	setvbuf(_file, NULL, _IOFBF, FILE_BUFFER_SIZE);
+	
+	// Reserve space for the root node at the beginning of the file
+	for (uint8_t i = 0; i < 8; ++i) _rootChildrenFilePosition[i] = 0;
+	fwrite(_rootChildrenFilePosition, sizeof(Octree::Node*), 8, _file);
+	_filePosition = 8 * sizeof(Octree::Node*);
+	
+	_openNodes = new OpenNode[OCTREE_LEAF_LEVEL + 1];
+	_openLevel = 0;
+	_recordPoints = new QuantPoint[MAX_POINTS_PER_NODE + OCTREE_POINTS_PER_POINT_DATA_BLOCK];
+	_nodeCount = 0;
+	_quantPointCount = 0;
+	_writeFailed = false;
+	
+	bool success = true;
+	
+	if (_runCount == 0)
+	{
+		// All points fit into memory
+		std::sort(_points, _points + _pointCount);
+		for (size_t i = 0; i < _pointCount; ++i) insertSortedPoint(&(_points[i]));
+		_pointCount = 0;
+	}
+	else
+	{
+		if (_pointCount > 0) success &= writeRun();
+		success &= mergeRuns();
+	}
+	
+	// Write the remaining path
+	while (_openLevel > 0) closeNode();
+	
+	success &= BackingStore::writeFooter(_file, &_worldTransform, _leafLevel);
+	
+	fseek(_file, 0, SEEK_SET);
+	fwrite(_rootChildrenFilePosition, sizeof(Octree::Node*), 8, _file);
+	success &= (fclose(_file) == 0);
+	success &= !_writeFailed;
+	_file = NULL;
+	
+	delete[] _recordPoints;
+	delete[] _openNodes;
+	_recordPoints = NULL;
+	_openNodes = NULL;
+	
+#ifdef DEBUG
+	logInfo("Built octree with %llu points (%u runs): %u nodes, %llu quant points, %.0f ms",
+			(unsigned long long)_totalPointCount, runCount, _nodeCount,
+			(unsigned long long)_quantPointCount, APIFactory::GetInstance().getTimeInMS() - startTime);
+#endif
+	
+	_totalPointCount = 0;
+	
+	return success;
+}
+
+
+}
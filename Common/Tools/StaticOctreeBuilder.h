@@ -0,0 +1,152 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef STATIC_OCTREE_BUILDER_H
+#define STATIC_OCTREE_BUILDER_H
+
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "Octree.h"
+
+
+namespace WVSClientCommon
+{
+
+
+/**
+	Builds a static point cloud file (see StaticBackingStore) without a live octree.
+	
+	Points are collected in runs of bounded size. Every run is sorted by Morton key and written to
+	a temp file (external sort). The sorted runs are merged and the nodes are constructed while
+	streaming over the points. Because of the Morton order the points of a node's subtree are
+	contiguous. Thus only the nodes on the path of the current point are open at any time. A node
+	is written as soon as the stream leaves its subtree, which yields the post order layout of
+	Octree::saveToDisk. Memory consumption is limited by maxPointsInMemory.
+ */
+class StaticOctreeBuilder
+{
+	// Number of bits per dimension in the fix point format (see OCTREE_WORLD_EDGE_LENGTH)
+	static const uint8_t	POSITION_BITS = OCTREE_LEAF_LEVEL + 4;
+	static const uint16_t	MAX_POINTS_PER_NODE = 8*8*8;
+	static const size_t		MIN_RUN_BUFFER_POINT_COUNT = 4096;
+	static const size_t		QUANTIZATION_BATCH_POINT_COUNT = 256;
+	
+	struct SortPoint
+	{
+		uint64_t			mortonKey;
+		uint16_t			fiveBitColor;
+		uint8_t				normalIndex;
+		uint8_t				insertionLevel;
+		
+		inline bool operator<(const SortPoint& other) const
+		{
+			return (mortonKey < other.mortonKey);
+		}
+	};
+	
+	struct Run
+	{
+		FILE*				file;
+		SortPoint*			points;
+		size_t				pointCount;
+		size_t				readIndex;
+	};
+	
+	struct RunComparator
+	{
+		const Run*			runs;
+		
+		// Inverted to get a min heap
+		inline bool operator()(const uint32_t a, const uint32_t b) const
+		{
+			return (runs[b].points[runs[b].readIndex] < runs[a].points[runs[a].readIndex]);
+		}
+	};
+	
+	struct OpenNode
+	{
+		uint64_t			pathKey;
+		long				childrenFilePosition[8];
+		uint16_t			quantPointCount;
+		uint64_t			occupancy[MAX_POINTS_PER_NODE / 64];
+		QuantPoint			cells[MAX_POINTS_PER_NODE];
+	};
+	
+	const size_t		_maxPointsInMemory;
+	char				_tempFilePrefix[2048];
+	SortPoint*			_points;
+	size_t				_pointCount;
+	uint32_t			_runCount;
+	uint64_t			_totalPointCount;
+	
+	FILE*				_file;
+	long				_filePosition;
+	OpenNode*			_openNodes;
+	uint8_t				_openLevel;
+	long				_rootChildrenFilePosition[8];
+	QuantPoint*			_recordPoints;
+	uint32_t			_nodeCount;
+	uint64_t			_quantPointCount;
+	bool				_writeFailed;
+	Octree::WorldTransform	_worldTransform;
+	uint8_t				_leafLevel;
+	
+	void getRunFilename(char* const cBuffer, const int iLength, const uint32_t runID) const;
+	bool writeRun();
+	
+	static const uint64_t calcMortonKey(const Octree::FIXPVECTOR3* const position);
+	static void decodeMortonKey(const uint64_t mortonKey, uint32_t* const outX, uint32_t* const outY, uint32_t* const outZ);
+	
+	bool mergeRuns();
+	static bool fillRun(Run* const run, const size_t bufferPointCount);
+	
+	void insertSortedPoint(const SortPoint* const point);
+	void openNode(const uint8_t level, const uint64_t pathKey);
+	void closeNode();
+
+
+public:
+	StaticOctreeBuilder(const size_t maxPointsInMemory, const char* const tempFilePrefix);
+	~StaticOctreeBuilder();
+	
+	void addPoints(const WVSPoint* const points, const size_t count);
+	
+	// Stored in the point cloud file (see Octree::setWorldTransform)
+	void setWorldTransform(const Octree::WorldTransform* const transform);
+	
+	// Must be called before the first point is added (see Octree::setLeafLevel)
+	void setLeafLevel(const uint8_t leafLevel);
+	
+	bool build(const char* const filename);
+};
+
+
+}
+
+#endif // STATIC_OCTREE_BUILDER_H
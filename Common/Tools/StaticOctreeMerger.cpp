@@ -0,0 +1,312 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "StaticOctreeMerger.h"
+#include "APIFactory.h"
+#include "BackingStore.h"
+
+
+namespace WVSClientCommon
+{
+
+
+StaticOctreeMerger::StaticOctreeMerger() :	_baseFile(NULL),
+											_deltaFile(NULL),
+											_file(NULL),
+											_grids(NULL),
+											_success(true),
+											_copiedNodeCount(0),
+											_mergedNodeCount(0)
+{
+}
+
+
+bool StaticOctreeMerger::readNodeRecord(FILE* const file, const long filePosition, NodeRecord* const outRecord)
+{
+	if ((fseek(file, filePosition, SEEK_SET) != 0) || !ParallelOctreeBuilder::readNodeRecord(file, outRecord))
+	{
+		logError("Merging octrees failed. Reason: Read failure.\n");
+		_success = false;
+		
+		// Continue with an empty node
+		for (uint8_t i = 0; i < 8; ++i) outRecord->childrenFilePosition[i] = 0;
+		outRecord->quantPointCount = 0;
+		return false;
+	}
+	
+	return true;
+}
+
+
+// Appends the record to the output file and returns its file position
+long StaticOctreeMerger::writeNodeRecord(NodeRecord* const record)
+{
+	const long filePosition = ftell(_file);
+	
+	if (!ParallelOctreeBuilder::writeNodeRecord(_file, record))
+	{
+		logError("Merging octrees failed. Reason: Write failure.\n");
+		_success = false;
+	}
+	
+	return filePosition;
+}
+
+
+// Copies a subtree that is untouched by the merge. Returns the new file position of its root.
+long StaticOctreeMerger::copySubtree(FILE* const sourceFile, const long filePosition, NodeRecord* const outRecord)
+{
+	readNodeRecord(sourceFile, filePosition, outRecord);
+	
+	NodeRecord* childRecord = NULL;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		if (outRecord->childrenFilePosition[i] == 0) continue;
+		
+		if (childRecord == NULL) childRecord = new NodeRecord;
+		outRecord->childrenFilePosition[i] = copySubtree(sourceFile, outRecord->childrenFilePosition[i], childRecord);
+	}
+	delete childRecord;
+	
+	++_copiedNodeCount;
+	return writeNodeRecord(outRecord);
+}
+
+
+/**
+	Merges the nodes at the same position of the base and the delta file (one of them may be absent)
+	including their subtrees. Returns the new file position of the merged node.
+	
+	@param outRecord Receives the merged node. Its points are needed for the LODs of the parent.
+ */
+long StaticOctreeMerger::mergeSubtrees(	const long baseFilePosition,
+										const long deltaFilePosition,
+										const uint8_t level,
+										NodeRecord* const outRecord)
+{
+	assert((baseFilePosition != 0) || (deltaFilePosition != 0));
+	
+	// Untouched subtrees are copied
+	if (deltaFilePosition == 0) return copySubtree(_baseFile, baseFilePosition, outRecord);
+	if (baseFilePosition == 0) return copySubtree(_deltaFile, deltaFilePosition, outRecord);
+	
+	NodeRecord* baseRecord = new NodeRecord;
+	NodeRecord* deltaRecord = new NodeRecord;
+	NodeRecord* childRecord = new NodeRecord;
+	readNodeRecord(_baseFile, baseFilePosition, baseRecord);
+	readNodeRecord(_deltaFile, deltaFilePosition, deltaRecord);
+	
+	assert(level <= OCTREE_LEAF_LEVEL);
+	Octree::LODGrid* const grid = &(_grids[level]);
+	for (uint8_t i = 0; i < 8; ++i) grid->occupancy[i] = 0;
+	
+	// Merge children first (file is written in post order)
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		outRecord->childrenFilePosition[i] = 0;
+		
+		const long baseChild = baseRecord->childrenFilePosition[i];
+		const long deltaChild = deltaRecord->childrenFilePosition[i];
+		if ((baseChild == 0) && (deltaChild == 0)) continue;
+		
+		outRecord->childrenFilePosition[i] = mergeSubtrees(baseChild, deltaChild, level + 1, childRecord);
+		Octree::accumulateLODCells(grid, childRecord->points, childRecord->quantPointCount, i);
+	}
+	
+	mergePoints(baseRecord, deltaRecord, grid, outRecord);
+	
+	delete childRecord;
+	delete deltaRecord;
+	delete baseRecord;
+	
+	++_mergedNodeCount;
+	return writeNodeRecord(outRecord);
+}
+
+
+// Native points of both nodes are kept, all other cells get the LOD points of the merged children.
+// The points of a node are sorted by cell (see Octree::retrieveQuantPointInNode).
+void StaticOctreeMerger::mergePoints(	const NodeRecord* const baseRecord,
+										const NodeRecord* const deltaRecord,
+										const Octree::LODGrid* const grid,
+										NodeRecord* const outRecord) const
+{
+	static const uint16_t nativeBit = (1 << 15);
+	
+	uint16_t baseIndex = 0;
+	uint16_t deltaIndex = 0;
+	outRecord->quantPointCount = 0;
+	
+	for (uint16_t cellID = 0; cellID < ParallelOctreeBuilder::MAX_POINTS_PER_NODE; ++cellID)
+	{
+		const QuantPoint* basePoint = NULL;
+		if ((baseIndex < baseRecord->quantPointCount) && (baseRecord->points[baseIndex].getPosition() == (cellID << 7)))
+		{
+			basePoint = &(baseRecord->points[baseIndex++]);
+			if (!basePoint->isNative()) basePoint = NULL;
+		}
+		
+		const QuantPoint* deltaPoint = NULL;
+		if ((deltaIndex < deltaRecord->quantPointCount) && (deltaRecord->points[deltaIndex].getPosition() == (cellID << 7)))
+		{
+			deltaPoint = &(deltaRecord->points[deltaIndex++]);
+			if (!deltaPoint->isNative()) deltaPoint = NULL;
+		}
+		
+		QuantPoint* const quantPoint = &(outRecord->points[outRecord->quantPointCount]);
+		
+		if (basePoint != NULL)
+		{
+			*quantPoint = *basePoint;
+			if (deltaPoint != NULL) quantPoint->mergeColor(deltaPoint->colorNative & ~nativeBit, nativeBit);
+		}
+		else if (deltaPoint != NULL)
+		{
+			*quantPoint = *deltaPoint;
+		}
+		else if (grid->occupancy[cellID >> 6] & (uint64_t(1) << (cellID & 63)))
+		{
+			Octree::calcLODPoint(&(grid->cells[cellID]), cellID, quantPoint);
+		}
+		else
+		{
+			continue;
+		}
+		
+		++(outRecord->quantPointCount);
+	}
+	
+	assert(baseIndex == baseRecord->quantPointCount);
+	assert(deltaIndex == deltaRecord->quantPointCount);
+}
+
+
+bool StaticOctreeMerger::merge(const char* const baseFilename, const char* const deltaFilename, const char* const filename)
+{
+#ifdef DEBUG
+	const double startTime = APIFactory::GetInstance().getTimeInMS();
+#endif
+	
+	_baseFile = fopen(baseFilename, "rb");
+	_deltaFile = fopen(deltaFilename, "rb");
+	_file = fopen(filename, "wb");
+	
+	if ((_baseFile == NULL) || (_deltaFile == NULL) || (_file == NULL))
+	{
+		logError("Merging octrees failed. Reason: Cannot open %s, %s or %s.\n", baseFilename, deltaFilename, filename);
+		if (_baseFile != NULL) fclose(_baseFile);
+		if (_deltaFile != NULL) fclose(_deltaFile);
+		if (_file != NULL) fclose(_file);
+		_baseFile = _deltaFile = _file = NULL;
+		return false;
+	}
+	
+	static const size_t FILE_BUFFER_SIZE = 1024 * 1024;
+	setvbuf(_file, NULL, _IOFBF, FILE_BUFFER_SIZE);
+	
+	_success = true;
+	_copiedNodeCount = 0;
+	_mergedNodeCount = 0;
+	
+	long baseRootChildrenFilePosition[8];
+	long deltaRootChildrenFilePosition[8];
+	long rootChildrenFilePosition[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	
+	// Both files must be in the same octree coordinates and have the same depth
+	Octree::WorldTransform baseTransform;
+	Octree::WorldTransform deltaTransform;
+	uint8_t baseLeafLevel;
+	uint8_t deltaLeafLevel;
+	BackingStore::readFooter(_baseFile, &baseTransform, &baseLeafLevel);
+	BackingStore::readFooter(_deltaFile, &deltaTransform, &deltaLeafLevel);
+	fseek(_baseFile, 0, SEEK_SET);
+	fseek(_deltaFile, 0, SEEK_SET);
+	
+	if ((baseTransform.scale != deltaTransform.scale) ||
+		(baseTransform.translation.x != deltaTransform.translation.x) ||
+		(baseTransform.translation.y != deltaTransform.translation.y) ||
+		(baseTransform.translation.z != deltaTransform.translation.z))
+	{
+		logError("Merging octrees failed. Reason: World transforms differ.\n");
+		_success = false;
+	}
+	else if (baseLeafLevel != deltaLeafLevel)
+	{
+		logError("Merging octrees failed. Reason: Leaf levels differ.\n");
+		_success = false;
+	}
+	else if ((fread(baseRootChildrenFilePosition, sizeof(Octree::Node*), 8, _baseFile) != 8) ||
+		(fread(deltaRootChildrenFilePosition, sizeof(Octree::Node*), 8, _deltaFile) != 8))
+	{
+		logError("Merging octrees failed. Reason: Read failure.\n");
+		_success = false;
+	}
+	else
+	{
+		// Reserve space for the root node at the beginning of the file
+		fwrite(rootChildrenFilePosition, sizeof(Octree::Node*), 8, _file);
+		
+		_grids = new Octree::LODGrid[OCTREE_LEAF_LEVEL + 1];
+		NodeRecord* record = new NodeRecord;
+		
+		// Root node holds no points
+		for (uint8_t i = 0; i < 8; ++i)
+		{
+			if ((baseRootChildrenFilePosition[i] == 0) && (deltaRootChildrenFilePosition[i] == 0)) continue;
+			
+			rootChildrenFilePosition[i] = mergeSubtrees(	baseRootChildrenFilePosition[i],
+															deltaRootChildrenFilePosition[i],
+															1,
+															record);
+		}
+		
+		delete record;
+		delete[] _grids;
+		_grids = NULL;
+		
+		if (!BackingStore::writeFooter(_file, &baseTransform, baseLeafLevel)) _success = false;
+		
+		fseek(_file, 0, SEEK_SET);
+		if (fwrite(rootChildrenFilePosition, sizeof(Octree::Node*), 8, _file) != 8) _success = false;
+	}
+	
+	if (fclose(_file) != 0) _success = false;
+	fclose(_deltaFile);
+	fclose(_baseFile);
+	_baseFile = _deltaFile = _file = NULL;
+	
+#ifdef DEBUG
+	logInfo("Merged octrees: %u nodes merged, %u nodes copied, %.0f ms",
+			_mergedNodeCount, _copiedNodeCount, APIFactory::GetInstance().getTimeInMS() - startTime);
+#endif
+	
+	return _success;
+}
+
+
+}
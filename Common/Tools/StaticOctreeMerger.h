@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef STATIC_OCTREE_MERGER_H
+#define STATIC_OCTREE_MERGER_H
+
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "Octree.h"
+#include "ParallelOctreeBuilder.h"
+
+
+namespace WVSClientCommon
+{
+
+
+/**
+	Adds points to an existing static point cloud file (see Octree::saveToDisk) without rebuilding it
+	from the raw sources.
+	
+	The new points are built into a delta file first (e.g. with ParallelOctreeBuilder). The delta
+	touches only the subtrees that contain new points. Both files are traversed in parallel and a new
+	file is written in post order. Subtrees that exist in one file only are copied record by record
+	(only the file positions of the children are moved). Nodes that exist in both files get the
+	native points of both and their LOD points are synthesized again from the merged children
+	(see Octree::generateLODs). Thus the cost is proportional to the delta plus a sequential copy.
+	
+	A static file cannot be modified in place because its nodes are never written back
+	(see StaticBackingStore).
+ */
+class StaticOctreeMerger
+{
+	typedef ParallelOctreeBuilder::NodeRecord NodeRecord;
+	
+	FILE*				_baseFile;
+	FILE*				_deltaFile;
+	FILE*				_file;
+	Octree::LODGrid*	_grids;
+	bool				_success;
+	uint32_t			_copiedNodeCount;
+	uint32_t			_mergedNodeCount;
+	
+	bool readNodeRecord(FILE* const file, const long filePosition, NodeRecord* const outRecord);
+	long writeNodeRecord(NodeRecord* const record);
+	
+	long copySubtree(FILE* const sourceFile, const long filePosition, NodeRecord* const outRecord);
+	long mergeSubtrees(	const long baseFilePosition,
+						const long deltaFilePosition,
+						const uint8_t level,
+						NodeRecord* const outRecord);
+	
+	void mergePoints(	const NodeRecord* const baseRecord,
+						const NodeRecord* const deltaRecord,
+						const Octree::LODGrid* const grid,
+						NodeRecord* const outRecord) const;
+
+
+public:
+	StaticOctreeMerger();
+	
+	/**
+		Writes the union of the base and the delta file to a new file. Native points of the delta
+		that fall into the cell of a native base point are blended with it (like Octree::addPoint).
+		Both files must have the same world transform and leaf level. The output file must differ from both input
+		files.
+	 */
+	bool merge(const char* const baseFilename, const char* const deltaFilename, const char* const filename);
+};
+
+
+}
+
+#endif // STATIC_OCTREE_MERGER_H
@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "XYZReader.h"
+#include <string.h>
+
+
+namespace WVSClientCommon
+{
+
+
+XYZReader::XYZReader(const uint32_t workerCount) :
+	MappedPointReader(workerCount)
+{
+}
+
+
+bool XYZReader::parseHeader()
+{
+	const char* const fileEnd = _fileData + _fileSize;
+	const char* line = _fileData;
+
+	uint32_t columnCount = 0;
+	bool isColorNormalized = false;
+
+	while ((line < fileEnd) && (columnCount < 3))
+	{
+		const char* lineEnd = (const char*)memchr(line, '\n', fileEnd - line);
+		if (lineEnd == NULL) lineEnd = fileEnd;
+
+		const char* cursor = line;
+		const char* tokenBegin = cursor;
+		double value;
+
+		columnCount = 0;
+		isColorNormalized = false;
+
+		while ((columnCount < MAX_SNIFFED_COLUMN_COUNT) && parseNumber(&cursor, lineEnd, &value))
+		{
+			// Color columns
+			if ((columnCount >= 3) && (columnCount < 6) && memchr(tokenBegin, '.', cursor - tokenBegin)) isColorNormalized = true;
+
+			++columnCount;
+			tokenBegin = cursor;
+		}
+
+		if (columnCount >= 3) _vertexData = line;
+		line = lineEnd + 1;
+	}
+
+	if (columnCount < 3) return false;
+
+	addProperty(PROPERTY_TYPE_FLOAT64, PROPERTY_TYPE_INVALID, PROPERTY_USAGE_X);
+	addProperty(PROPERTY_TYPE_FLOAT64, PROPERTY_TYPE_INVALID, PROPERTY_USAGE_Y);
+	addProperty(PROPERTY_TYPE_FLOAT64, PROPERTY_TYPE_INVALID, PROPERTY_USAGE_Z);
+
+	if (columnCount >= 6)
+	{
+		// Float colors are scaled by 255 (see addProperty)
+		const PropertyType colorType = isColorNormalized ? PROPERTY_TYPE_FLOAT32 : PROPERTY_TYPE_UINT8;
+		addProperty(colorType, PROPERTY_TYPE_INVALID, PROPERTY_USAGE_RED);
+		addProperty(colorType, PROPERTY_TYPE_INVALID, PROPERTY_USAGE_GREEN);
+		addProperty(colorType, PROPERTY_TYPE_INVALID, PROPERTY_USAGE_BLUE);
+	}
+
+	if (columnCount >= 9)
+	{
+		addProperty(PROPERTY_TYPE_FLOAT32, PROPERTY_TYPE_INVALID, PROPERTY_USAGE_NX);
+		addProperty(PROPERTY_TYPE_FLOAT32, PROPERTY_TYPE_INVALID, PROPERTY_USAGE_NY);
+		addProperty(PROPERTY_TYPE_FLOAT32, PROPERTY_TYPE_INVALID, PROPERTY_USAGE_NZ);
+	}
+
+	// The point count is only known after all lines have been decoded
+	_vertexDataEnd = fileEnd;
+	_vertexCount = UNKNOWN_VERTEX_COUNT;
+
+	return true;
+}
+
+
+}
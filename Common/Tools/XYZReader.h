@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2011, Lars Schneider
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  Redistributions of source code must retain the above copyright notice, this
+ *  list of conditions and the following disclaimer.
+ *  Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef XYZ_READER_H
+#define XYZ_READER_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MappedPointReader.h"
+
+
+namespace WVSClientCommon
+{
+
+
+/**
+	Reads a text point file with one point per line (see MappedPointReader). Values are separated
+	by spaces, tabs, commas or semicolons (XYZ, TXT and CSV files).
+
+	The columns are determined by the first line that starts with at least three numbers:
+		3 - 5 columns:		x y z
+		6 - 8 columns:		x y z red green blue
+		9 or more columns:	x y z red green blue nx ny nz
+	Additional columns are ignored. Colors with a decimal point are expected in [0, 1], otherwise
+	in [0, 255]. Lines in front of the first point (e.g. column titles) are skipped.
+ */
+class XYZReader : public MappedPointReader
+{
+	static const uint32_t	MAX_SNIFFED_COLUMN_COUNT = 9;
+
+
+protected:
+	virtual bool parseHeader();
+
+
+public:
+	XYZReader(const uint32_t workerCount);
+};
+
+
+}
+
+#endif // XYZ_READER_H
@@ -46,6 +46,7 @@
 - (void)performanceTest
 {
 	WVSClientCommon::Tests::MemoryPoolTest();
+	WVSClientCommon::Tests::MemoryPoolTraversal();
 }
 #endif
 